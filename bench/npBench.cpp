@@ -0,0 +1,418 @@
+#include "countsMatrix.h"
+#include "eventBinning.h"
+#include "nexusFile.h"
+#include "nexusTemplate.h"
+#include "processors.h"
+#include "syntheticNeXuS.h"
+#include "tofBinning.h"
+#include "window.h"
+#include <CLI/App.hpp>
+#include <CLI/Config.hpp>
+#include <CLI/Formatter.hpp>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fmt/core.h>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+namespace
+{
+/*
+ * Measurement
+ */
+
+// Result of a single benchmark
+struct BenchmarkResult
+{
+    // Benchmark name
+    std::string name;
+    // Elapsed wall time (seconds)
+    double seconds{0.0};
+    // Number of events and bytes processed
+    unsigned long long events{0}, bytes{0};
+    // Peak resident set size during the benchmark (bytes)
+    unsigned long long peakRSS{0};
+
+    // Return processing rates (per second)
+    [[nodiscard]] double eventsPerSecond() const { return seconds > 0.0 ? events / seconds : 0.0; }
+    [[nodiscard]] double bytesPerSecond() const { return seconds > 0.0 ? bytes / seconds : 0.0; }
+};
+
+// Reset the peak resident set size of the process, returning false if this is not possible
+bool resetPeakRSS()
+{
+    // Writing "5" to clear_refs resets VmHWM on Linux
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    if (!clearRefs)
+        return false;
+    clearRefs << "5";
+    clearRefs.close();
+    return !clearRefs.fail();
+}
+
+// Return peak resident set size of the process (bytes) since it started or was last reset
+unsigned long long peakRSS()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+        if (line.rfind("VmHWM:", 0) == 0)
+            return std::stoull(line.substr(6)) * 1024;
+
+    // Fall back to the (never reset) peak of the whole process
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss * 1024ULL;
+}
+
+// Run the supplied benchmark function, which returns the number of events and bytes it processed
+BenchmarkResult measure(std::string name, const std::function<std::pair<unsigned long long, unsigned long long>()> &function)
+{
+    fmt::print("Benchmark '{}'...\n", name);
+    resetPeakRSS();
+
+    BenchmarkResult result;
+    result.name = std::move(name);
+    auto start = std::chrono::steady_clock::now();
+    std::tie(result.events, result.bytes) = function();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    result.seconds = elapsed.count();
+    result.peakRSS = peakRSS();
+
+    return result;
+}
+
+// Return size of the specified file, or zero if it does not exist
+unsigned long long fileSize(const std::string &filename)
+{
+    std::error_code error;
+    auto size = std::filesystem::file_size(filename, error);
+    return error ? 0 : size;
+}
+
+// Return the number of events in the supplied files which fall inside occurrences of the window, and so are binned by the
+// processors
+unsigned long long windowEvents(const std::vector<std::string> &files, const Window &window, double windowDelta)
+{
+    unsigned long long nEvents = 0;
+    for (const auto &file : files)
+    {
+        NeXuSFile nxs(file);
+        nxs.loadTimes();
+        nxs.loadFrameData();
+        const auto &frameFirstEvents = nxs.frameFirstEvents();
+        for (const auto &range : Processors::selectWindowFrames(nxs, window, windowDelta))
+            nEvents += frameFirstEvents[range.lastFrame] - frameFirstEvents[range.firstFrame];
+    }
+
+    return nEvents;
+}
+
+/*
+ * Event Binning Kernels
+ */
+
+// Synthetic event block for binning benchmarks
+struct EventBlock
+{
+    std::vector<int> eventIndices;
+    std::vector<double> eventTimes;
+};
+
+// Generate random events over the specified spectra and TOF range
+EventBlock generateEvents(std::size_t nEvents, int nSpectra, double tofMin, double tofMax)
+{
+    std::mt19937_64 generator(12345);
+    std::uniform_int_distribution<int> spectrum(0, nSpectra);
+    std::uniform_real_distribution<double> tof(tofMin, tofMax);
+
+    EventBlock events;
+    events.eventIndices.resize(nEvents);
+    events.eventTimes.resize(nEvents);
+    for (auto i = 0; i < nEvents; ++i)
+    {
+        events.eventIndices[i] = spectrum(generator);
+        events.eventTimes[i] = tof(generator);
+    }
+
+    return events;
+}
+
+// Benchmark event binning with the specified kernel
+BenchmarkResult benchmarkBinning(const std::string &name, EventBinning::InstructionSet set, const EventBlock &events,
+                                 const std::vector<int> &spectrumRows, const TOFBinning &tofBinning, int nRepeats)
+{
+    CountsMatrix counts(spectrumRows.size() - 1, tofBinning.nBins());
+
+    return measure(fmt::format("binEvents/{}/{}", name, EventBinning::instructionSet(set)),
+                   [&]()
+                   {
+                       for (auto n = 0; n < nRepeats; ++n)
+                           EventBinning::binEvents(set, events.eventIndices.data(), events.eventTimes.data(),
+                                                   events.eventIndices.size(), spectrumRows, tofBinning, counts);
+                       unsigned long long nEvents = events.eventIndices.size() * nRepeats;
+                       return std::make_pair(nEvents, nEvents * (sizeof(int) + sizeof(double)));
+                   });
+}
+
+// Benchmark all available binning kernels over a range of TOF binning schemes
+void benchmarkKernels(std::vector<BenchmarkResult> &results, std::size_t nEvents, int nSpectra, int nBins, int nRepeats)
+{
+    // Spectrum ids run from 1 to nSpectra, so rows are simply offset by one
+    std::vector<int> spectrumRows(nSpectra + 1, -1);
+    for (auto id = 1; id <= nSpectra; ++id)
+        spectrumRows[id] = id - 1;
+
+    // Binning schemes to test
+    std::vector<std::pair<std::string, std::vector<double>>> binnings(3);
+    binnings[0].first = "linear";
+    binnings[1].first = "logarithmic";
+    binnings[2].first = "irregular";
+    std::mt19937_64 generator(54321);
+    for (auto i = 0; i <= nBins; ++i)
+    {
+        binnings[0].second.push_back(1000.0 + i * 9.5);
+        binnings[1].second.push_back(1000.0 * std::pow(1.001, i));
+        binnings[2].second.push_back(i == 0 ? 1000.0 : binnings[2].second.back() + 1.0 + (generator() % 1700) / 100.0);
+    }
+
+    for (auto &&[name, edges] : binnings)
+    {
+        TOFBinning tofBinning(edges);
+        auto events = generateEvents(nEvents, nSpectra, edges.front(), edges.back());
+        for (auto set : {EventBinning::InstructionSet::Scalar, EventBinning::InstructionSet::AVX2,
+                         EventBinning::InstructionSet::AVX512})
+            if (EventBinning::isSupported(set))
+                results.push_back(benchmarkBinning(name, set, events, spectrumRows, tofBinning, nRepeats));
+    }
+}
+
+/*
+ * Output
+ */
+
+// Write results and configuration as JSON to the specified stream
+void writeJSON(std::FILE *output, const SyntheticRun &run, int nFiles, int nThreads, bool mapping,
+               const std::vector<BenchmarkResult> &results)
+{
+    fmt::print(output, "{{\n  \"config\": {{\"spectra\": {}, \"bins\": {}, \"frames\": {}, \"events_per_frame\": {}, "
+                       "\"distribution\": \"{}\", \"files\": {}, \"threads\": {}, \"mmap\": {}}},\n",
+               run.nSpectra, run.nBins, run.nFrames, run.eventsPerFrame, SyntheticRun::distributionName(run.distribution),
+               nFiles, nThreads, mapping ? "true" : "false");
+    fmt::print(output, "  \"benchmarks\": [\n");
+    for (auto i = 0; i < results.size(); ++i)
+    {
+        const auto &result = results[i];
+        fmt::print(output,
+                   "    {{\"benchmark\": \"{}\", \"seconds\": {:.6f}, \"events\": {}, \"bytes\": {}, "
+                   "\"events_per_second\": {:.1f}, \"bytes_per_second\": {:.1f}, \"peak_rss_bytes\": {}}}{}\n",
+                   result.name, result.seconds, result.events, result.bytes, result.eventsPerSecond(),
+                   result.bytesPerSecond(), result.peakRSS, i == results.size() - 1 ? "" : ",");
+    }
+    fmt::print(output, "  ]\n}}\n");
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    // Synthetic run definition
+    SyntheticRun run;
+    std::string distribution_{"uniform"};
+    // Number of synthetic files to generate and process
+    int nFiles_{1};
+    // Number of repeats for templating / saving and kernel benchmarks
+    int nRepeats_{5};
+    // Number of events for kernel benchmarks
+    unsigned long long kernelEvents_{10000000};
+    // Number of slices for processing benchmarks
+    int nSlices_{5};
+    // Working directory for generated and output files
+    std::string workDirectory_{"np_bench_work"};
+    // JSON results file
+    std::string outputFile_{"np_bench.json"};
+    // Whether to generate the synthetic files and stop
+    bool generateOnly_{false};
+    // Whether to skip kernel benchmarks
+    bool skipKernels_{false};
+    // Whether to disable memory mapping of event data
+    bool noMapping_{false};
+
+    CLI::App app("np_bench - Benchmarks for nexus-process using synthetic ISIS NeXuS event files.");
+    app.add_option("--spectra", run.nSpectra, "Number of detector spectra")->group("Synthetic Data");
+    app.add_option("--bins", run.nBins, "Number of TOF bins")->group("Synthetic Data");
+    app.add_option("--frames", run.nFrames, "Number of frames per file")->group("Synthetic Data");
+    app.add_option("--events-per-frame", run.eventsPerFrame, "Mean number of events per frame")->group("Synthetic Data");
+    app.add_option("--distribution", distribution_, "Hit distribution (uniform, hot-spectrum, or bursty)")
+        ->group("Synthetic Data");
+    app.add_option("--files", nFiles_, "Number of consecutive run files to generate")->group("Synthetic Data");
+    app.add_option("--seed", run.seed, "Random seed for the first file")->group("Synthetic Data");
+    app.add_flag("--generate-only", generateOnly_, "Generate synthetic files in the work directory and exit")
+        ->group("Synthetic Data");
+    app.add_option("--repeats", nRepeats_, "Number of repeats for templating, saving and kernel benchmarks")
+        ->group("Benchmarks");
+    app.add_option("--kernel-events", kernelEvents_, "Number of events for binning kernel benchmarks")->group("Benchmarks");
+    app.add_flag("--skip-kernels", skipKernels_, "Skip binning kernel benchmarks")->group("Benchmarks");
+    app.add_option("--slices", nSlices_, "Number of slices for processing benchmarks")->group("Benchmarks");
+    app.add_option("-t,--threads", Processors::nThreads_, "Number of threads to use when binning events")
+        ->group("Benchmarks");
+    app.add_flag("--no-mmap", noMapping_, "Always read event data into memory rather than mapping it from files")
+        ->group("Benchmarks");
+    app.add_option("--work-dir", workDirectory_, "Directory for generated and output files")->group("Output");
+    app.add_option("-o,--output", outputFile_, "File to write JSON results to (default is np_bench.json)")->group("Output");
+
+    CLI11_PARSE(app, argc, argv);
+
+    if (!SyntheticRun::distributionFromName(distribution_, run.distribution))
+    {
+        fmt::print("Error: Unrecognised hit distribution '{}'.\n", distribution_);
+        return 1;
+    }
+    if (run.nSpectra < 1 || run.nBins < 1 || run.nFrames < 1 || run.eventsPerFrame < 0 || nFiles_ < 1)
+    {
+        fmt::print("Error: Spectra, bins, frames and files must be positive, and events per frame not negative.\n");
+        return 1;
+    }
+    if (nRepeats_ < 1 || nSlices_ < 1 || Processors::nThreads_ < 1)
+    {
+        fmt::print("Error: Repeats, slices and threads must be positive.\n");
+        return 1;
+    }
+    NeXuSFile::setEventMapping(!noMapping_);
+
+    std::vector<BenchmarkResult> results;
+
+    // Generate consecutive synthetic run files
+    std::filesystem::create_directories(workDirectory_);
+    std::vector<std::string> files;
+    unsigned long long nEvents = 0, fileBytes = 0;
+    results.push_back(measure("generate",
+                              [&]()
+                              {
+                                  auto fileRun = run;
+                                  for (auto i = 0; i < nFiles_; ++i)
+                                  {
+                                      files.push_back(fmt::format("{}/synthetic_{}.nxs", workDirectory_, i + 1));
+                                      fmt::print("... writing '{}'...\n", files.back());
+                                      nEvents += writeSyntheticNeXuS(files.back(), fileRun);
+                                      fileBytes += fileSize(files.back());
+                                      fileRun.startTime = fileRun.endTime();
+                                      ++fileRun.seed;
+                                  }
+                                  return std::make_pair(nEvents, fileBytes);
+                              }));
+    if (generateOnly_)
+        return 0;
+
+    // Loading event data - events are summed afterwards so that mapped data is actually read from the file
+    unsigned long long checksum = 0;
+    results.push_back(measure("loadEventData",
+                              [&]()
+                              {
+                                  unsigned long long bytes = 0;
+                                  for (const auto &file : files)
+                                  {
+                                      NeXuSFile nxs(file);
+                                      nxs.loadEventData();
+                                      nxs.visitEvents(
+                                          [&](auto eventIndices, auto eventTimes)
+                                          {
+                                              for (auto k = 0; k < eventIndices.size(); ++k)
+                                                  checksum += eventIndices[k] + (eventTimes[k] > 0.0 ? 1 : 0);
+                                          });
+                                      bytes += nxs.nEvents() * nxs.eventSize();
+                                  }
+                                  return std::make_pair(nEvents, bytes);
+                              }));
+    fmt::print("... event checksum is {}.\n", checksum);
+
+    // Templating and saving output files
+    std::vector<NeXuSFile> outputs(nRepeats_);
+    results.push_back(measure("templateFile",
+                              [&]()
+                              {
+                                  auto nxsTemplate = NeXuSTemplate::get(files.front());
+                                  unsigned long long bytes = 0;
+                                  for (auto i = 0; i < nRepeats_; ++i)
+                                  {
+                                      auto filename = fmt::format("{}/template_{}.nxs", workDirectory_, i + 1);
+                                      outputs[i].templateFile(*nxsTemplate, filename);
+                                      bytes += fileSize(filename);
+                                  }
+                                  return std::make_pair(0ULL, bytes);
+                              }));
+    results.push_back(measure("saveModifiedData",
+                              [&]()
+                              {
+                                  unsigned long long bytes = 0;
+                                  for (auto &output : outputs)
+                                  {
+                                      output.saveModifiedData();
+                                      bytes += output.countsStorageSize();
+                                  }
+                                  return std::make_pair(0ULL, bytes);
+                              }));
+    outputs.clear();
+
+    // Processing - each window covers a twentieth of the total run time, and they are spaced every tenth
+    NeXuSFile first(files.front());
+    first.loadTimes();
+    auto runLength = nFiles_ * std::ceil(run.nFrames * run.frameInterval);
+    Window window("np_bench", first.startSinceEpoch(), runLength / 20.0);
+    auto windowDelta = runLength / 10.0;
+    auto eventFileBytes = nEvents * (sizeof(unsigned int) + sizeof(float));
+    auto outputPrefix = workDirectory_ + "/";
+    // Only events inside the windows are binned (and read), so rates are given for those alone
+    auto nWindowEvents = windowEvents(files, window, windowDelta);
+    auto windowEventBytes = nWindowEvents * (sizeof(unsigned int) + sizeof(float));
+    results.push_back(measure("processSummed",
+                              [&]()
+                              {
+                                  Processors::processSummed(files, outputPrefix, window, nSlices_, windowDelta);
+                                  return std::make_pair(nWindowEvents, windowEventBytes);
+                              }));
+    results.push_back(measure("processIndividual",
+                              [&]()
+                              {
+                                  Processors::processIndividual(files, outputPrefix, window, nSlices_, windowDelta);
+                                  return std::make_pair(nWindowEvents, windowEventBytes);
+                              }));
+
+    // Event extraction for one spectrum in a hundred
+    std::vector<int> spectra;
+    for (auto id = 1; id <= run.nSpectra; id += 100)
+        spectra.push_back(id);
+    results.push_back(measure("getEvents",
+                              [&]()
+                              {
+                                  Processors::getEvents(files, spectra, workDirectory_ + "/events.bin", false);
+                                  return std::make_pair(nEvents, eventFileBytes);
+                              }));
+
+    // Binning kernels
+    if (!skipKernels_)
+        benchmarkKernels(results, kernelEvents_, run.nSpectra, run.nBins, nRepeats_);
+
+    // Summarise results
+    fmt::print("\n{:40} {:>12} {:>14} {:>12} {:>12}\n", "Benchmark", "Seconds", "Mevents/s", "MiB/s", "Peak RSS MiB");
+    for (const auto &result : results)
+        fmt::print("{:40} {:12.4f} {:14.2f} {:12.1f} {:12.1f}\n", result.name, result.seconds,
+                   result.eventsPerSecond() / 1.0e6, result.bytesPerSecond() / 1048576.0, result.peakRSS / 1048576.0);
+
+    // Write machine-readable results to their own file, since the processors report their progress on stdout
+    auto *output = std::fopen(outputFile_.c_str(), "w");
+    if (!output)
+    {
+        fmt::print("Error: Failed to open '{}' for writing.\n", outputFile_);
+        return 1;
+    }
+    writeJSON(output, run, nFiles_, Processors::nThreads_, !noMapping_, results);
+    std::fclose(output);
+    fmt::print("Results written to '{}'.\n", outputFile_);
+
+    return 0;
+}
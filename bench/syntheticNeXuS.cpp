@@ -0,0 +1,179 @@
+#include "syntheticNeXuS.h"
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+/*
+ * Synthetic files contain the paths read by np from real ISIS raw files - run title, user, start and end times, frame
+ * counts, nine monitors with TOF bins on the first, detector spectra and (zeroed) counts, event data stored as uint32 ids
+ * and float32 time offsets, frame zeros, and the events-per-frame log.
+ */
+
+namespace
+{
+// Write a scalar string dataset
+void writeString(H5::Group &group, const std::string &name, const std::string &value)
+{
+    H5::StrType type(H5::PredType::C_S1, std::max(value.size(), std::size_t(1)));
+    hsize_t dims = 1;
+    group.createDataSet(name, type, H5::DataSpace(1, &dims)).write(value, type);
+}
+
+// Write a dataset with the specified file type and dimensions from the supplied data
+template <class T>
+void writeData(H5::Group &group, const std::string &name, const H5::PredType &fileType, const H5::PredType &memType,
+               const std::vector<hsize_t> &dims, const std::vector<T> &data)
+{
+    group.createDataSet(name, fileType, H5::DataSpace(dims.size(), dims.data())).write(data.data(), memType);
+}
+
+// Return ISO 8601 time string for the specified start time plus a number of seconds
+std::string offsetTime(const std::string &startTime, int seconds)
+{
+    std::tm time = {0};
+    if (sscanf(startTime.c_str(), "%d-%d-%dT%d:%d:%d", &time.tm_year, &time.tm_mon, &time.tm_mday, &time.tm_hour,
+               &time.tm_min, &time.tm_sec) != 6)
+        throw(std::runtime_error("Invalid start time '" + startTime + "'.\n"));
+    time.tm_year -= 1900;
+    time.tm_mon -= 1;
+    time.tm_sec += seconds;
+    time.tm_isdst = -1;
+    mktime(&time);
+
+    char buffer[32];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &time);
+    return buffer;
+}
+} // namespace
+
+// Return run end time (ISO 8601), rounded up to the next whole second
+std::string SyntheticRun::endTime() const { return offsetTime(startTime, int(std::ceil(nFrames * frameInterval))); }
+
+// Return text name for the specified distribution
+std::string SyntheticRun::distributionName(HitDistribution distribution)
+{
+    switch (distribution)
+    {
+        case (HitDistribution::Uniform):
+            return "uniform";
+        case (HitDistribution::HotSpectrum):
+            return "hot-spectrum";
+        case (HitDistribution::Bursty):
+            return "bursty";
+        default:
+            throw(std::runtime_error("Unhandled hit distribution.\n"));
+    }
+}
+
+// Convert text name to distribution, returning false if it is not recognised
+bool SyntheticRun::distributionFromName(const std::string &name, HitDistribution &distribution)
+{
+    for (auto d : {HitDistribution::Uniform, HitDistribution::HotSpectrum, HitDistribution::Bursty})
+        if (name == distributionName(d))
+        {
+            distribution = d;
+            return true;
+        }
+    return false;
+}
+
+// Write a synthetic NeXuS event file with the specified parameters, returning the number of events written
+hsize_t writeSyntheticNeXuS(const std::string &filename, const SyntheticRun &run)
+{
+    if (run.nSpectra < 1 || run.nBins < 1 || run.nFrames < 1 || run.eventsPerFrame < 0 || run.frameInterval <= 0.0)
+        throw(std::runtime_error("Invalid synthetic run parameters.\n"));
+
+    std::mt19937_64 generator(run.seed);
+
+    H5::H5File file(filename, H5F_ACC_TRUNC);
+    auto root = file.createGroup("raw_data_1");
+
+    // Run information
+    writeString(root, "title", "Synthetic " + SyntheticRun::distributionName(run.distribution) + " run");
+    auto user = root.createGroup("user_1");
+    writeString(user, "name", "np_bench");
+    writeString(root, "start_time", run.startTime);
+    writeString(root, "end_time", run.endTime());
+    writeData(root, "good_frames", H5::PredType::STD_I32LE, H5::PredType::NATIVE_INT, {1}, std::vector<int>{run.nFrames});
+    writeData(root, "raw_frames", H5::PredType::STD_I32LE, H5::PredType::NATIVE_INT, {1}, std::vector<int>{run.nFrames});
+
+    // TOF bins are linear between 1000 and 20000 microseconds
+    const auto tofMin = 1000.0, tofMax = 20000.0;
+    std::vector<float> tofBins(run.nBins + 1);
+    for (auto i = 0; i <= run.nBins; ++i)
+        tofBins[i] = float(tofMin + i * (tofMax - tofMin) / run.nBins);
+
+    // Monitors
+    std::uniform_int_distribution<int> monitorCount(0, 1000);
+    for (auto m = 1; m <= 9; ++m)
+    {
+        auto monitor = root.createGroup("monitor_" + std::to_string(m));
+        std::vector<int> counts(run.nBins);
+        for (auto &count : counts)
+            count = monitorCount(generator);
+        writeData(monitor, "data", H5::PredType::STD_I32LE, H5::PredType::NATIVE_INT, {1, 1, hsize_t(run.nBins)}, counts);
+        if (m == 1)
+            writeData(monitor, "time_of_flight", H5::PredType::IEEE_F32LE, H5::PredType::NATIVE_FLOAT,
+                      {hsize_t(run.nBins + 1)}, tofBins);
+    }
+
+    // Detector spectra and counts
+    auto detector = root.createGroup("detector_1");
+    std::vector<int> spectra(run.nSpectra);
+    for (auto i = 0; i < run.nSpectra; ++i)
+        spectra[i] = i + 1;
+    writeData(detector, "spectrum_index", H5::PredType::STD_I32LE, H5::PredType::NATIVE_INT, {hsize_t(run.nSpectra)},
+              spectra);
+    writeData(detector, "counts", H5::PredType::STD_I32LE, H5::PredType::NATIVE_INT,
+              {1, hsize_t(run.nSpectra), hsize_t(run.nBins)}, std::vector<int>(std::size_t(run.nSpectra) * run.nBins, 0));
+
+    // Events per frame - bursty runs have one frame in ten carrying most of the events
+    std::vector<int> eventsPerFrame(run.nFrames);
+    std::poisson_distribution<int> quietFrame(std::max(run.eventsPerFrame * 0.2, 1.0e-3));
+    std::poisson_distribution<int> burstFrame(std::max(run.eventsPerFrame * 8.2, 1.0e-3));
+    std::poisson_distribution<int> normalFrame(std::max(double(run.eventsPerFrame), 1.0e-3));
+    for (auto i = 0; i < run.nFrames; ++i)
+    {
+        if (run.distribution == SyntheticRun::HitDistribution::Bursty)
+            eventsPerFrame[i] = i % 10 == 0 ? burstFrame(generator) : quietFrame(generator);
+        else
+            eventsPerFrame[i] = normalFrame(generator);
+    }
+
+    // Events - hot-spectrum runs send half of all events to one spectrum in a hundred (or just the last spectrum, if there are
+    // fewer than a hundred)
+    std::vector<unsigned int> eventIds;
+    std::vector<float> eventTimes;
+    const auto hotStride = std::min(run.nSpectra, 100);
+    std::uniform_int_distribution<int> anySpectrum(1, run.nSpectra);
+    std::uniform_int_distribution<int> hotSpectrum(1, run.nSpectra / hotStride);
+    std::uniform_real_distribution<double> tof(tofMin, tofMax), unit(0.0, 1.0);
+    for (auto nEvents : eventsPerFrame)
+        for (auto k = 0; k < nEvents; ++k)
+        {
+            auto hot = run.distribution == SyntheticRun::HitDistribution::HotSpectrum && unit(generator) < 0.5;
+            eventIds.push_back(hot ? hotSpectrum(generator) * hotStride : anySpectrum(generator));
+            eventTimes.push_back(float(tof(generator)));
+        }
+
+    std::vector<double> frameZeros(run.nFrames);
+    for (auto i = 0; i < run.nFrames; ++i)
+        frameZeros[i] = i * run.frameInterval;
+
+    auto events = root.createGroup("detector_1_events");
+    writeData(events, "event_id", H5::PredType::STD_U32LE, H5::PredType::NATIVE_UINT, {eventIds.size()}, eventIds);
+    writeData(events, "event_time_offset", H5::PredType::IEEE_F32LE, H5::PredType::NATIVE_FLOAT, {eventTimes.size()},
+              eventTimes);
+    writeData(events, "event_time_zero", H5::PredType::IEEE_F64LE, H5::PredType::NATIVE_DOUBLE, {hsize_t(run.nFrames)},
+              frameZeros);
+
+    auto framelog = root.createGroup("framelog");
+    auto eventsLog = framelog.createGroup("events_log");
+    writeData(eventsLog, "value", H5::PredType::STD_I32LE, H5::PredType::NATIVE_INT, {hsize_t(run.nFrames)},
+              eventsPerFrame);
+
+    return eventIds.size();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <H5Cpp.h>
+#include <string>
+
+// Parameters for a synthetic ISIS-style NeXuS event file
+struct SyntheticRun
+{
+    // Distribution of event hits over spectra and frames
+    enum class HitDistribution
+    {
+        Uniform,
+        HotSpectrum,
+        Bursty
+    };
+
+    // Number of detector spectra (ids run from 1)
+    int nSpectra{10000};
+    // Number of TOF bins
+    int nBins{2000};
+    // Number of frames, and the time between them in seconds
+    int nFrames{5000};
+    double frameInterval{0.1};
+    // Mean number of events per frame
+    int eventsPerFrame{2000};
+    // Distribution of hits
+    HitDistribution distribution{HitDistribution::Uniform};
+    // Run start time (ISO 8601)
+    std::string startTime{"2024-01-01T00:00:00"};
+    // Random seed
+    unsigned int seed{12345};
+
+    // Return run end time (ISO 8601), rounded up to the next whole second
+    std::string endTime() const;
+
+    // Return text name for the specified distribution
+    static std::string distributionName(HitDistribution distribution);
+    // Convert text name to distribution, returning false if it is not recognised
+    static bool distributionFromName(const std::string &name, HitDistribution &distribution);
+};
+
+// Write a synthetic NeXuS event file with the specified parameters, returning the number of events written
+hsize_t writeSyntheticNeXuS(const std::string &filename, const SyntheticRun &run);
@@ -1,10 +1,17 @@
+#include "directoryWatcher.h"
+#include "eventBinning.h"
 #include "nexusFile.h"
+#include "nexusTemplate.h"
 #include "processors.h"
+#include "profiler.h"
 #include "window.h"
 #include <CLI/App.hpp>
 #include <CLI/Config.hpp>
 #include <CLI/Formatter.hpp>
+#include <algorithm>
+#include <cctype>
 #include <fmt/core.h>
+#include <fstream>
 #include <optional>
 #include <vector>
 
@@ -26,34 +33,103 @@ int main(int argc, char **argv)
     double windowDelta_{0.0};
     // Number of slices to partition window in to
     int windowSlices_{1};
-    // Target spectrum for event get (optional)
-    std::optional<int> spectrumId_;
+    // Additional window definitions, given directly and / or in a file, as comma-separated key=value pairs
+    std::vector<std::string> extraWindows_;
+    std::optional<std::string> windowFile_;
+    // Target spectra for event get (optional)
+    std::optional<std::string> getSpectra_;
+    // Output file for event get (optional)
+    std::string getOutputFile_;
+    // Whether to print events found by event get
+    bool getPrintEvents_{false};
+    // Storage for detector counts in output files
+    CountsStorage countsStorage_;
+    std::string countsType_{"int32"};
+    std::string countsCompressor_;
+    // Directory to watch for new input files, and time to wait for them before stopping (zero to wait forever)
+    std::optional<std::string> watchDirectory_;
+    double watchIdleTimeout_{0.0};
+    // Fraction of bins which may be occupied before sparse detector counts are converted to dense (zero to disable)
+    double sparseOccupancy_{0.0};
+    // Output prefix for profiling results (optional)
+    std::optional<std::string> profilePrefix_;
+    // Partial outputs to merge
+    std::vector<std::string> partialFiles_;
 
     // Define and parse CLI arguments
     CLI::App app("NeXuS Processor (np), Copyright (C) 2024 Jared Swift and Tristan Youngs.");
     // -- Window Definition
-    app.add_option("-n,--name", windowName_, "Name of the window, used as a prefix to all output files")
-        ->group("Window Definition")
-        ->required();
+    auto *nameOption =
+        app.add_option("-n,--name", windowName_, "Name of the window, used as a prefix to all output files (required)")
+            ->group("Window Definition");
     app.add_option("-s,--start", windowStartTime_,
                    "Start time of the window (relative to first input file start time unless --absolute-start is given)")
         ->group("Window Definition");
-    app.add_option("-w,--width", windowWidth_, "Window width in seconds)")->group("Window Definition")->required();
+    auto *widthOption =
+        app.add_option("-w,--width", windowWidth_, "Window width in seconds (required)")->group("Window Definition");
     app.add_flag(
            "--relative-start", relativeStartTime_,
            "Flag that the given window start time is relative to the first run start time, not absolute (seconds since epoch)")
         ->group("Window Definition");
-    app.add_option("-d,--delta", windowDelta_, "Time between window occurrences, in seconds")
-        ->group("Window Definition")
-        ->required();
+    auto *deltaOption = app.add_option("-d,--delta", windowDelta_, "Time between window occurrences, in seconds (required)")
+                            ->group("Window Definition");
     app.add_option("--offset", windowOffset_, "Time after start time, in seconds, that the window begins.")
         ->group("Window Definition");
+    app.add_option("--window", extraWindows_,
+                   "Additional window definition to process in the same pass over the input files, given as comma-separated "
+                   "key=value pairs from name, start, width, delta, offset and slices (e.g. name=phase2,offset=10) - values "
+                   "not given are taken from the main window definition, but the name must be unique")
+        ->group("Window Definition");
+    app.add_option("--window-file", windowFile_,
+                   "File of additional window definitions, one per line in the same format as --window ('#' begins a "
+                   "comment)")
+        ->group("Window Definition");
     // -- Input Files
-    app.add_option("-f,--files", inputFiles_, "List of NeXuS files to process")->group("Input Files")->required();
+    app.add_option("-f,--files", inputFiles_, "List of NeXuS files to process")->group("Input Files");
+    app.add_option("--watch", watchDirectory_,
+                   "Directory to watch for new, completed NeXuS files, adding each to the summed outputs as it arrives (any "
+                   "already present are processed first)")
+        ->group("Input Files");
+    app.add_option("--watch-idle", watchIdleTimeout_,
+                   "Stop watching once no new files have arrived for this many seconds (default = 0, watch forever)")
+        ->group("Input Files");
+    app.add_flag_callback(
+           "--no-mmap", [&]() { NeXuSFile::setEventMapping(false); },
+           "Always read event data through HDF5, rather than mapping uncompressed, contiguous event data directly from file")
+        ->group("Input Files");
     // -- Output Files
     app.add_option("--output-dir", outputDirectory_, "Output directory for generated NeXuS files.")->group("Output Files");
+    app.add_option("--output-file", Processors::outputFile_,
+                   "Write all slices of all windows to this single HDF5 file, rather than a NeXuS file per slice")
+        ->group("Output Files");
+    app.add_option("--counts-type", countsType_,
+                   "Integer type to store detector counts as (int32, uint16, or uint8) - saving fails if any count exceeds "
+                   "the range of the type (default = int32)")
+        ->group("Output Files");
+    app.add_option("--counts-chunk", countsStorage_.chunkSpectra,
+                   "Store detector counts in chunks of the specified number of spectra (default = contiguous, or about 1 MiB "
+                   "per chunk if compressing)")
+        ->group("Output Files");
+    app.add_option("--deflate", countsStorage_.deflateLevel, "Compress detector counts with deflate at the given level (1-9)")
+        ->group("Output Files");
+    app.add_flag("--shuffle", countsStorage_.shuffle, "Apply the byte shuffle filter to detector counts")
+        ->group("Output Files");
+    app.add_flag("--scale-offset", countsStorage_.scaleOffset, "Apply the integer scale-offset filter to detector counts")
+        ->group("Output Files");
+    app.add_option("--compressor", countsCompressor_,
+                   "Compress detector counts with a third-party HDF5 filter plugin (lz4 or zstd), which must be installed")
+        ->group("Output Files");
     // -- Pre Processing
-    app.add_option("-g,--get", spectrumId_, "Get all events from specified spectrum index")->group("Pre-Processing");
+    app.add_option("-g,--get", getSpectra_,
+                   "Get all events from the specified spectrum indices, given as a list and / or ranges (e.g. 1,5,10-20)")
+        ->group("Pre-Processing");
+    app.add_option("--get-output", getOutputFile_,
+                   "File to write events from --get to, in HDF5 format if the extension is .h5 / .hdf5, or packed binary "
+                   "otherwise")
+        ->group("Pre-Processing");
+    app.add_flag("--get-print", getPrintEvents_,
+                 "Print events from --get (the default if no --get-output file is given)")
+        ->group("Pre-Processing");
     // -- Processing Modes
     app.add_flag_callback(
            "--summed",
@@ -83,8 +159,69 @@ int main(int argc, char **argv)
            },
            "Output NeXuS files for each window / slice")
         ->group("Processing");
+    app.add_flag_callback(
+           "--events",
+           [&]()
+           {
+               if (processingMode_ == Processors::ProcessingMode::None)
+                   processingMode_ = Processors::ProcessingMode::Events;
+               else
+               {
+                   fmt::print("Error: Multiple processing modes given.\n");
+                   throw(CLI::RuntimeError());
+               }
+           },
+           "Output NeXuS event files for each window / slice, copying the events of their frames rather than "
+           "histogramming them")
+        ->group("Processing");
     app.add_option("-l,--slices", windowSlices_, "Number of slices to split window definition in to (default = 1, no slicing)")
         ->group("Processing");
+    app.add_flag_callback(
+           "--scalar-binning", [&]() { EventBinning::setInstructionSet(EventBinning::InstructionSet::Scalar); },
+           "Disable vectorised (AVX2 / AVX-512) event binning kernels")
+        ->group("Processing");
+    app.add_option("-t,--threads", Processors::nThreads_,
+                   "Number of threads to use when binning events from each input file (default = 1)")
+        ->group("Processing");
+    app.add_option("--file-threads", Processors::nFileThreads_,
+                   "Number of input files to process concurrently in summed mode, each using --threads binning threads "
+                   "(default = 1)")
+        ->group("Processing");
+    app.add_option("--chunk-size", Processors::eventChunkSize_,
+                   "Maximum number of events to hold in memory at once when reading input files (default = 10000000)")
+        ->group("Processing");
+    app.add_option("--read-ahead", Processors::readAheadDepth_,
+                   "Number of event chunks to read ahead of binning on a background thread, or zero to disable (default = 2)")
+        ->group("Processing");
+    app.add_option("--read-ahead-memory", Processors::readAheadMemory_,
+                   "Maximum amount of memory for event buffers when reading ahead, including the chunk being binned and any "
+                   "kept for reuse, in MiB (default = 1024)")
+        ->group("Processing");
+    app.add_option("--write-queue", Processors::writeQueueDepth_,
+                   "Number of finished windows which may wait to be written by a background thread in individual mode, or "
+                   "zero to write them before continuing (default = 2)")
+        ->group("Processing");
+    app.add_option("--memory-limit", Processors::memoryLimit_,
+                   "Maximum amount of memory to hold slice detector counts in during summed processing, in MiB - the "
+                   "least recently used slices are spilled to a scratch file next to the outputs beyond it (default = 0, "
+                   "no limit)")
+        ->group("Processing");
+    app.add_option("--sparse-counts", sparseOccupancy_,
+                   "Accumulate detector counts for each slice sparsely until this fraction of its bins is occupied (e.g. "
+                   "0.1), saving memory when there are many slices each receiving few events (default = 0, always dense)")
+        ->group("Processing");
+    app.add_flag("--checkpoint", Processors::useCheckpoint_,
+                 "Keep a checkpoint of summed totals next to the outputs, and bin only input files it does not already "
+                 "include when run again")
+        ->group("Processing");
+    app.add_flag("--partial", Processors::writePartial_,
+                 "Write unscaled summed totals, with their detector and monitor frame counts, as partial outputs to be "
+                 "combined later by 'np merge' (which then applies any post-processing)")
+        ->group("Processing");
+    app.add_option("--profile", profilePrefix_,
+                   "Record time, I/O, events binned, frames processed and memory for each phase, file and thread, writing a "
+                   "summary to <prefix>.json and a Chrome / Perfetto trace to <prefix>.trace.json")
+        ->group("Processing");
     // -- Post Processing
     app.add_flag_callback(
            "--scale-monitors", [&]() { Processors::postProcessingMode_ = Processors::PostProcessingMode::ScaleMonitors; },
@@ -95,9 +232,39 @@ int main(int argc, char **argv)
            "Scale detector counts in final output to match the number of frames used for monitor counts")
         ->group("Post-Processing");
 
+    // -- Merge Subcommand
+    auto *mergeCommand =
+        app.add_subcommand("merge", "Merge partial outputs from any number of summed processing jobs into final slice files, "
+                                    "applying any post-processing (partial outputs of the same slice share a filename)");
+    mergeCommand->add_option("partials", partialFiles_, "Partial outputs to merge")->required();
+    mergeCommand->fallthrough();
+
     CLI11_PARSE(app, argc, argv);
 
+    // Merge partial outputs if requested, rather than processing input files
+    if (*mergeCommand)
+    {
+        if (profilePrefix_)
+            Profiler::enable(*profilePrefix_);
+        try
+        {
+            Processors::mergePartials(partialFiles_, outputDirectory_);
+        }
+        catch (std::exception &ex)
+        {
+            fmt::print("Error: {}", ex.what());
+            return 1;
+        }
+        Profiler::write();
+        return 0;
+    }
+
     // Sanity check
+    if (!*nameOption || !*widthOption || !*deltaOption)
+    {
+        fmt::print("Error: A window name, width and delta must be given.\n");
+        return 1;
+    }
     if ((windowWidth_ + windowOffset_) > windowDelta_)
     {
         fmt::print("Error: Window width (including any optional offset) is greater than window delta.\n");
@@ -108,14 +275,198 @@ int main(int argc, char **argv)
         fmt::print("Error: Invalid number of window slices provided ({}).\n", windowSlices_);
         return 1;
     }
+    if (Processors::nThreads_ < 1)
+    {
+        fmt::print("Error: Invalid number of threads provided ({}).\n", Processors::nThreads_);
+        return 1;
+    }
+    if (Processors::nFileThreads_ < 1)
+    {
+        fmt::print("Error: Invalid number of file threads provided ({}).\n", Processors::nFileThreads_);
+        return 1;
+    }
+    if (Processors::readAheadDepth_ < 0)
+    {
+        fmt::print("Error: Invalid read-ahead depth provided ({}).\n", Processors::readAheadDepth_);
+        return 1;
+    }
+    if (Processors::writeQueueDepth_ < 0)
+    {
+        fmt::print("Error: Invalid write queue depth provided ({}).\n", Processors::writeQueueDepth_);
+        return 1;
+    }
+    if (sparseOccupancy_ < 0.0 || sparseOccupancy_ > 1.0)
+    {
+        fmt::print("Error: Invalid sparse counts occupancy provided ({}).\n", sparseOccupancy_);
+        return 1;
+    }
+    CountsMatrix::setSparseOccupancy(sparseOccupancy_);
+    if (Processors::eventChunkSize_ < 1)
+    {
+        fmt::print("Error: Invalid event chunk size provided ({}).\n", Processors::eventChunkSize_);
+        return 1;
+    }
+
+    if (inputFiles_.empty() && !watchDirectory_)
+    {
+        fmt::print("Error: Need at least one input NeXuS file, or a directory to watch.\n");
+        return 1;
+    }
+    if (watchDirectory_ && processingMode_ != Processors::ProcessingMode::Summed)
+    {
+        fmt::print("Error: Watching a directory for new files is only possible in summed processing mode.\n");
+        return 1;
+    }
+    if (watchIdleTimeout_ < 0.0)
+    {
+        fmt::print("Error: Invalid watch idle timeout provided ({}).\n", watchIdleTimeout_);
+        return 1;
+    }
+    if (Processors::useCheckpoint_ && processingMode_ != Processors::ProcessingMode::Summed)
+    {
+        fmt::print("Error: Checkpoints can only be used in summed processing mode.\n");
+        return 1;
+    }
+    if (windowFile_)
+    {
+        std::ifstream windowFile(*windowFile_);
+        if (!windowFile)
+        {
+            fmt::print("Error: Failed to open window definition file '{}'.\n", *windowFile_);
+            return 1;
+        }
+        std::string line;
+        while (std::getline(windowFile, line))
+        {
+            line = line.substr(0, line.find('#'));
+            line.erase(std::remove_if(line.begin(), line.end(), [](unsigned char c) { return std::isspace(c); }),
+                       line.end());
+            if (!line.empty())
+                extraWindows_.push_back(line);
+        }
+    }
+    if (!extraWindows_.empty() && !Processors::outputFile_.empty())
+    {
+        fmt::print("Error: A single output file can only be written for a single window definition.\n");
+        return 1;
+    }
+    if (Processors::writePartial_ && processingMode_ != Processors::ProcessingMode::Summed)
+    {
+        fmt::print("Error: Partial outputs can only be written in summed processing mode.\n");
+        return 1;
+    }
+    if (Processors::writePartial_ && (!Processors::outputFile_.empty() || watchDirectory_))
+    {
+        fmt::print("Error: Partial outputs can only be written as a file per slice, and not while watching a directory.\n");
+        return 1;
+    }
+    if (Processors::writePartial_ && Processors::postProcessingMode_ != Processors::PostProcessingMode::None)
+    {
+        fmt::print("Error: Post-processing of partial outputs is applied when they are merged.\n");
+        return 1;
+    }
+    if (Processors::memoryLimit_ > 0 && processingMode_ != Processors::ProcessingMode::Summed)
+    {
+        fmt::print("Error: Memory limits can only be applied in summed processing mode.\n");
+        return 1;
+    }
+    if (Processors::memoryLimit_ > 0 && (!Processors::outputFile_.empty() || watchDirectory_ ||
+                                         Processors::useCheckpoint_ || Processors::nFileThreads_ > 1))
+    {
+        fmt::print("Error: Memory limits can't be combined with a single output file, watching, checkpoints, or concurrent "
+                   "input files.\n");
+        return 1;
+    }
+    if (processingMode_ == Processors::ProcessingMode::Events &&
+        (!Processors::outputFile_.empty() || Processors::postProcessingMode_ != Processors::PostProcessingMode::None))
+    {
+        fmt::print("Error: Events can only be written to a file per slice, without post-processing.\n");
+        return 1;
+    }
+    if (!extraWindows_.empty() && Processors::useCheckpoint_)
+    {
+        fmt::print("Error: Checkpoints can only be kept for a single window definition.\n");
+        return 1;
+    }
+    if (!Processors::outputFile_.empty() &&
+        Processors::postProcessingMode_ == Processors::PostProcessingMode::ScaleMonitors)
+    {
+        fmt::print("Error: Monitor counts are shared by all slices in a single output file, so cannot be scaled.\n");
+        return 1;
+    }
+    if (countsType_ == "int32")
+        countsStorage_.type = CountsStorage::Type::Int32;
+    else if (countsType_ == "uint16")
+        countsStorage_.type = CountsStorage::Type::UInt16;
+    else if (countsType_ == "uint8")
+        countsStorage_.type = CountsStorage::Type::UInt8;
+    else
+    {
+        fmt::print("Error: Invalid detector counts type provided ({}).\n", countsType_);
+        return 1;
+    }
+    if (countsStorage_.chunkSpectra < 0)
+    {
+        fmt::print("Error: Invalid detector counts chunk size provided ({}).\n", countsStorage_.chunkSpectra);
+        return 1;
+    }
+    if (countsStorage_.deflateLevel < 0 || countsStorage_.deflateLevel > 9)
+    {
+        fmt::print("Error: Invalid deflate level provided ({}).\n", countsStorage_.deflateLevel);
+        return 1;
+    }
+    if (countsCompressor_ == "lz4")
+        countsStorage_.plugin = CountsStorage::Plugin::LZ4;
+    else if (countsCompressor_ == "zstd")
+        countsStorage_.plugin = CountsStorage::Plugin::Zstd;
+    else if (!countsCompressor_.empty())
+    {
+        fmt::print("Error: Invalid compressor provided ({}).\n", countsCompressor_);
+        return 1;
+    }
+    NeXuSTemplate::setCountsStorage(countsStorage_);
+    if (profilePrefix_)
+        Profiler::enable(*profilePrefix_);
+
+    // Start watching for new input files if requested, adding any already present to those given explicitly, and waiting for
+    // the first to arrive if there are none
+    std::optional<DirectoryWatcher> watcher;
+    if (watchDirectory_)
+    {
+        watcher.emplace(*watchDirectory_, watchIdleTimeout_);
+        for (const auto &file : inputFiles_)
+            watcher->ignore(file);
+        auto existingFiles = watcher->completedFiles();
+        inputFiles_.insert(inputFiles_.end(), existingFiles.begin(), existingFiles.end());
+        if (inputFiles_.empty())
+        {
+            fmt::print("Waiting for the first input file to arrive...\n");
+            inputFiles_ = watcher->waitForNewFiles();
+            if (inputFiles_.empty())
+            {
+                fmt::print("No input files arrived before the idle timeout.\n");
+                return 0;
+            }
+        }
+    }
 
     // Perform pre-processing if requested
-    if (spectrumId_)
+    if (getSpectra_)
     {
-        Processors::getEvents(inputFiles_, *spectrumId_);
+        try
+        {
+            auto spectra = Processors::parseSpectra(*getSpectra_, Processors::maxSpectrum(inputFiles_.front()));
+            Processors::getEvents(inputFiles_, spectra, getOutputFile_, getPrintEvents_ || getOutputFile_.empty());
+        }
+        catch (std::exception &ex)
+        {
+            fmt::print("Error: {}", ex.what());
+            return 1;
+        }
     }
 
     // Construct the master window definition
+    auto startTimeBase = 0.0;
     if (relativeStartTime_)
     {
         // Need to query first NeXuS file to get its start time
@@ -126,28 +477,114 @@ int main(int argc, char **argv)
         }
         NeXuSFile firstFile(inputFiles_.front());
         firstFile.loadTimes();
+        startTimeBase = firstFile.startSinceEpoch();
         fmt::print("Window start time converted from relative to absolute time: {} => {} (= {} + {})\n", windowStartTime_,
-                   windowStartTime_ + firstFile.startSinceEpoch(), firstFile.startSinceEpoch(), windowStartTime_);
-        windowStartTime_ += firstFile.startSinceEpoch();
+                   windowStartTime_ + startTimeBase, startTimeBase, windowStartTime_);
+        windowStartTime_ += startTimeBase;
     }
     Window window(windowName_, windowStartTime_ + windowOffset_, windowWidth_);
     fmt::print("Window start time (including any offset) is {}.\n", window.startTime());
 
+    // Construct any additional window definitions, taking unspecified values from the master definition
+    std::vector<Processors::WindowSchedule> schedules{{window, windowSlices_, windowDelta_}};
+    for (const auto &definition : extraWindows_)
+    {
+        std::optional<std::string> name;
+        auto startTime = windowStartTime_, width = windowWidth_, delta = windowDelta_, offset = windowOffset_;
+        auto nSlices = windowSlices_;
+        try
+        {
+            std::size_t start = 0;
+            while (start < definition.size())
+            {
+                auto end = std::min(definition.find(',', start), definition.size());
+                auto item = definition.substr(start, end - start);
+                auto equals = item.find('=');
+                if (equals == std::string::npos)
+                    throw(std::runtime_error(fmt::format("Invalid window definition item '{}'.\n", item)));
+                auto key = item.substr(0, equals), value = item.substr(equals + 1);
+                if (key == "name")
+                    name = value;
+                else if (key == "start")
+                    startTime = std::stod(value) + startTimeBase;
+                else if (key == "width")
+                    width = std::stod(value);
+                else if (key == "delta")
+                    delta = std::stod(value);
+                else if (key == "offset")
+                    offset = std::stod(value);
+                else if (key == "slices")
+                    nSlices = std::stoi(value);
+                else
+                    throw(std::runtime_error(fmt::format("Unrecognised window definition key '{}'.\n", key)));
+                start = end + 1;
+            }
+        }
+        catch (std::logic_error &)
+        {
+            fmt::print("Error: Invalid value in window definition '{}'.\n", definition);
+            return 1;
+        }
+        catch (std::exception &ex)
+        {
+            fmt::print("Error: {}", ex.what());
+            return 1;
+        }
+
+        if (!name || name->empty())
+        {
+            fmt::print("Error: Window definition '{}' has no name.\n", definition);
+            return 1;
+        }
+        if (std::any_of(schedules.begin(), schedules.end(),
+                        [&](const auto &schedule) { return schedule.window.id() == *name; }))
+        {
+            fmt::print("Error: Window name '{}' is used more than once.\n", *name);
+            return 1;
+        }
+        if ((width + offset) > delta)
+        {
+            fmt::print("Error: Width of window '{}' (including any optional offset) is greater than its delta.\n", *name);
+            return 1;
+        }
+        if (nSlices < 1)
+        {
+            fmt::print("Error: Invalid number of slices provided for window '{}' ({}).\n", *name, nSlices);
+            return 1;
+        }
+
+        schedules.push_back({Window(*name, startTime + offset, width), nSlices, delta});
+        fmt::print("Window '{}' start time (including any offset) is {}.\n", *name, schedules.back().window.startTime());
+    }
+
     // Perform processing
-    switch (processingMode_)
-    {
-        case (Processors::ProcessingMode::None):
-            fmt::print("No processing mode specified. We are done.\n");
-            break;
-        case (Processors::ProcessingMode::Individual):
-            Processors::processIndividual(inputFiles_, outputDirectory_, window, windowSlices_, windowDelta_);
-            break;
-        case (Processors::ProcessingMode::Summed):
-            Processors::processSummed(inputFiles_, outputDirectory_, window, windowSlices_, windowDelta_);
-            break;
-        default:
-            throw(std::runtime_error("Unhandled processing mode.\n"));
+    try
+    {
+        switch (processingMode_)
+        {
+            case (Processors::ProcessingMode::None):
+                fmt::print("No processing mode specified. We are done.\n");
+                break;
+            case (Processors::ProcessingMode::Individual):
+                Processors::processIndividual(inputFiles_, outputDirectory_, schedules);
+                break;
+            case (Processors::ProcessingMode::Summed):
+                Processors::processSummed(inputFiles_, outputDirectory_, schedules, watcher ? &*watcher : nullptr);
+                break;
+            case (Processors::ProcessingMode::Events):
+                Processors::processEvents(inputFiles_, outputDirectory_, schedules);
+                break;
+            default:
+                throw(std::runtime_error("Unhandled processing mode.\n"));
+        }
     }
+    catch (std::exception &ex)
+    {
+        fmt::print("Error: {}", ex.what());
+        return 1;
+    }
+
+    Profiler::write();
 
     return 0;
 }
@@ -0,0 +1,321 @@
+#include "checkpoint.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fmt/core.h>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+
+/*
+ * Checkpoints are HDF5 files holding the window definition and template source as attributes of /checkpoint, the input
+ * files included so far in /checkpoint/files (filename, size, modified, hash), and the unscaled detector counts, detector
+ * frame counts and final window start times of each slice in /checkpoint/counts, /checkpoint/good_frames and
+ * /checkpoint/start_time. Files are matched by content hash, but an unchanged name, size and modification time is trusted
+ * without rehashing.
+ */
+
+namespace
+{
+// Current checkpoint format version
+const int checkpointVersion_ = 1;
+
+// Write a 1D dataset to the supplied group
+template <class T>
+void writeData(H5::Group &group, const std::string &name, const H5::DataType &type, const std::vector<T> &data)
+{
+    hsize_t size = data.size();
+    group.createDataSet(name, type, H5::DataSpace(1, &size)).write(data.data(), type);
+}
+
+// Read a 1D dataset from the supplied group
+template <class T> std::vector<T> readData(const H5::Group &group, const std::string &name, const H5::DataType &type)
+{
+    auto dataset = group.openDataSet(name);
+    std::vector<T> data(dataset.getSpace().getSimpleExtentNpoints());
+    dataset.read(data.data(), type);
+    return data;
+}
+} // namespace
+
+Checkpoint::Checkpoint(std::string filename) : filename_(std::move(filename))
+{
+    if (!std::filesystem::exists(filename_))
+        return;
+
+    fmt::print("Loading checkpoint from '{}'...\n", filename_);
+
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+    H5::H5File input(filename_, H5F_ACC_RDONLY);
+    auto root = input.openGroup("checkpoint");
+    if (NeXuSFile::readAttribute<int>(root, "version", H5::PredType::NATIVE_INT) != checkpointVersion_)
+        throw(std::runtime_error(fmt::format("Checkpoint '{}' has an unsupported format version.\n", filename_)));
+    windowStartTime_ = NeXuSFile::readAttribute<double>(root, "window_start", H5::PredType::NATIVE_DOUBLE);
+    windowDuration_ = NeXuSFile::readAttribute<double>(root, "window_duration", H5::PredType::NATIVE_DOUBLE);
+    windowDelta_ = NeXuSFile::readAttribute<double>(root, "window_delta", H5::PredType::NATIVE_DOUBLE);
+    nSlices_ = NeXuSFile::readAttribute<int>(root, "slices", H5::PredType::NATIVE_INT);
+    auto templateAttribute = root.openAttribute("template_source");
+    templateAttribute.read(templateAttribute.getStrType(), templatingSourceFilename_);
+
+    // Input files
+    auto files = root.openGroup("files");
+    auto filenames = files.openDataSet("filename");
+    auto filenameType = filenames.getStrType();
+    auto nFiles = filenames.getSpace().getSimpleExtentNpoints();
+    std::vector<char> filenameData(nFiles * filenameType.getSize());
+    filenames.read(filenameData.data(), filenameType);
+    auto sizes = readData<unsigned long long>(files, "size", H5::PredType::NATIVE_ULLONG);
+    auto modified = readData<long long>(files, "modified", H5::PredType::NATIVE_LLONG);
+    auto hashes = readData<unsigned long long>(files, "hash", H5::PredType::NATIVE_ULLONG);
+    for (auto i = 0; i < nFiles; ++i)
+    {
+        const auto *name = filenameData.data() + i * filenameType.getSize();
+        inputFiles_.push_back({std::string(name, strnlen(name, filenameType.getSize())), sizes[i], modified[i], hashes[i]});
+    }
+
+    // Slice totals
+    detectorFrames_ = readData<int>(root, "good_frames", H5::PredType::NATIVE_INT);
+    startTimes_ = readData<double>(root, "start_time", H5::PredType::NATIVE_DOUBLE);
+    auto counts = root.openDataSet("counts");
+    std::array<hsize_t, 3> dims{0, 0, 0};
+    auto fileSpace = counts.getSpace();
+    if (fileSpace.getSimpleExtentNdims() != 3)
+        throw(std::runtime_error(fmt::format("Checkpoint '{}' has malformed detector counts.\n", filename_)));
+    fileSpace.getSimpleExtentDims(dims.data());
+    if (dims[0] != nSlices_ || detectorFrames_.size() != nSlices_ || startTimes_.size() != nSlices_)
+        throw(std::runtime_error(fmt::format("Checkpoint '{}' does not contain data for {} slices.\n", filename_, nSlices_)));
+    std::array<hsize_t, 2> memDims{dims[1], dims[2]};
+    H5::DataSpace memSpace(2, memDims.data());
+    for (auto i = 0; i < nSlices_; ++i)
+    {
+        std::array<hsize_t, 3> offset{hsize_t(i), 0, 0}, count{1, dims[1], dims[2]};
+        fileSpace.selectHyperslab(H5S_SELECT_SET, count.data(), offset.data());
+        counts_.emplace_back(dims[1], dims[2]);
+        counts.read(counts_.back().data(), H5::PredType::NATIVE_INT, memSpace, fileSpace);
+    }
+
+    loaded_ = true;
+    fmt::print("Checkpoint contains totals for {} input file(s).\n", inputFiles_.size());
+}
+
+/*
+ * Input Files
+ */
+
+// Return a record of the specified file, without hashing its contents
+Checkpoint::InputFile Checkpoint::inputFile(const std::string &filename)
+{
+    InputFile file;
+    file.filename = filename;
+    file.size = std::filesystem::file_size(filename);
+    file.modified = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::filesystem::last_write_time(filename).time_since_epoch())
+                        .count();
+    return file;
+}
+
+// Return hash of the contents of the specified file
+unsigned long long Checkpoint::contentHash(const std::string &filename)
+{
+    // 64-bit FNV-1a
+    std::ifstream input(filename, std::ios::binary);
+    if (!input)
+        throw(std::runtime_error(fmt::format("Failed to open '{}' to hash its contents.\n", filename)));
+    unsigned long long hash = 14695981039346656037ULL;
+    std::vector<char> buffer(1 << 20);
+    while (input)
+    {
+        input.read(buffer.data(), buffer.size());
+        for (auto i = 0; i < input.gcount(); ++i)
+        {
+            hash ^= static_cast<unsigned char>(buffer[i]);
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+/*
+ * Totals
+ */
+
+// Return filename
+const std::string &Checkpoint::filename() const { return filename_; }
+
+// Return whether the checkpoint was loaded from an existing file
+bool Checkpoint::isLoaded() const { return loaded_; }
+
+// Return the source file used to template outputs
+const std::string &Checkpoint::templatingSourceFilename() const { return templatingSourceFilename_; }
+
+// Return number of input files included in the totals
+int Checkpoint::nInputFiles() const { return inputFiles_.size(); }
+
+// Check the checkpoint was made with the specified window definition, delta and number of slices
+void Checkpoint::checkCompatible(const Window &window, double windowDelta, int nSlices) const
+{
+    if (!loaded_)
+        return;
+
+    if (std::fabs(window.startTime() - windowStartTime_) > 1.0e-6 || std::fabs(window.duration() - windowDuration_) > 1.0e-6 ||
+        std::fabs(windowDelta - windowDelta_) > 1.0e-6 || nSlices != nSlices_)
+        throw(std::runtime_error(fmt::format("Checkpoint '{}' was made with a different window definition (start {}, width "
+                                             "{}, delta {}, {} slices) - remove it to start afresh.\n",
+                                             filename_, windowStartTime_, windowDuration_, windowDelta_, nSlices_)));
+}
+
+// Return records of those of the supplied input files not already included, throwing if any included file has changed
+std::vector<Checkpoint::InputFile> Checkpoint::newInputFiles(const std::vector<std::string> &inputFiles) const
+{
+    std::vector<InputFile> newFiles;
+    for (const auto &filename : inputFiles)
+    {
+        // An included file with the same name, size and modification time is assumed unchanged
+        auto file = inputFile(filename);
+        auto named = std::find_if(inputFiles_.begin(), inputFiles_.end(),
+                                  [&](const auto &included) { return included.filename == filename; });
+        if (named != inputFiles_.end() && named->size == file.size && named->modified == file.modified)
+            continue;
+
+        // Otherwise compare contents with all included files, so that moved or copied files are still recognised
+        file.hash = contentHash(filename);
+        if (std::any_of(inputFiles_.begin(), inputFiles_.end(),
+                        [&](const auto &included) { return included.size == file.size && included.hash == file.hash; }))
+            continue;
+        if (named != inputFiles_.end())
+            throw(std::runtime_error(fmt::format("Input file '{}' has changed since it was added to checkpoint '{}' - "
+                                                 "remove the checkpoint to start afresh.\n",
+                                                 filename, filename_)));
+
+        newFiles.push_back(file);
+    }
+
+    return newFiles;
+}
+
+// Return filenames of the supplied input file records
+std::vector<std::string> Checkpoint::filenames(const std::vector<InputFile> &inputFiles)
+{
+    std::vector<std::string> names;
+    for (const auto &file : inputFiles)
+        names.push_back(file.filename);
+    return names;
+}
+
+// Add the saved totals to the supplied slices, moving their windows to the saved positions if requested, and release them
+void Checkpoint::takeTotals(std::vector<std::pair<Window, NeXuSFile>> &slices, bool restoreWindows)
+{
+    if (counts_.empty())
+        return;
+    if (slices.size() != nSlices_)
+        throw(std::runtime_error("Can't add checkpoint totals to a set of slices of differing size.\n"));
+
+    for (auto i = 0; i < nSlices_; ++i)
+    {
+        auto &[slice, nxs] = slices[i];
+        if (nxs.detectorCounts().nRows() != counts_[i].nRows() || nxs.detectorCounts().nBins() != counts_[i].nBins())
+            throw(std::runtime_error(
+                fmt::format("Detector counts in checkpoint '{}' do not match the layout of the output files.\n", filename_)));
+        nxs.detectorCounts().add(counts_[i]);
+        nxs.incrementDetectorFrameCount(detectorFrames_[i]);
+        if (restoreWindows)
+            slice.shiftStartTime(startTimes_[i] - slice.startTime());
+    }
+
+    counts_.clear();
+}
+
+// Replace the checkpoint with the totals in the supplied slices, adding the specified input files to those included
+void Checkpoint::save(const std::vector<std::pair<Window, NeXuSFile>> &slices, const std::vector<InputFile> &newInputFiles,
+                      const std::string &templatingSourceFilename, const Window &window, double windowDelta)
+{
+    fmt::print("Saving checkpoint to '{}'...\n", filename_);
+
+    inputFiles_.insert(inputFiles_.end(), newInputFiles.begin(), newInputFiles.end());
+    templatingSourceFilename_ = templatingSourceFilename;
+    windowStartTime_ = window.startTime();
+    windowDuration_ = window.duration();
+    windowDelta_ = windowDelta;
+    nSlices_ = slices.size();
+
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+    // Write to a temporary file and then replace the original, so we never leave a partial checkpoint behind
+    auto temporaryFilename = filename_ + ".tmp";
+    {
+        H5::H5File output(temporaryFilename, H5F_ACC_TRUNC);
+        auto root = output.createGroup("checkpoint");
+        NeXuSFile::writeAttribute(root, "version", H5::PredType::NATIVE_INT, checkpointVersion_);
+        NeXuSFile::writeAttribute(root, "window_start", H5::PredType::NATIVE_DOUBLE, windowStartTime_);
+        NeXuSFile::writeAttribute(root, "window_duration", H5::PredType::NATIVE_DOUBLE, windowDuration_);
+        NeXuSFile::writeAttribute(root, "window_delta", H5::PredType::NATIVE_DOUBLE, windowDelta_);
+        NeXuSFile::writeAttribute(root, "slices", H5::PredType::NATIVE_INT, nSlices_);
+        H5::StrType templateType(H5::PredType::C_S1, std::max(templatingSourceFilename_.size(), std::size_t(1)));
+        root.createAttribute("template_source", templateType, H5::DataSpace(H5S_SCALAR))
+            .write(templateType, templatingSourceFilename_);
+
+        // Input files
+        auto files = root.createGroup("files");
+        std::size_t maxLength = 1;
+        for (const auto &file : inputFiles_)
+            maxLength = std::max(maxLength, file.filename.size());
+        std::vector<char> filenameData(inputFiles_.size() * maxLength, '\0');
+        std::vector<unsigned long long> sizes, hashes;
+        std::vector<long long> modified;
+        for (auto i = 0; i < inputFiles_.size(); ++i)
+        {
+            std::copy(inputFiles_[i].filename.begin(), inputFiles_[i].filename.end(), filenameData.begin() + i * maxLength);
+            sizes.push_back(inputFiles_[i].size);
+            modified.push_back(inputFiles_[i].modified);
+            hashes.push_back(inputFiles_[i].hash);
+        }
+        hsize_t nFiles = inputFiles_.size();
+        H5::StrType filenameType(H5::PredType::C_S1, maxLength);
+        files.createDataSet("filename", filenameType, H5::DataSpace(1, &nFiles)).write(filenameData.data(), filenameType);
+        writeData(files, "size", H5::PredType::NATIVE_ULLONG, sizes);
+        writeData(files, "modified", H5::PredType::NATIVE_LLONG, modified);
+        writeData(files, "hash", H5::PredType::NATIVE_ULLONG, hashes);
+
+        // Slice totals
+        detectorFrames_.clear();
+        startTimes_.clear();
+        for (const auto &[slice, nxs] : slices)
+        {
+            detectorFrames_.push_back(nxs.nDetectorFrames());
+            startTimes_.push_back(slice.startTime());
+        }
+        writeData(root, "good_frames", H5::PredType::NATIVE_INT, detectorFrames_);
+        writeData(root, "start_time", H5::PredType::NATIVE_DOUBLE, startTimes_);
+
+        const auto &firstCounts = slices.front().second.detectorCounts();
+        std::array<hsize_t, 3> dims{hsize_t(nSlices_), hsize_t(firstCounts.nRows()), hsize_t(firstCounts.nBins())};
+        H5::DataSpace fileSpace(3, dims.data());
+        H5::DSetCreatPropList properties;
+        if (firstCounts.size() > 0 && H5Zfilter_avail(H5Z_FILTER_DEFLATE) > 0)
+        {
+            std::array<hsize_t, 3> chunk{1, std::clamp(hsize_t(262144 / std::max(firstCounts.nBins(), 1)), hsize_t(1), dims[1]),
+                                         dims[2]};
+            properties.setChunk(3, chunk.data());
+            properties.setDeflate(1);
+        }
+        auto counts = root.createDataSet("counts", H5::PredType::STD_I32LE, fileSpace, properties);
+        std::array<hsize_t, 2> memDims{dims[1], dims[2]};
+        H5::DataSpace memSpace(2, memDims.data());
+        std::vector<int> denseBuffer;
+        for (auto i = 0; i < nSlices_; ++i)
+        {
+            std::array<hsize_t, 3> offset{hsize_t(i), 0, 0}, count{1, dims[1], dims[2]};
+            fileSpace.selectHyperslab(H5S_SELECT_SET, count.data(), offset.data());
+            counts.write(slices[i].second.detectorCounts().denseData(denseBuffer), H5::PredType::NATIVE_INT, memSpace,
+                         fileSpace);
+        }
+
+        output.close();
+    }
+    std::filesystem::rename(temporaryFilename, filename_);
+
+    loaded_ = true;
+}
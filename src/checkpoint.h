@@ -0,0 +1,71 @@
+#pragma once
+
+#include "nexusFile.h"
+#include "window.h"
+#include <string>
+#include <vector>
+
+// Saved state of summed processing, from which further input files can be added to the totals later
+class Checkpoint
+{
+    public:
+    Checkpoint(std::string filename);
+    ~Checkpoint() = default;
+
+    public:
+    // Input file included, or to be included, in the totals
+    struct InputFile
+    {
+        // Filename as given, size (bytes), modification time (nanoseconds since the filesystem clock epoch)
+        std::string filename;
+        unsigned long long size{0};
+        long long modified{0};
+        // Hash of the file contents
+        unsigned long long hash{0};
+    };
+
+    private:
+    // Checkpoint filename
+    std::string filename_;
+    // Whether the checkpoint was loaded from an existing file
+    bool loaded_{false};
+    // Input files included in the totals
+    std::vector<InputFile> inputFiles_;
+    // Source file used to template outputs
+    std::string templatingSourceFilename_;
+    // Window definition, delta, and number of slices the totals were made with
+    double windowStartTime_{0.0}, windowDuration_{0.0}, windowDelta_{0.0};
+    int nSlices_{0};
+    // Detector counts of each slice (released once taken)
+    std::vector<CountsMatrix> counts_;
+    // Detector frame counts and final start times of each slice
+    std::vector<int> detectorFrames_;
+    std::vector<double> startTimes_;
+
+    private:
+    // Return a record of the specified file, without hashing its contents
+    static InputFile inputFile(const std::string &filename);
+    // Return hash of the contents of the specified file
+    static unsigned long long contentHash(const std::string &filename);
+
+    public:
+    // Return filename
+    const std::string &filename() const;
+    // Return whether the checkpoint was loaded from an existing file
+    bool isLoaded() const;
+    // Return the source file used to template outputs
+    const std::string &templatingSourceFilename() const;
+    // Return number of input files included in the totals
+    int nInputFiles() const;
+    // Check the checkpoint was made with the specified window definition, delta and number of slices
+    void checkCompatible(const Window &window, double windowDelta, int nSlices) const;
+    // Return records of those of the supplied input files not already included, throwing if any included file has changed
+    std::vector<InputFile> newInputFiles(const std::vector<std::string> &inputFiles) const;
+    // Return filenames of the supplied input file records
+    static std::vector<std::string> filenames(const std::vector<InputFile> &inputFiles);
+    // Add the saved totals to the supplied slices, moving their windows to the saved positions if requested, and release them
+    void takeTotals(std::vector<std::pair<Window, NeXuSFile>> &slices, bool restoreWindows);
+    // Replace the checkpoint with the totals in the supplied slices, adding the specified input files to those included
+    void save(const std::vector<std::pair<Window, NeXuSFile>> &slices, const std::vector<InputFile> &newInputFiles,
+              const std::string &templatingSourceFilename, const Window &window, double windowDelta);
+};
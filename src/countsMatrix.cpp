@@ -0,0 +1,273 @@
+#include "countsMatrix.h"
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+
+/*
+ * Sparse counts are held as (flat index, count) pairs sorted by index, with individual increments appended to a pending
+ * list of flat indices which is periodically sorted and merged into them. Once the number of occupied bins passes the
+ * occupancy threshold the counts are converted to the dense layout, which is also produced on demand when they are saved.
+ */
+
+// Static Members
+double CountsMatrix::sparseOccupancy_ = 0.0;
+
+CountsMatrix::CountsMatrix(int nRows, int nBins) { initialise(nRows, nBins); }
+
+// Set the fraction of bins which may be occupied before sparse counts are converted to dense (zero to always be dense)
+void CountsMatrix::setSparseOccupancy(double occupancy) { sparseOccupancy_ = occupancy; }
+
+// Return the fraction of bins which may be occupied before sparse counts are converted to dense
+double CountsMatrix::sparseOccupancy() { return sparseOccupancy_; }
+
+// Initialise to the specified size, zeroing all counts, or leaving storage released until initialised again if requested
+void CountsMatrix::initialise(int nRows, int nBins, bool allocate)
+{
+    nRows_ = nRows;
+    nBins_ = nBins;
+    entries_ = decltype(entries_)();
+    pending_ = decltype(pending_)();
+    if (!allocate)
+    {
+        release();
+        return;
+    }
+
+    // Sparse counts use 32-bit flat indices
+    sparse_ = sparseOccupancy_ > 0.0 && size() > 0 && size() <= std::numeric_limits<std::uint32_t>::max();
+    if (sparse_)
+        counts_ = decltype(counts_)();
+    else
+        counts_.assign(size(), 0);
+}
+
+// Return number of rows (spectra)
+int CountsMatrix::nRows() const { return nRows_; }
+
+// Return number of bins per row
+int CountsMatrix::nBins() const { return nBins_; }
+
+// Return total number of elements
+std::size_t CountsMatrix::size() const { return std::size_t(nRows_) * nBins_; }
+
+// Return raw count data, converting sparse counts to dense first
+int *CountsMatrix::data()
+{
+    toDense();
+    return counts_.data();
+}
+
+// Return raw count data, which must be dense
+const int *CountsMatrix::data() const
+{
+    if (sparse_)
+        throw(std::runtime_error("Can't access sparse counts directly.\n"));
+    return counts_.data();
+}
+
+// Return raw count data, expanding sparse counts into the supplied buffer if necessary
+const int *CountsMatrix::denseData(std::vector<int> &buffer) const
+{
+    if (!sparse_)
+        return counts_.data();
+
+    buffer.assign(size(), 0);
+    for (auto &&[index, count] : entries_)
+        buffer[index] += count;
+    for (auto index : pending_)
+        ++buffer[index];
+    return buffer.data();
+}
+
+// Return whether counts are currently held sparsely
+bool CountsMatrix::isSparse() const { return sparse_; }
+
+// Return number of bytes used to hold the counts
+std::size_t CountsMatrix::memoryBytes() const
+{
+    return sparse_ ? entries_.capacity() * sizeof(entries_.front()) + pending_.capacity() * sizeof(pending_.front())
+                   : counts_.size() * sizeof(int);
+}
+
+// Merge the supplied sorted (index, count) pairs into our sparse counts
+void CountsMatrix::mergeEntries(const std::vector<std::pair<std::uint32_t, int>> &entries)
+{
+    if (entries.empty())
+        return;
+
+    std::vector<std::pair<std::uint32_t, int>> merged;
+    merged.reserve(entries_.size() + entries.size());
+    auto a = entries_.cbegin();
+    auto b = entries.cbegin();
+    while (a != entries_.cend() || b != entries.cend())
+    {
+        if (b == entries.cend() || (a != entries_.cend() && a->first < b->first))
+            merged.push_back(*a++);
+        else if (a == entries_.cend() || b->first < a->first)
+            merged.push_back(*b++);
+        else
+        {
+            merged.emplace_back(a->first, a->second + b->second);
+            ++a;
+            ++b;
+        }
+    }
+    entries_.swap(merged);
+}
+
+// Compact pending sparse increments, converting to dense if the occupancy threshold is passed
+void CountsMatrix::compact()
+{
+    if (!sparse_)
+        return;
+
+    if (!pending_.empty())
+    {
+        std::sort(pending_.begin(), pending_.end());
+        std::vector<std::pair<std::uint32_t, int>> runs;
+        for (auto index : pending_)
+        {
+            if (!runs.empty() && runs.back().first == index)
+                ++runs.back().second;
+            else
+                runs.emplace_back(index, 1);
+        }
+        pending_.clear();
+        mergeEntries(runs);
+    }
+
+    if (entries_.size() > sparseOccupancy_ * size())
+        toDense();
+}
+
+// Convert sparse counts to dense
+void CountsMatrix::toDense()
+{
+    if (!sparse_)
+        return;
+
+    counts_.assign(size(), 0);
+    for (auto &&[index, count] : entries_)
+        counts_[index] += count;
+    for (auto index : pending_)
+        ++counts_[index];
+    entries_ = decltype(entries_)();
+    pending_ = decltype(pending_)();
+    sparse_ = false;
+}
+
+// Add counts in the specified range of rows to the supplied buffer (the matrix must not be released)
+void CountsMatrix::addRows(int firstRow, int nRows, int *destination) const
+{
+    if (isReleased())
+        throw(std::runtime_error("Can't add counts from a released counts matrix.\n"));
+
+    const auto begin = std::size_t(firstRow) * nBins_, end = std::size_t(firstRow + nRows) * nBins_;
+    if (!sparse_)
+    {
+        for (auto i = begin; i < end; ++i)
+            destination[i - begin] += counts_[i];
+        return;
+    }
+
+    auto it = std::lower_bound(entries_.begin(), entries_.end(), begin,
+                               [](const auto &entry, std::size_t index) { return entry.first < index; });
+    for (; it != entries_.end() && it->first < end; ++it)
+        destination[it->first - begin] += it->second;
+    for (auto index : pending_)
+        if (index >= begin && index < end)
+            ++destination[index - begin];
+}
+
+// Release all storage, leaving the matrix unusable until it is initialised again
+void CountsMatrix::release()
+{
+    counts_ = decltype(counts_)();
+    entries_ = decltype(entries_)();
+    pending_ = decltype(pending_)();
+    sparse_ = false;
+}
+
+// Return whether storage has been released
+bool CountsMatrix::isReleased() const { return !sparse_ && counts_.empty() && size() > 0; }
+
+// Zero all counts
+void CountsMatrix::zero()
+{
+    if (sparse_)
+    {
+        entries_.clear();
+        pending_.clear();
+    }
+    else
+        std::fill(counts_.begin(), counts_.end(), 0);
+}
+
+// Add counts from another matrix of identical size (neither may be released)
+void CountsMatrix::add(const CountsMatrix &other)
+{
+    if (other.nRows_ != nRows_ || other.nBins_ != nBins_)
+        throw(std::runtime_error("Can't add counts matrices of differing size.\n"));
+    if (isReleased() || other.isReleased())
+        throw(std::runtime_error("Can't add counts to or from a released counts matrix.\n"));
+
+    if (!sparse_)
+    {
+        if (!other.sparse_)
+            std::transform(counts_.begin(), counts_.end(), other.counts_.begin(), counts_.begin(), std::plus<>());
+        else
+        {
+            for (auto &&[index, count] : other.entries_)
+                counts_[index] += count;
+            for (auto index : other.pending_)
+                ++counts_[index];
+        }
+        return;
+    }
+
+    // Only the occupied bins of a dense matrix are merged into sparse counts
+    if (other.sparse_)
+    {
+        pending_.insert(pending_.end(), other.pending_.begin(), other.pending_.end());
+        mergeEntries(other.entries_);
+    }
+    else
+    {
+        std::vector<std::pair<std::uint32_t, int>> occupied;
+        for (std::size_t i = 0; i < other.counts_.size(); ++i)
+            if (other.counts_[i] != 0)
+                occupied.emplace_back(i, other.counts_[i]);
+        mergeEntries(occupied);
+    }
+    compact();
+}
+
+// Return sum of all counts
+long long CountsMatrix::sum() const
+{
+    long long total = 0;
+    if (sparse_)
+    {
+        for (auto &&[index, count] : entries_)
+            total += count;
+        return total + pending_.size();
+    }
+    for (auto count : counts_)
+        total += count;
+    return total;
+}
+
+// Scale all counts by the specified factor (truncating to integer)
+void CountsMatrix::scale(double factor)
+{
+    compact();
+    if (sparse_)
+    {
+        for (auto &&[index, count] : entries_)
+            count = count * factor;
+        return;
+    }
+    for (auto &count : counts_)
+        count = count * factor;
+}
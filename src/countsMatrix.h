@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Allocator returning memory aligned to the specified boundary (defaults to a typical cache line)
+template <class T, std::size_t Alignment = 64> class AlignedAllocator
+{
+    public:
+    using value_type = T;
+    template <class U> struct rebind
+    {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+    template <class U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T *allocate(std::size_t n)
+    {
+        if (n == 0)
+            return nullptr;
+        void *ptr = ::operator new(n * sizeof(T), std::align_val_t(Alignment));
+        return static_cast<T *>(ptr);
+    }
+    void deallocate(T *ptr, std::size_t) { ::operator delete(ptr, std::align_val_t(Alignment)); }
+
+    template <class U> bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+    template <class U> bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+// Row-major matrix of integer counts (spectrum rows x TOF bins), held contiguously or, while few bins are occupied, sparsely
+class CountsMatrix
+{
+    public:
+    CountsMatrix(int nRows = 0, int nBins = 0);
+    ~CountsMatrix() = default;
+    CountsMatrix(const CountsMatrix &) = default;
+    CountsMatrix &operator=(const CountsMatrix &) = default;
+    // Moving leaves the source matrix without storage
+    CountsMatrix(CountsMatrix &&) = default;
+    CountsMatrix &operator=(CountsMatrix &&) = default;
+
+    private:
+    // Number of rows (spectra)
+    int nRows_{0};
+    // Number of bins per row
+    int nBins_{0};
+    // Count data (empty while sparse)
+    std::vector<int, AlignedAllocator<int>> counts_;
+    // Whether counts are currently held sparsely
+    bool sparse_{false};
+    // Sparse counts, as (flat index, count) pairs sorted by index, and flat indices of increments not yet compacted into them
+    std::vector<std::pair<std::uint32_t, int>> entries_;
+    std::vector<std::uint32_t> pending_;
+    // Fraction of bins which may be occupied before new matrices held sparsely are converted to dense (zero to disable)
+    static double sparseOccupancy_;
+
+    private:
+    // Merge the supplied sorted (index, count) pairs into our sparse counts
+    void mergeEntries(const std::vector<std::pair<std::uint32_t, int>> &entries);
+
+    public:
+    // Set the fraction of bins which may be occupied before sparse counts are converted to dense (zero to always be dense)
+    static void setSparseOccupancy(double occupancy);
+    // Return the fraction of bins which may be occupied before sparse counts are converted to dense
+    static double sparseOccupancy();
+
+    public:
+    // Initialise to the specified size, zeroing all counts, or leaving storage released until initialised again if requested
+    void initialise(int nRows, int nBins, bool allocate = true);
+    // Return number of rows (spectra)
+    [[nodiscard]] int nRows() const;
+    // Return number of bins per row
+    [[nodiscard]] int nBins() const;
+    // Return total number of elements
+    [[nodiscard]] std::size_t size() const;
+    // Return raw count data, converting sparse counts to dense first
+    [[nodiscard]] int *data();
+    // Return raw count data, which must be dense
+    [[nodiscard]] const int *data() const;
+    // Return raw count data, expanding sparse counts into the supplied buffer if necessary
+    [[nodiscard]] const int *denseData(std::vector<int> &buffer) const;
+    // Return whether counts are currently held sparsely
+    [[nodiscard]] bool isSparse() const;
+    // Return number of bytes used to hold the counts
+    [[nodiscard]] std::size_t memoryBytes() const;
+    // Increment the specified bin in the specified row (dense only)
+    void increment(int row, int bin) { ++counts_[std::size_t(row) * nBins_ + bin]; }
+    // Return value of the specified bin in the specified row (dense only)
+    [[nodiscard]] int value(int row, int bin) const { return counts_[std::size_t(row) * nBins_ + bin]; }
+    // Increment the element at the specified flat index (sparse only), compacting increments once enough are pending
+    void incrementSparse(std::size_t index)
+    {
+        pending_.push_back(index);
+        if (pending_.size() >= std::max(std::size_t(65536), entries_.size()))
+            compact();
+    }
+    // Compact pending sparse increments, converting to dense if the occupancy threshold is passed
+    void compact();
+    // Convert sparse counts to dense
+    void toDense();
+    // Add counts in the specified range of rows to the supplied buffer (the matrix must not be released)
+    void addRows(int firstRow, int nRows, int *destination) const;
+    // Release all storage, leaving the matrix unusable until it is initialised again
+    void release();
+    // Return whether storage has been released
+    [[nodiscard]] bool isReleased() const;
+    // Zero all counts
+    void zero();
+    // Add counts from another matrix of identical size (neither may be released)
+    void add(const CountsMatrix &other);
+    // Return sum of all counts
+    [[nodiscard]] long long sum() const;
+    // Scale all counts by the specified factor (truncating to integer)
+    void scale(double factor);
+};
@@ -0,0 +1,174 @@
+#include "directoryWatcher.h"
+#include "nexusFile.h"
+#include <algorithm>
+#include <fmt/core.h>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+DirectoryWatcher::DirectoryWatcher(std::string directory, double idleTimeout, double pollInterval)
+    : directory_(std::move(directory)), idleTimeout_(idleTimeout), pollInterval_(pollInterval)
+{
+    if (!std::filesystem::is_directory(directory_))
+        throw(std::runtime_error(fmt::format("Watch directory '{}' does not exist.\n", directory_)));
+
+#ifdef __linux__
+    // Files are complete once closed after writing, or moved in - if inotify is unavailable we rely on polling alone
+    inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_ >= 0 && inotify_add_watch(inotify_, directory_.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        close(inotify_);
+        inotify_ = -1;
+    }
+#endif
+    fmt::print("Watching '{}' for new NeXuS files ({}).\n", directory_,
+               inotify_ >= 0 ? "inotify" : fmt::format("polling every {} seconds", pollInterval_));
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+#ifdef __linux__
+    if (inotify_ >= 0)
+        close(inotify_);
+#endif
+}
+
+/*
+ * Files
+ */
+
+// Return canonical form of the specified path, for comparison
+std::string DirectoryWatcher::canonical(const std::string &path)
+{
+    std::error_code error;
+    auto result = std::filesystem::weakly_canonical(path, error);
+    return error ? path : result.string();
+}
+
+// Return whether the specified file is a NeXuS file which has been completely written
+bool DirectoryWatcher::isComplete(const std::string &filename)
+{
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+    // Files still being written may not open at all, and the end time is only written once the run has finished
+    auto complete = false;
+    H5E_BEGIN_TRY
+    {
+        auto file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+        if (file >= 0)
+        {
+            complete = H5Lexists(file, "raw_data_1", H5P_DEFAULT) > 0 &&
+                       H5Lexists(file, "raw_data_1/end_time", H5P_DEFAULT) > 0 &&
+                       H5Lexists(file, "raw_data_1/detector_1_events", H5P_DEFAULT) > 0;
+            H5Fclose(file);
+        }
+    }
+    H5E_END_TRY;
+
+    return complete;
+}
+
+// Scan the directory, returning files which are newly complete (unchanged since the last scan, notified as closed, or
+// present at all if we are to assume files are stable)
+std::vector<std::string> DirectoryWatcher::scan(const std::set<std::string> &closedFiles, bool assumeStable)
+{
+    std::vector<std::string> newFiles;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator(directory_, error))
+    {
+        if (!entry.is_regular_file(error) || entry.path().extension() != ".nxs")
+            continue;
+
+        auto path = entry.path().string();
+        auto name = canonical(path);
+        if (reported_.find(name) != reported_.end())
+            continue;
+
+        auto size = entry.file_size(error);
+        if (error)
+            continue;
+        auto modified = entry.last_write_time(error);
+        if (error)
+            continue;
+
+        auto pending = pending_.find(name);
+        auto stable = assumeStable || closedFiles.find(entry.path().filename().string()) != closedFiles.end() ||
+                      (pending != pending_.end() && pending->second == std::make_pair(size, modified));
+        if (stable && isComplete(path))
+        {
+            reported_.insert(name);
+            pending_.erase(name);
+            newFiles.push_back(path);
+        }
+        else
+            pending_[name] = {size, modified};
+    }
+
+    std::sort(newFiles.begin(), newFiles.end());
+
+    return newFiles;
+}
+
+// Wait up to the specified time for inotify to report closed or moved files, returning their names
+std::set<std::string> DirectoryWatcher::waitForNotifications(double seconds)
+{
+    std::set<std::string> names;
+
+#ifdef __linux__
+    if (inotify_ >= 0)
+    {
+        pollfd descriptor{inotify_, POLLIN, 0};
+        if (poll(&descriptor, 1, int(seconds * 1000)) > 0)
+        {
+            alignas(inotify_event) char buffer[16384];
+            ssize_t length;
+            while ((length = read(inotify_, buffer, sizeof(buffer))) > 0)
+                for (auto *ptr = buffer; ptr < buffer + length;)
+                {
+                    const auto *event = reinterpret_cast<const inotify_event *>(ptr);
+                    if (event->len > 0)
+                        names.insert(event->name);
+                    ptr += sizeof(inotify_event) + event->len;
+                }
+        }
+        return names;
+    }
+#endif
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    return names;
+}
+
+/*
+ * Public Functions
+ */
+
+// Return directory being watched
+const std::string &DirectoryWatcher::directory() const { return directory_; }
+
+// Never report the specified file
+void DirectoryWatcher::ignore(const std::string &filename) { reported_.insert(canonical(filename)); }
+
+// Return completed files already in the directory, sorted by name
+std::vector<std::string> DirectoryWatcher::completedFiles() { return scan({}, true); }
+
+// Wait for new completed files, returning them sorted by name (or nothing if the idle timeout expires)
+std::vector<std::string> DirectoryWatcher::waitForNewFiles()
+{
+    auto idleStart = std::chrono::steady_clock::now();
+    while (true)
+    {
+        auto files = scan(waitForNotifications(pollInterval_));
+        if (!files.empty())
+            return files;
+
+        std::chrono::duration<double> idleTime = std::chrono::steady_clock::now() - idleStart;
+        if (idleTimeout_ > 0.0 && idleTime.count() >= idleTimeout_)
+            return {};
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Reports completed NeXuS files as they appear in a directory, using inotify where available and polling otherwise
+class DirectoryWatcher
+{
+    public:
+    DirectoryWatcher(std::string directory, double idleTimeout = 0.0, double pollInterval = 2.0);
+    ~DirectoryWatcher();
+    DirectoryWatcher(const DirectoryWatcher &) = delete;
+    DirectoryWatcher &operator=(const DirectoryWatcher &) = delete;
+
+    private:
+    // Directory being watched
+    std::string directory_;
+    // Time without new files after which waiting gives up (zero to wait forever), and interval between directory scans
+    double idleTimeout_{0.0}, pollInterval_{2.0};
+    // inotify descriptor, if in use
+    int inotify_{-1};
+    // Files already reported or ignored (canonical paths)
+    std::set<std::string> reported_;
+    // Incomplete files seen in the last scan, with their size and modification time at the time
+    std::map<std::string, std::pair<std::uintmax_t, std::filesystem::file_time_type>> pending_;
+
+    private:
+    // Return canonical form of the specified path, for comparison
+    static std::string canonical(const std::string &path);
+    // Return whether the specified file is a NeXuS file which has been completely written
+    static bool isComplete(const std::string &filename);
+    // Scan the directory, returning files which are newly complete (unchanged since the last scan, notified as closed, or
+    // present at all if we are to assume files are stable)
+    std::vector<std::string> scan(const std::set<std::string> &closedFiles, bool assumeStable = false);
+    // Wait up to the specified time for inotify to report closed or moved files, returning their names
+    std::set<std::string> waitForNotifications(double seconds);
+
+    public:
+    // Return directory being watched
+    const std::string &directory() const;
+    // Never report the specified file
+    void ignore(const std::string &filename);
+    // Return completed files already in the directory, sorted by name
+    std::vector<std::string> completedFiles();
+    // Wait for new completed files, returning them sorted by name (or nothing if the idle timeout expires)
+    std::vector<std::string> waitForNewFiles();
+};
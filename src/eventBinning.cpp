@@ -0,0 +1,409 @@
+#include "eventBinning.h"
+#include "countsMatrix.h"
+#include "tofBinning.h"
+#include <climits>
+#include <stdexcept>
+
+// Vectorised kernels are compiled for x86 with GCC-compatible compilers, and selected at runtime based on CPU support
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define NP_X86_SIMD
+#include <immintrin.h>
+#define NP_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define NP_TARGET_AVX512 __attribute__((target("avx512f,avx512vl,avx2,fma")))
+#endif
+
+namespace EventBinning
+{
+namespace
+{
+// Return reference to selected instruction set, detecting it on first use
+InstructionSet &selectedInstructionSet()
+{
+    static InstructionSet set = detectInstructionSet();
+    return set;
+}
+
+// Bin events one at a time
+template <class TimeType>
+void binEventsScalar(const int *eventIndices, const TimeType *eventTimes, std::size_t nEvents,
+                     const std::vector<int> &spectrumRows, const TOFBinning &tofBinning, CountsMatrix &counts)
+{
+    const int nSpectrumRows = spectrumRows.size();
+    for (std::size_t k = 0; k < nEvents; ++k)
+    {
+        // Ignore events from invalid or unknown spectra
+        auto id = eventIndices[k];
+        if (id <= 0 || id >= nSpectrumRows || spectrumRows[id] == -1)
+            continue;
+
+        // Locate the TOF bin containing the event, ignoring those outside the binning range
+        auto bin = tofBinning.bin(eventTimes[k]);
+        if (bin == -1)
+            continue;
+
+        counts.increment(spectrumRows[id], bin);
+    }
+}
+
+// Bin events one at a time into sparse counts, returning the number binned before the counts were converted to dense
+template <class TimeType>
+std::size_t binEventsSparse(const int *eventIndices, const TimeType *eventTimes, std::size_t nEvents,
+                            const std::vector<int> &spectrumRows, const TOFBinning &tofBinning, CountsMatrix &counts)
+{
+    const int nSpectrumRows = spectrumRows.size();
+    const std::size_t nBins = tofBinning.nBins();
+    for (std::size_t k = 0; k < nEvents; ++k)
+    {
+        if (!counts.isSparse())
+            return k;
+
+        // Ignore events from invalid or unknown spectra
+        auto id = eventIndices[k];
+        if (id <= 0 || id >= nSpectrumRows || spectrumRows[id] == -1)
+            continue;
+
+        // Locate the TOF bin containing the event, ignoring those outside the binning range
+        auto bin = tofBinning.bin(eventTimes[k]);
+        if (bin == -1)
+            continue;
+
+        counts.incrementSparse(spectrumRows[id] * nBins + bin);
+    }
+    return nEvents;
+}
+
+#ifdef NP_X86_SIMD
+// Natural logarithm of two
+constexpr auto ln2 = 0.693147180559945309417232121458176568;
+
+/*
+ * The vector kernels compute spectrum rows and an estimated TOF bin for a block of events at once, refine the estimate
+ * against the real bin edges, and produce a flat index into the counts matrix for each event. Events with invalid spectra
+ * or out-of-range TOFs are masked off. Increments are then applied one lane at a time so that colliding indices within a
+ * block are counted correctly, and any lane whose bin could not be resolved by the vector refinement is handed to the
+ * scalar lookup. Results are therefore identical to the scalar kernel.
+ */
+
+// Load four event times as doubles
+NP_TARGET_AVX2 inline __m256d loadTimesAVX2(const double *eventTimes) { return _mm256_loadu_pd(eventTimes); }
+NP_TARGET_AVX2 inline __m256d loadTimesAVX2(const float *eventTimes) { return _mm256_cvtps_pd(_mm_loadu_ps(eventTimes)); }
+
+// Approximate natural logarithm of positive, normal values (absolute error ~1e-7) - exact bins are found by refinement
+NP_TARGET_AVX2 inline __m256d logAVX2(__m256d x)
+{
+    const auto bits = _mm256_castpd_si256(x);
+
+    // Unbiased exponent, converted to double via the low 32 bits of each lane
+    auto exponent64 = _mm256_sub_epi64(_mm256_srli_epi64(bits, 52), _mm256_set1_epi64x(1023));
+    auto exponent = _mm256_cvtepi32_pd(
+        _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(exponent64, _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0))));
+
+    // Mantissa in [1, 2), with ln(m) = 2 atanh(s) where s = (m - 1) / (m + 1)
+    auto mantissa = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL)),
+                                                        _mm256_set1_epi64x(0x3FF0000000000000LL)));
+    const auto one = _mm256_set1_pd(1.0);
+    auto s = _mm256_div_pd(_mm256_sub_pd(mantissa, one), _mm256_add_pd(mantissa, one));
+    auto s2 = _mm256_mul_pd(s, s);
+    auto series = _mm256_fmadd_pd(s2, _mm256_set1_pd(1.0 / 11.0), _mm256_set1_pd(1.0 / 9.0));
+    series = _mm256_fmadd_pd(s2, series, _mm256_set1_pd(1.0 / 7.0));
+    series = _mm256_fmadd_pd(s2, series, _mm256_set1_pd(1.0 / 5.0));
+    series = _mm256_fmadd_pd(s2, series, _mm256_set1_pd(1.0 / 3.0));
+    series = _mm256_fmadd_pd(s2, series, one);
+
+    return _mm256_fmadd_pd(exponent, _mm256_set1_pd(ln2), _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(2.0), s), series));
+}
+
+// AVX2 kernel, handling four events per iteration
+template <TOFBinning::BinningType Type, class TimeType>
+NP_TARGET_AVX2 void binEventsAVX2(const int *eventIndices, const TimeType *eventTimes, std::size_t nEvents,
+                                  const std::vector<int> &spectrumRows, const TOFBinning &tofBinning, CountsMatrix &counts)
+{
+    constexpr auto irregular = Type == TOFBinning::BinningType::Irregular;
+    constexpr auto logarithmic = Type == TOFBinning::BinningType::Logarithmic;
+    const auto &edges = tofBinning.edges();
+    const auto &lookup = tofBinning.lookup();
+    const auto nBins = tofBinning.nBins();
+    const auto origin = irregular ? tofBinning.lookupOrigin() : tofBinning.segments().front().origin;
+    const auto inverseWidth = irregular ? tofBinning.lookupInverseWidth() : tofBinning.segments().front().inverseWidth;
+    const int maxEstimate = irregular ? lookup.size() - 1 : nBins - 1;
+    auto *data = counts.data();
+
+    const auto vZero = _mm_setzero_si128(), vMinusOne = _mm_set1_epi32(-1);
+    const auto vIdLimit = _mm_set1_epi32(spectrumRows.size()), vNBins = _mm_set1_epi32(nBins);
+    const auto vLastBin = _mm_set1_epi32(nBins - 1), vMaxEstimate = _mm_set1_epi32(maxEstimate);
+    const auto vFront = _mm256_set1_pd(edges.front()), vBack = _mm256_set1_pd(edges.back());
+    const auto vOrigin = _mm256_set1_pd(origin), vInverseWidth = _mm256_set1_pd(inverseWidth), vUnit = _mm256_set1_pd(1.0);
+
+    alignas(16) int index[4];
+    std::size_t k = 0;
+    for (; k + 4 <= nEvents; k += 4)
+    {
+        // Gather spectrum rows for valid event ids, marking others with -1
+        auto id = _mm_loadu_si128(reinterpret_cast<const __m128i *>(eventIndices + k));
+        auto idValid = _mm_and_si128(_mm_cmpgt_epi32(id, vZero), _mm_cmplt_epi32(id, vIdLimit));
+        auto row = _mm_mask_i32gather_epi32(vMinusOne, spectrumRows.data(), id, idValid, 4);
+        auto mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(row, vMinusOne)));
+
+        // Mask off events outside of the binning range (ordered comparisons also reject NaN)
+        auto tof = loadTimesAVX2(eventTimes + k);
+        mask &= _mm256_movemask_pd(
+            _mm256_and_pd(_mm256_cmp_pd(tof, vFront, _CMP_GE_OQ), _mm256_cmp_pd(tof, vBack, _CMP_LT_OQ)));
+        if (mask == 0)
+            continue;
+
+        // Estimate bin
+        auto x = logarithmic ? logAVX2(tof) : tof;
+        auto estimate = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_sub_pd(x, vOrigin), vInverseWidth));
+        estimate = _mm_min_epi32(_mm_max_epi32(estimate, vZero), vMaxEstimate);
+        auto bin = irregular ? _mm_i32gather_epi32(lookup.data(), estimate, 4) : estimate;
+
+        // Refine by one bin in either direction
+        auto lower = _mm256_i32gather_pd(edges.data(), bin, 8);
+        auto upper = _mm256_i32gather_pd(edges.data() + 1, bin, 8);
+        auto up = _mm256_cvtpd_epi32(_mm256_and_pd(_mm256_cmp_pd(tof, upper, _CMP_GE_OQ), vUnit));
+        auto down = _mm256_cvtpd_epi32(_mm256_and_pd(_mm256_cmp_pd(tof, lower, _CMP_LT_OQ), vUnit));
+        bin = _mm_min_epi32(_mm_max_epi32(_mm_sub_epi32(_mm_add_epi32(bin, up), down), vZero), vLastBin);
+        lower = _mm256_i32gather_pd(edges.data(), bin, 8);
+        upper = _mm256_i32gather_pd(edges.data() + 1, bin, 8);
+        auto resolved = _mm256_movemask_pd(
+            _mm256_and_pd(_mm256_cmp_pd(tof, lower, _CMP_GE_OQ), _mm256_cmp_pd(tof, upper, _CMP_LT_OQ)));
+
+        // Increment counts one lane at a time
+        _mm_store_si128(reinterpret_cast<__m128i *>(index), _mm_add_epi32(_mm_mullo_epi32(row, vNBins), bin));
+        while (mask)
+        {
+            auto lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (resolved & (1 << lane))
+                ++data[index[lane]];
+            else
+                counts.increment(spectrumRows[eventIndices[k + lane]], tofBinning.bin(eventTimes[k + lane]));
+        }
+    }
+
+    // Finish off any remaining events
+    binEventsScalar(eventIndices + k, eventTimes + k, nEvents - k, spectrumRows, tofBinning, counts);
+}
+
+// Load eight event times as doubles
+NP_TARGET_AVX512 inline __m512d loadTimesAVX512(const double *eventTimes) { return _mm512_loadu_pd(eventTimes); }
+NP_TARGET_AVX512 inline __m512d loadTimesAVX512(const float *eventTimes)
+{
+    return _mm512_cvtps_pd(_mm256_loadu_ps(eventTimes));
+}
+
+// Approximate natural logarithm of positive, normal values (absolute error ~1e-7) - exact bins are found by refinement
+NP_TARGET_AVX512 inline __m512d logAVX512(__m512d x)
+{
+    auto exponent = _mm512_getexp_pd(x);
+    auto mantissa = _mm512_getmant_pd(x, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_zero);
+
+    const auto one = _mm512_set1_pd(1.0);
+    auto s = _mm512_div_pd(_mm512_sub_pd(mantissa, one), _mm512_add_pd(mantissa, one));
+    auto s2 = _mm512_mul_pd(s, s);
+    auto series = _mm512_fmadd_pd(s2, _mm512_set1_pd(1.0 / 11.0), _mm512_set1_pd(1.0 / 9.0));
+    series = _mm512_fmadd_pd(s2, series, _mm512_set1_pd(1.0 / 7.0));
+    series = _mm512_fmadd_pd(s2, series, _mm512_set1_pd(1.0 / 5.0));
+    series = _mm512_fmadd_pd(s2, series, _mm512_set1_pd(1.0 / 3.0));
+    series = _mm512_fmadd_pd(s2, series, one);
+
+    return _mm512_fmadd_pd(exponent, _mm512_set1_pd(ln2), _mm512_mul_pd(_mm512_mul_pd(_mm512_set1_pd(2.0), s), series));
+}
+
+// AVX-512 kernel, handling eight events per iteration
+template <TOFBinning::BinningType Type, class TimeType>
+NP_TARGET_AVX512 void binEventsAVX512(const int *eventIndices, const TimeType *eventTimes, std::size_t nEvents,
+                                      const std::vector<int> &spectrumRows, const TOFBinning &tofBinning, CountsMatrix &counts)
+{
+    constexpr auto irregular = Type == TOFBinning::BinningType::Irregular;
+    constexpr auto logarithmic = Type == TOFBinning::BinningType::Logarithmic;
+    const auto &edges = tofBinning.edges();
+    const auto &lookup = tofBinning.lookup();
+    const auto nBins = tofBinning.nBins();
+    const auto origin = irregular ? tofBinning.lookupOrigin() : tofBinning.segments().front().origin;
+    const auto inverseWidth = irregular ? tofBinning.lookupInverseWidth() : tofBinning.segments().front().inverseWidth;
+    const int maxEstimate = irregular ? lookup.size() - 1 : nBins - 1;
+    auto *data = counts.data();
+
+    const auto vZero = _mm256_setzero_si256(), vOne = _mm256_set1_epi32(1), vMinusOne = _mm256_set1_epi32(-1);
+    const auto vIdLimit = _mm256_set1_epi32(spectrumRows.size()), vNBins = _mm256_set1_epi32(nBins);
+    const auto vLastBin = _mm256_set1_epi32(nBins - 1), vMaxEstimate = _mm256_set1_epi32(maxEstimate);
+    const auto vFront = _mm512_set1_pd(edges.front()), vBack = _mm512_set1_pd(edges.back());
+    const auto vOrigin = _mm512_set1_pd(origin), vInverseWidth = _mm512_set1_pd(inverseWidth);
+
+    alignas(32) int index[8];
+    std::size_t k = 0;
+    for (; k + 8 <= nEvents; k += 8)
+    {
+        // Gather spectrum rows for valid event ids, marking others with -1
+        auto id = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(eventIndices + k));
+        __mmask8 idValid = _mm256_cmpgt_epi32_mask(id, vZero) & _mm256_cmplt_epi32_mask(id, vIdLimit);
+        auto row = _mm256_mmask_i32gather_epi32(vMinusOne, idValid, id, spectrumRows.data(), 4);
+        unsigned int mask = _mm256_cmpgt_epi32_mask(row, vMinusOne);
+
+        // Mask off events outside of the binning range (ordered comparisons also reject NaN)
+        auto tof = loadTimesAVX512(eventTimes + k);
+        mask &= _mm512_cmp_pd_mask(tof, vFront, _CMP_GE_OQ) & _mm512_cmp_pd_mask(tof, vBack, _CMP_LT_OQ);
+        if (mask == 0)
+            continue;
+
+        // Estimate bin
+        auto x = logarithmic ? logAVX512(tof) : tof;
+        auto estimate = _mm512_cvttpd_epi32(_mm512_mul_pd(_mm512_sub_pd(x, vOrigin), vInverseWidth));
+        estimate = _mm256_min_epi32(_mm256_max_epi32(estimate, vZero), vMaxEstimate);
+        auto bin = irregular ? _mm256_i32gather_epi32(lookup.data(), estimate, 4) : estimate;
+
+        // Refine by one bin in either direction
+        auto lower = _mm512_i32gather_pd(bin, edges.data(), 8);
+        auto upper = _mm512_i32gather_pd(bin, edges.data() + 1, 8);
+        bin = _mm256_mask_add_epi32(bin, _mm512_cmp_pd_mask(tof, upper, _CMP_GE_OQ), bin, vOne);
+        bin = _mm256_mask_sub_epi32(bin, _mm512_cmp_pd_mask(tof, lower, _CMP_LT_OQ), bin, vOne);
+        bin = _mm256_min_epi32(_mm256_max_epi32(bin, vZero), vLastBin);
+        lower = _mm512_i32gather_pd(bin, edges.data(), 8);
+        upper = _mm512_i32gather_pd(bin, edges.data() + 1, 8);
+        unsigned int resolved = _mm512_cmp_pd_mask(tof, lower, _CMP_GE_OQ) & _mm512_cmp_pd_mask(tof, upper, _CMP_LT_OQ);
+
+        // Increment counts one lane at a time
+        _mm256_store_si256(reinterpret_cast<__m256i *>(index), _mm256_add_epi32(_mm256_mullo_epi32(row, vNBins), bin));
+        while (mask)
+        {
+            auto lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (resolved & (1u << lane))
+                ++data[index[lane]];
+            else
+                counts.increment(spectrumRows[eventIndices[k + lane]], tofBinning.bin(eventTimes[k + lane]));
+        }
+    }
+
+    // Finish off any remaining events
+    binEventsScalar(eventIndices + k, eventTimes + k, nEvents - k, spectrumRows, tofBinning, counts);
+}
+#endif
+} // namespace
+
+// Return text name for the specified instruction set
+std::string instructionSet(InstructionSet set)
+{
+    switch (set)
+    {
+        case (InstructionSet::Scalar):
+            return "scalar";
+        case (InstructionSet::AVX2):
+            return "AVX2";
+        case (InstructionSet::AVX512):
+            return "AVX-512";
+        default:
+            throw(std::runtime_error("Unhandled instruction set.\n"));
+    }
+}
+
+// Return whether the specified instruction set is supported by this build and the current CPU
+bool isSupported(InstructionSet set)
+{
+    if (set == InstructionSet::Scalar)
+        return true;
+#ifdef NP_X86_SIMD
+    __builtin_cpu_init();
+    if (set == InstructionSet::AVX2)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (set == InstructionSet::AVX512)
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx2") &&
+               __builtin_cpu_supports("fma");
+#endif
+    return false;
+}
+
+// Return the best instruction set supported by this build and the current CPU
+InstructionSet detectInstructionSet()
+{
+    for (auto set : {InstructionSet::AVX512, InstructionSet::AVX2})
+        if (isSupported(set))
+            return set;
+    return InstructionSet::Scalar;
+}
+
+// Set instruction set to use for binning (must be supported)
+void setInstructionSet(InstructionSet set)
+{
+    if (!isSupported(set))
+        throw(std::runtime_error("Instruction set '" + instructionSet(set) + "' is not supported on this machine.\n"));
+    selectedInstructionSet() = set;
+}
+
+// Return instruction set in use for binning
+InstructionSet instructionSet() { return selectedInstructionSet(); }
+
+// Bin events into the supplied counts matrix, ignoring those with unknown spectra or TOFs outside of the binning range
+template <class IdType, class TimeType>
+void binEvents(const IdType *eventIndices, const TimeType *eventTimes, std::size_t nEvents,
+               const std::vector<int> &spectrumRows, const TOFBinning &tofBinning, CountsMatrix &counts)
+{
+    binEvents(selectedInstructionSet(), eventIndices, eventTimes, nEvents, spectrumRows, tofBinning, counts);
+}
+
+// Bin events using the specified instruction set
+template <class IdType, class TimeType>
+void binEvents(InstructionSet set, const IdType *eventIndices, const TimeType *eventTimes, std::size_t nEvents,
+               const std::vector<int> &spectrumRows, const TOFBinning &tofBinning, CountsMatrix &counts)
+{
+    // Unsigned ids are binned as signed - any beyond the signed range become negative, and are ignored as invalid just as
+    // they would be if out of range
+    static_assert(sizeof(IdType) == sizeof(int), "Event ids must be 32-bit.");
+    auto *ids = reinterpret_cast<const int *>(eventIndices);
+
+    // Sparse counts are incremented individually until they become dense, after which any remaining events are binned by
+    // the dense kernels
+    if (counts.isSparse())
+    {
+        auto nBinned = binEventsSparse(ids, eventTimes, nEvents, spectrumRows, tofBinning, counts);
+        ids += nBinned;
+        eventTimes += nBinned;
+        nEvents -= nBinned;
+        if (nEvents == 0)
+            return;
+    }
+
+    // The vector kernels use 32-bit indices into the counts matrix, and handle piecewise binning via the scalar path only
+    auto vectorisable = tofBinning.nBins() > 0 && counts.size() <= INT_MAX &&
+                        tofBinning.type() != TOFBinning::BinningType::Piecewise;
+
+#ifdef NP_X86_SIMD
+    if (vectorisable && set != InstructionSet::Scalar)
+    {
+        using BinningType = TOFBinning::BinningType;
+        auto avx512 = set == InstructionSet::AVX512;
+        switch (tofBinning.type())
+        {
+            case (BinningType::Linear):
+                return avx512 ? binEventsAVX512<BinningType::Linear>(ids, eventTimes, nEvents, spectrumRows, tofBinning, counts)
+                              : binEventsAVX2<BinningType::Linear>(ids, eventTimes, nEvents, spectrumRows, tofBinning, counts);
+            case (BinningType::Logarithmic):
+                return avx512 ? binEventsAVX512<BinningType::Logarithmic>(ids, eventTimes, nEvents, spectrumRows, tofBinning,
+                                                                          counts)
+                              : binEventsAVX2<BinningType::Logarithmic>(ids, eventTimes, nEvents, spectrumRows, tofBinning,
+                                                                        counts);
+            default:
+                return avx512 ? binEventsAVX512<BinningType::Irregular>(ids, eventTimes, nEvents, spectrumRows, tofBinning,
+                                                                        counts)
+                              : binEventsAVX2<BinningType::Irregular>(ids, eventTimes, nEvents, spectrumRows, tofBinning,
+                                                                      counts);
+        }
+    }
+#endif
+
+    binEventsScalar(ids, eventTimes, nEvents, spectrumRows, tofBinning, counts);
+}
+
+// Instantiate for the supported event id and time types
+#define NP_INSTANTIATE_BIN_EVENTS(IdType, TimeType)                                                                           \
+    template void binEvents(const IdType *, const TimeType *, std::size_t, const std::vector<int> &, const TOFBinning &,     \
+                            CountsMatrix &);                                                                                 \
+    template void binEvents(InstructionSet, const IdType *, const TimeType *, std::size_t, const std::vector<int> &,         \
+                            const TOFBinning &, CountsMatrix &);
+NP_INSTANTIATE_BIN_EVENTS(int, double)
+NP_INSTANTIATE_BIN_EVENTS(int, float)
+NP_INSTANTIATE_BIN_EVENTS(unsigned int, double)
+NP_INSTANTIATE_BIN_EVENTS(unsigned int, float)
+#undef NP_INSTANTIATE_BIN_EVENTS
+}; // namespace EventBinning
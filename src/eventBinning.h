@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Forward Declarations
+class CountsMatrix;
+class TOFBinning;
+
+namespace EventBinning
+{
+// Available kernel implementations
+enum class InstructionSet
+{
+    Scalar,
+    AVX2,
+    AVX512
+};
+// Return text name for the specified instruction set
+std::string instructionSet(InstructionSet set);
+// Return whether the specified instruction set is supported by this build and the current CPU
+bool isSupported(InstructionSet set);
+// Return the best instruction set supported by this build and the current CPU
+InstructionSet detectInstructionSet();
+// Set instruction set to use for binning (must be supported)
+void setInstructionSet(InstructionSet set);
+// Return instruction set in use for binning
+InstructionSet instructionSet();
+
+// Bin events into the supplied counts matrix, ignoring those with unknown spectra or TOFs outside of the binning range (ids
+// may be int or unsigned int, and times double or float)
+template <class IdType, class TimeType>
+void binEvents(const IdType *eventIndices, const TimeType *eventTimes, std::size_t nEvents,
+               const std::vector<int> &spectrumRows, const TOFBinning &tofBinning, CountsMatrix &counts);
+// Bin events using the specified instruction set
+template <class IdType, class TimeType>
+void binEvents(InstructionSet set, const IdType *eventIndices, const TimeType *eventTimes, std::size_t nEvents,
+               const std::vector<int> &spectrumRows, const TOFBinning &tofBinning, CountsMatrix &counts);
+}; // namespace EventBinning
@@ -0,0 +1,295 @@
+#include "eventReader.h"
+#include <fmt/core.h>
+#include <stdexcept>
+
+EventReader::EventReader(std::vector<std::string> inputFiles, unsigned long long chunkSize, int depth,
+                         unsigned long long memoryBudget, FrameSelector frameSelector)
+    : inputFiles_(std::move(inputFiles)), chunkSize_(chunkSize), depth_(depth), memoryBudget_(memoryBudget),
+      frameSelector_(std::move(frameSelector))
+{
+    if (depth_ > 0)
+        thread_ = std::thread(&EventReader::readAhead, this);
+}
+
+EventReader::~EventReader()
+{
+    if (thread_.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        itemTaken_.notify_all();
+        thread_.join();
+    }
+}
+
+/*
+ * Items
+ */
+
+// Return the size in bytes of event data in the next item to be read
+unsigned long long EventReader::nextItemBytes() const
+{
+    if (!readFile_ || nextChunkIndex_ >= readChunks_.size())
+        return 0;
+
+    return readChunks_[nextChunkIndex_].nLoadedEvents() * readFile_->eventSize();
+}
+
+// Read the next item
+EventReader::Item EventReader::readItem()
+{
+    Item item;
+
+    if (readFile_ && nextChunkIndex_ < readChunks_.size())
+    {
+        // Read the next chunk of the current file, reusing a spare buffer if there is one large enough - a smaller one is
+        // freed rather than grown, so the new buffers are allocated at exactly the size required
+        const auto itemBytes = nextItemBytes();
+        item.type = Item::Type::Chunk;
+        item.file = readFile_;
+        item.chunk = readChunks_[nextChunkIndex_++];
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!spareBuffers_.empty())
+            {
+                auto &&[eventIndices, eventTimes] = spareBuffers_.back();
+                allocatedBytes_ -= bufferBytes(eventIndices, eventTimes);
+                if (bufferBytes(eventIndices, eventTimes) >= itemBytes)
+                {
+                    item.eventIndices.swap(eventIndices);
+                    item.eventTimes.swap(eventTimes);
+                }
+                spareBuffers_.pop_back();
+            }
+        }
+        readFile_->readEventChunk(item.chunk, item.eventIndices, item.eventTimes);
+    }
+    else if (readFile_)
+    {
+        // No more chunks in the current file
+        item.type = Item::Type::EndOfFile;
+        item.file = readFile_;
+        readFile_.reset();
+    }
+    else if (nextFileIndex_ < inputFiles_.size())
+    {
+        // Open the next file and get its frame data
+        readFile_ = std::make_shared<NeXuSFile>(inputFiles_[nextFileIndex_++]);
+        readFile_->loadFrameCounts();
+        readFile_->loadFrameData();
+        readFile_->loadTimes();
+        nextChunkIndex_ = 0;
+        if (frameSelector_)
+        {
+            readChunks_ = readFile_->eventChunks(chunkSize_, frameSelector_(*readFile_));
+            hsize_t nSelected = 0;
+            for (const auto &chunk : readChunks_)
+                nSelected += chunk.nLoadedEvents();
+            fmt::print("... file '{}' - reading {} of {} events ({:.1f}%) from selected frames...\n", readFile_->filename(),
+                       nSelected, readFile_->nEvents(),
+                       readFile_->nEvents() == 0 ? 0.0 : 100.0 * nSelected / readFile_->nEvents());
+        }
+        else
+            readChunks_ = readFile_->eventChunks(chunkSize_);
+
+        item.type = Item::Type::File;
+        item.file = readFile_;
+    }
+
+    return item;
+}
+
+// Return the next item, waiting for it if necessary
+EventReader::Item EventReader::takeItem()
+{
+    // Without read-ahead we just read the item ourselves
+    if (depth_ == 0)
+        return readItem();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    itemQueued_.wait(lock, [&]() { return !queue_.empty(); });
+    auto item = std::move(queue_.front());
+    queue_.pop_front();
+    if (item.type == Item::Type::Chunk)
+    {
+        // The chunk's buffers still count towards the budget until the consumer returns them
+        --nQueuedChunks_;
+        consumerHoldsChunk_ = true;
+    }
+    lock.unlock();
+    itemTaken_.notify_one();
+
+    if (item.type == Item::Type::Error)
+        std::rethrow_exception(item.error);
+
+    return item;
+}
+
+/*
+ * Read-Ahead
+ */
+
+// Return the capacity in bytes of the supplied event buffers
+unsigned long long EventReader::bufferBytes(const NeXuSFile::EventBuffer &eventIndices,
+                                            const NeXuSFile::EventBuffer &eventTimes)
+{
+    return eventIndices.capacity() + eventTimes.capacity();
+}
+
+// Return whether an item needing the specified bytes of event data may be read now, releasing spare buffers to make room if
+// necessary (mutex must be held)
+bool EventReader::canRead(unsigned long long itemBytes)
+{
+    // Items without event data need no room, and a chunk can always be read if the consumer would otherwise have none
+    if (itemBytes == 0 || (nQueuedChunks_ == 0 && !consumerHoldsChunk_))
+        return true;
+    if (nQueuedChunks_ >= depth_)
+        return false;
+
+    // Only the last spare can be reused for the item (and only if it is large enough), so release the others first if we
+    // are short of room
+    auto requiredBytes = [&]()
+    {
+        if (spareBuffers_.empty())
+            return allocatedBytes_ + itemBytes;
+        auto spareBytes = bufferBytes(spareBuffers_.back().first, spareBuffers_.back().second);
+        return spareBytes >= itemBytes ? allocatedBytes_ : allocatedBytes_ - spareBytes + itemBytes;
+    };
+    while (spareBuffers_.size() > 1 && requiredBytes() > memoryBudget_)
+    {
+        allocatedBytes_ -= bufferBytes(spareBuffers_.front().first, spareBuffers_.front().second);
+        spareBuffers_.erase(spareBuffers_.begin());
+    }
+
+    return requiredBytes() <= memoryBudget_;
+}
+
+// Keep event buffers the consumer has finished with for reuse, or free them if there are enough spares already
+void EventReader::recycleBuffers(NeXuSFile::EventBuffer eventIndices, NeXuSFile::EventBuffer eventTimes)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        consumerHoldsChunk_ = false;
+        if (bufferBytes(eventIndices, eventTimes) > 0 && spareBuffers_.size() < depth_)
+            spareBuffers_.emplace_back(std::move(eventIndices), std::move(eventTimes));
+        else
+        {
+            allocatedBytes_ -= bufferBytes(eventIndices, eventTimes);
+            NeXuSFile::EventBuffer().swap(eventIndices);
+            NeXuSFile::EventBuffer().swap(eventTimes);
+        }
+    }
+    itemTaken_.notify_one();
+}
+
+// Read items ahead of the consumer until the end of the input files is reached, or we are told to stop
+void EventReader::readAhead()
+{
+    try
+    {
+        while (true)
+        {
+            // Wait until there is room for the next item - only chunks count towards the limits, and every event buffer
+            // (queued, spare, or held by the consumer) counts towards the memory budget
+            const auto itemBytes = nextItemBytes();
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                itemTaken_.wait(lock, [&]() { return stop_ || canRead(itemBytes); });
+                if (stop_)
+                    return;
+            }
+
+            auto item = readItem();
+            const auto type = item.type;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (type == Item::Type::Chunk)
+                {
+                    ++nQueuedChunks_;
+                    allocatedBytes_ += bufferBytes(item.eventIndices, item.eventTimes);
+                }
+                queue_.push_back(std::move(item));
+            }
+            itemQueued_.notify_one();
+
+            if (type == Item::Type::End)
+                return;
+        }
+    }
+    catch (...)
+    {
+        Item error;
+        error.type = Item::Type::Error;
+        error.error = std::current_exception();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(error));
+        }
+        itemQueued_.notify_one();
+    }
+}
+
+/*
+ * Consumer Interface
+ */
+
+// Return the event buffers of the consumer's current chunk for reuse before it waits for another
+void EventReader::releaseChunk()
+{
+    if (depth_ == 0 || !consumerFile_)
+        return;
+
+    NeXuSFile::EventBuffer eventIndices, eventTimes;
+    consumerFile_->adoptEventChunk({}, eventIndices, eventTimes);
+    recycleBuffers(std::move(eventIndices), std::move(eventTimes));
+}
+
+// Open the next input file with its frame data loaded, skipping any unconsumed chunks of the current one (null at end)
+std::shared_ptr<NeXuSFile> EventReader::nextFile()
+{
+    releaseChunk();
+
+    while (true)
+    {
+        auto item = takeItem();
+        if (item.type == Item::Type::Chunk && depth_ > 0)
+            recycleBuffers(std::move(item.eventIndices), std::move(item.eventTimes));
+        if (item.type == Item::Type::File)
+            return consumerFile_ = item.file;
+        if (item.type == Item::Type::End)
+        {
+            // Leave the end marker for any subsequent calls
+            if (depth_ > 0)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                queue_.push_front(std::move(item));
+            }
+            return consumerFile_ = nullptr;
+        }
+    }
+}
+
+// Load the next chunk of event data into the current file, returning false when there are none left
+bool EventReader::nextChunk()
+{
+    if (!consumerFile_)
+        return false;
+
+    releaseChunk();
+
+    auto item = takeItem();
+    if (item.type == Item::Type::EndOfFile)
+    {
+        consumerFile_.reset();
+        return false;
+    }
+    if (item.type != Item::Type::Chunk || item.file != consumerFile_)
+        throw(std::runtime_error("Event reader is out of step with its consumer.\n"));
+
+    // Pass the data to the file (whose old buffers, if any, we have already returned)
+    consumerFile_->adoptEventChunk(item.chunk, item.eventIndices, item.eventTimes);
+
+    return true;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "nexusFile.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Sequential reader of frame-aligned event chunks from a list of NeXuS files, optionally reading ahead on a background thread
+class EventReader
+{
+    public:
+    // Function returning the ranges of frames in a file whose events should be read
+    using FrameSelector = std::function<std::vector<NeXuSFile::FrameRange>(const NeXuSFile &)>;
+    EventReader(std::vector<std::string> inputFiles, unsigned long long chunkSize, int depth, unsigned long long memoryBudget,
+                FrameSelector frameSelector = {});
+    ~EventReader();
+    EventReader(const EventReader &) = delete;
+    EventReader &operator=(const EventReader &) = delete;
+
+    private:
+    // Files to read, in order
+    std::vector<std::string> inputFiles_;
+    // Maximum number of events per chunk
+    unsigned long long chunkSize_{0};
+    // Maximum number of chunks to read ahead (zero to read synchronously)
+    int depth_{0};
+    // Maximum number of bytes of event buffers to hold, including the consumer's and any spares (a single chunk is always
+    // permitted)
+    unsigned long long memoryBudget_{0};
+    // Selector for frames whose events should be read (all frames if not set)
+    FrameSelector frameSelector_;
+
+    /*
+     * Items
+     */
+    private:
+    // Unit of data passed from reader to consumer
+    struct Item
+    {
+        enum class Type
+        {
+            File,
+            Chunk,
+            EndOfFile,
+            End,
+            Error
+        };
+        Type type{Type::End};
+        // File the item relates to
+        std::shared_ptr<NeXuSFile> file;
+        // Chunk and its event data (Chunk items only)
+        NeXuSFile::EventChunk chunk;
+        NeXuSFile::EventBuffer eventIndices;
+        NeXuSFile::EventBuffer eventTimes;
+        // Captured exception (Error items only)
+        std::exception_ptr error;
+    };
+    // Index of next input file to open
+    int nextFileIndex_{0};
+    // File currently being read, its chunks, and the index of the next chunk to read
+    std::shared_ptr<NeXuSFile> readFile_;
+    std::vector<NeXuSFile::EventChunk> readChunks_;
+    int nextChunkIndex_{0};
+    // File currently being consumed
+    std::shared_ptr<NeXuSFile> consumerFile_;
+
+    private:
+    // Return the size in bytes of event data in the next item to be read
+    unsigned long long nextItemBytes() const;
+    // Read the next item
+    Item readItem();
+    // Return the next item, waiting for it if necessary
+    Item takeItem();
+
+    /*
+     * Read-Ahead
+     */
+    private:
+    // Background reader thread
+    std::thread thread_;
+    // Mutex protecting the queue and buffers
+    std::mutex mutex_;
+    // Condition signalled when an item is queued
+    std::condition_variable itemQueued_;
+    // Condition signalled when an item is taken from the queue, buffers are returned, or we are stopping
+    std::condition_variable itemTaken_;
+    // Queued items
+    std::deque<Item> queue_;
+    // Number of chunks currently queued
+    int nQueuedChunks_{0};
+    // Spare event buffers returned by the consumer for reuse
+    std::vector<std::pair<NeXuSFile::EventBuffer, NeXuSFile::EventBuffer>> spareBuffers_;
+    // Total capacity in bytes of all event buffers, whether queued, spare, or held by the consumer
+    unsigned long long allocatedBytes_{0};
+    // Whether the consumer holds the buffers of a chunk it has not yet finished with
+    bool consumerHoldsChunk_{false};
+    // Whether the reader thread should stop
+    bool stop_{false};
+
+    private:
+    // Return the capacity in bytes of the supplied event buffers
+    static unsigned long long bufferBytes(const NeXuSFile::EventBuffer &eventIndices,
+                                          const NeXuSFile::EventBuffer &eventTimes);
+    // Return whether an item needing the specified bytes of event data may be read now, releasing spare buffers to make room
+    // if necessary (mutex must be held)
+    bool canRead(unsigned long long itemBytes);
+    // Keep event buffers the consumer has finished with for reuse, or free them if there are enough spares already
+    void recycleBuffers(NeXuSFile::EventBuffer eventIndices, NeXuSFile::EventBuffer eventTimes);
+    // Read items ahead of the consumer until the end of the input files is reached, or we are told to stop
+    void readAhead();
+
+    /*
+     * Consumer Interface
+     */
+    private:
+    // Return the event buffers of the consumer's current chunk for reuse before it waits for another
+    void releaseChunk();
+
+    public:
+    // Open the next input file with its frame data loaded, skipping any unconsumed chunks of the current one (null at end)
+    std::shared_ptr<NeXuSFile> nextFile();
+    // Load the next chunk of event data into the current file, returning false when there are none left
+    bool nextChunk();
+};
@@ -0,0 +1,178 @@
+#include "eventSliceFile.h"
+#include "nexusTemplate.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <fmt/core.h>
+#include <mutex>
+
+/*
+ * Events are copied in their stored types into /raw_data_1/detector_1_events/event_id and event_time_offset, with the zero
+ * of each frame (seconds since the start time of the file) in event_time_zero and its number of events in
+ * /raw_data_1/framelog/events_log/value. The start and end times of the file are those of the slice, rounded outwards to
+ * whole seconds. All other metadata and the monitors are taken from the template, along with the detector spectra, TOF bins
+ * and an empty detector counts dataset, so that the file may itself be processed again (or used as a template).
+ */
+
+namespace
+{
+// Number of elements per chunk of the extendable event and frame datasets
+constexpr hsize_t eventChunkSize = 1 << 16, frameChunkSize = 1 << 12;
+
+// Create an empty, extendable 1D dataset of the specified type
+H5::DataSet createExtendable(H5::Group &group, const std::string &name, const H5::DataType &type, hsize_t chunkSize)
+{
+    hsize_t initialSize = 0, maxSize = H5S_UNLIMITED;
+    H5::DataSpace space(1, &initialSize, &maxSize);
+    H5::DSetCreatPropList properties;
+    properties.setChunk(1, &chunkSize);
+    return group.createDataSet(name, type, space, properties);
+}
+
+// Extend the supplied 1D dataset and write the data (of the specified memory type) to its end
+void appendData(H5::DataSet &dataset, const H5::DataType &type, hsize_t offset, hsize_t count, const void *data)
+{
+    hsize_t newSize = offset + count;
+    dataset.extend(&newSize);
+    auto fileSpace = dataset.getSpace();
+    fileSpace.selectHyperslab(H5S_SELECT_SET, &count, &offset);
+    H5::DataSpace memSpace(1, &count);
+    dataset.write(data, type, memSpace, fileSpace);
+}
+
+// Write the specified time (seconds since epoch) to the group as an ISO 8601 time string, replacing any existing one
+void writeTime(H5::Group &group, const std::string &name, std::time_t time)
+{
+    auto text = NeXuSFile::formatTime(time);
+    if (group.nameExists(name))
+        group.unlink(name);
+    H5::StrType type(H5::PredType::C_S1, text.size());
+    hsize_t one = 1;
+    group.createDataSet(name, type, H5::DataSpace(1, &one)).write(text, type);
+}
+} // namespace
+
+EventSliceFile::EventSliceFile(std::string filename, const std::string &templatingSourceFilename, const Window &slice,
+                               const H5::DataType &idType, const H5::DataType &timeType)
+    : filename_(std::move(filename)), startSinceEpoch_(int(std::floor(slice.startTime())))
+{
+    auto nxsTemplate = NeXuSTemplate::get(templatingSourceFilename);
+
+    printf("Templating file '%s' to event file '%s'...\n", templatingSourceFilename.c_str(), filename_.c_str());
+
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+    file_ = nxsTemplate->createMetadataFile(filename_);
+    nxsTemplate->createDetectorLayout(file_);
+    auto rawData = file_.openGroup("raw_data_1");
+    writeTime(rawData, "start_time", startSinceEpoch_);
+    writeTime(rawData, "end_time", std::time_t(std::ceil(slice.endTime())));
+
+    auto events = rawData.createGroup("detector_1_events");
+    eventIds_ = createExtendable(events, "event_id", idType, eventChunkSize);
+    eventTimes_ = createExtendable(events, "event_time_offset", timeType, eventChunkSize);
+    frameZeroes_ = createExtendable(events, "event_time_zero", H5::PredType::IEEE_F64LE, frameChunkSize);
+    H5::StrType unitsType(H5::PredType::C_S1, 6);
+    frameZeroes_.createAttribute("units", unitsType, H5::DataSpace(H5S_SCALAR)).write(unitsType, std::string("second"));
+    auto eventsLog = rawData.createGroup("framelog").createGroup("events_log");
+    eventsPerFrame_ = createExtendable(eventsLog, "value", H5::PredType::STD_I32LE, frameChunkSize);
+}
+
+EventSliceFile::~EventSliceFile()
+{
+    // Errors can no longer be reported
+    try
+    {
+        close();
+    }
+    catch (...)
+    {
+    }
+}
+
+/*
+ * Data
+ */
+
+// Return output filename
+const std::string &EventSliceFile::filename() const { return filename_; }
+
+// Return number of frames written so far
+hsize_t EventSliceFile::nFrames() const { return nFrames_; }
+
+// Return number of events written so far
+hsize_t EventSliceFile::nEvents() const { return nEvents_; }
+
+/*
+ * Output
+ */
+
+// Append the specified range of elements of the source dataset to the destination, in blocks of at most the given size
+void EventSliceFile::copyEvents(const H5::DataSet &source, H5::DataSet &destination, hsize_t firstEvent, hsize_t nEvents,
+                                hsize_t blockSize)
+{
+    // Events are read and written in the stored type of the source, so HDF5 need not convert them
+    auto type = source.getDataType();
+    auto sourceSpace = source.getSpace();
+    for (hsize_t offset = 0; offset < nEvents; offset += blockSize)
+    {
+        auto count = std::min(blockSize, nEvents - offset), sourceOffset = firstEvent + offset;
+        buffer_.resize(count * type.getSize());
+        H5::DataSpace memSpace(1, &count);
+        sourceSpace.selectHyperslab(H5S_SELECT_SET, &count, &sourceOffset);
+        source.read(buffer_.data(), type, memSpace, sourceSpace);
+        appendData(destination, type, nEvents_ + offset, count, buffer_.data());
+    }
+}
+
+// Append the events of the specified frames of the source file, copying them from its event datasets in blocks of at most
+// the given number of events
+void EventSliceFile::append(const NeXuSFile &source, const H5::DataSet &sourceIds, const H5::DataSet &sourceTimes,
+                            int firstFrame, int lastFrame, hsize_t blockSize)
+{
+    if (lastFrame <= firstFrame)
+        return;
+
+    Profiler::Scope profile(Profiler::Phase::Save, filename_);
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+    // Frame zeroes are made relative to our own start time
+    const auto &frameOffsets = source.frameOffsets();
+    std::vector<double> frameZeroes(frameOffsets.begin() + firstFrame, frameOffsets.begin() + lastFrame);
+    const auto shift = double(source.startSinceEpoch() - startSinceEpoch_);
+    for (auto &zero : frameZeroes)
+        zero += shift;
+    const hsize_t nFrames = lastFrame - firstFrame;
+    appendData(frameZeroes_, H5::PredType::NATIVE_DOUBLE, nFrames_, nFrames, frameZeroes.data());
+    appendData(eventsPerFrame_, H5::PredType::NATIVE_INT, nFrames_, nFrames, source.eventsPerFrame().data() + firstFrame);
+
+    const auto firstEvent = source.frameFirstEvents()[firstFrame], nEvents = source.frameFirstEvents()[lastFrame] - firstEvent;
+    copyEvents(sourceIds, eventIds_, firstEvent, nEvents, blockSize);
+    copyEvents(sourceTimes, eventTimes_, firstEvent, nEvents, blockSize);
+
+    nFrames_ += nFrames;
+    nEvents_ += nEvents;
+
+    const auto nBytes = nEvents * (sourceIds.getDataType().getSize() + sourceTimes.getDataType().getSize());
+    profile.add(Profiler::Counter::BytesRead, nBytes);
+    profile.add(Profiler::Counter::BytesWritten, nBytes);
+}
+
+// Record the number of good frames and close the file
+void EventSliceFile::close()
+{
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+    if (file_.getId() < 0)
+        return;
+
+    const int nGoodFrames = nFrames_;
+    file_.openDataSet("raw_data_1/good_frames").write(&nGoodFrames, H5::PredType::NATIVE_INT);
+
+    eventIds_.close();
+    eventTimes_.close();
+    frameZeroes_.close();
+    eventsPerFrame_.close();
+    file_.close();
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "nexusFile.h"
+#include "window.h"
+#include <H5Cpp.h>
+#include <string>
+#include <vector>
+
+// NeXuS event file holding the events of a single slice, appended a contiguous range of source frames at a time
+class EventSliceFile
+{
+    public:
+    EventSliceFile(std::string filename, const std::string &templatingSourceFilename, const Window &slice,
+                   const H5::DataType &idType, const H5::DataType &timeType);
+    ~EventSliceFile();
+    EventSliceFile(const EventSliceFile &) = delete;
+    EventSliceFile &operator=(const EventSliceFile &) = delete;
+
+    /*
+     * Data
+     */
+    private:
+    // Output filename
+    std::string filename_;
+    // Start time of the file (whole seconds since epoch), to which frame zeroes are relative
+    int startSinceEpoch_{0};
+    // Number of frames and events written so far
+    hsize_t nFrames_{0}, nEvents_{0};
+    // Output file
+    H5::H5File file_;
+    // Event ids and time offsets, frame zeroes, and events per frame
+    H5::DataSet eventIds_, eventTimes_, frameZeroes_, eventsPerFrame_;
+    // Buffer for events in transit
+    std::vector<char> buffer_;
+
+    private:
+    // Append the specified range of elements of the source dataset to the destination, in blocks of at most the given size
+    void copyEvents(const H5::DataSet &source, H5::DataSet &destination, hsize_t firstEvent, hsize_t nEvents,
+                    hsize_t blockSize);
+
+    public:
+    // Return output filename
+    [[nodiscard]] const std::string &filename() const;
+    // Return number of frames written so far
+    [[nodiscard]] hsize_t nFrames() const;
+    // Return number of events written so far
+    [[nodiscard]] hsize_t nEvents() const;
+
+    /*
+     * Output
+     */
+    public:
+    // Append the events of the specified frames of the source file, copying them from its event datasets in blocks of at most
+    // the given number of events
+    void append(const NeXuSFile &source, const H5::DataSet &sourceIds, const H5::DataSet &sourceTimes, int firstFrame,
+                int lastFrame, hsize_t blockSize);
+    // Record the number of good frames and close the file
+    void close();
+};
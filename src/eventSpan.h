@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Read-only view of contiguous event data, held either in memory or mapped directly from file
+template <class T> class EventSpan
+{
+    public:
+    EventSpan() = default;
+    EventSpan(const T *data, std::size_t size) : data_(data), size_(size) {}
+    EventSpan(const std::vector<T> &data) : data_(data.data()), size_(data.size()) {}
+
+    private:
+    // Pointer to the first element
+    const T *data_{nullptr};
+    // Number of elements
+    std::size_t size_{0};
+
+    public:
+    // Return pointer to the first element
+    [[nodiscard]] const T *data() const { return data_; }
+    // Return number of elements
+    [[nodiscard]] std::size_t size() const { return size_; }
+    // Return whether the span is empty
+    [[nodiscard]] bool empty() const { return size_ == 0; }
+    // Return the specified element
+    const T &operator[](std::size_t index) const { return data_[index]; }
+    // Return iterators over the elements
+    [[nodiscard]] const T *begin() const { return data_; }
+    [[nodiscard]] const T *end() const { return data_ + size_; }
+};
@@ -1,71 +1,337 @@
+#include "eventReader.h"
 #include "nexusFile.h"
 #include "processors.h"
-#include "window.h"
+#include <algorithm>
+#include <cstring>
 #include <fmt/core.h>
-#include <optional>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
 
 namespace Processors
 {
-// Get events from specified spectrum, returning seconds since epoch for each
-std::map<int, std::vector<double>> getEvents(const std::vector<std::string> &inputNeXusFiles, int spectrumId, bool firstOnly)
+namespace
+{
+// Event matched to one of the target spectra
+struct EventHit
+{
+    // Spectrum the event belongs to
+    int spectrum{0};
+    // Event time offset (microseconds)
+    double timeOffset{0.0};
+    // Frame zero (seconds since run start)
+    double frameZero{0.0};
+};
+
+/*
+ * Events are written to binary output as a header ("NPEVENTS" followed by a 32-bit format version) and then one packed
+ * record per event containing its 32-bit spectrum and 64-bit time (seconds since epoch), all in native byte order. HDF5
+ * output contains the same information in /events/spectrum_index and /events/time.
+ */
+class EventOutput
+{
+    public:
+    EventOutput(std::string_view filename)
+    {
+        if (filename.empty())
+            return;
+
+        auto extension = std::string(filename.substr(std::min(filename.size(), filename.rfind('.'))));
+        hdf5_ = extension == ".h5" || extension == ".hdf5";
+        if (hdf5_)
+        {
+            std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+            output_ = H5::H5File(std::string(filename), H5F_ACC_TRUNC);
+            auto events = output_.createGroup("events");
+            hsize_t initialSize = 0, maxSize = H5S_UNLIMITED, chunkSize = 65536;
+            H5::DataSpace space(1, &initialSize, &maxSize);
+            H5::DSetCreatPropList properties;
+            properties.setChunk(1, &chunkSize);
+            spectra_ = events.createDataSet("spectrum_index", H5::PredType::NATIVE_INT, space, properties);
+            times_ = events.createDataSet("time", H5::PredType::NATIVE_DOUBLE, space, properties);
+        }
+        else
+        {
+            binary_.open(std::string(filename), std::ios::binary | std::ios::trunc);
+            if (!binary_)
+                throw(std::runtime_error(fmt::format("Failed to open '{}' for writing.\n", filename)));
+            const int version = 1;
+            binary_.write("NPEVENTS", 8);
+            binary_.write(reinterpret_cast<const char *>(&version), sizeof(int));
+        }
+    }
+
+    private:
+    // Whether output is to HDF5 (otherwise binary)
+    bool hdf5_{false};
+    // Binary output stream
+    std::ofstream binary_;
+    // HDF5 output file and datasets
+    H5::H5File output_;
+    H5::DataSet spectra_, times_;
+    // Number of events written so far
+    hsize_t nWritten_{0};
+
+    public:
+    // Write the supplied events
+    void write(const std::vector<int> &spectra, const std::vector<double> &times)
+    {
+        if (spectra.empty())
+            return;
+
+        if (binary_.is_open())
+        {
+            std::vector<char> records(spectra.size() * (sizeof(int) + sizeof(double)));
+            auto *record = records.data();
+            for (auto i = 0; i < spectra.size(); ++i)
+            {
+                std::memcpy(record, &spectra[i], sizeof(int));
+                std::memcpy(record + sizeof(int), &times[i], sizeof(double));
+                record += sizeof(int) + sizeof(double);
+            }
+            binary_.write(records.data(), records.size());
+            if (!binary_)
+                throw(std::runtime_error("Failed to write events to binary output.\n"));
+        }
+        else if (hdf5_)
+        {
+            std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+            hsize_t count = spectra.size(), newSize = nWritten_ + count;
+            H5::DataSpace memSpace(1, &count);
+            auto append = [&](H5::DataSet &dataset, const H5::PredType &type, const void *data)
+            {
+                dataset.extend(&newSize);
+                auto fileSpace = dataset.getSpace();
+                fileSpace.selectHyperslab(H5S_SELECT_SET, &count, &nWritten_);
+                dataset.write(data, type, memSpace, fileSpace);
+            };
+            append(spectra_, H5::PredType::NATIVE_INT, spectra.data());
+            append(times_, H5::PredType::NATIVE_DOUBLE, times.data());
+        }
+
+        nWritten_ += spectra.size();
+    }
+    // Finish writing
+    void close()
+    {
+        if (binary_.is_open())
+            binary_.close();
+        if (hdf5_)
+        {
+            std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+            spectra_.close();
+            times_.close();
+            output_.close();
+        }
+    }
+};
+} // namespace
+
+// Return the largest detector spectrum in the specified NeXuS file
+int maxSpectrum(const std::string &filename)
+{
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+    H5::H5File input(filename, H5F_ACC_RDONLY);
+    auto dataset = input.openDataSet("raw_data_1/detector_1/spectrum_index");
+    std::vector<int> spectra(dataset.getSpace().getSimpleExtentNpoints());
+    dataset.read(spectra.data(), H5::PredType::NATIVE_INT);
+
+    return spectra.empty() ? 0 : *std::max_element(spectra.begin(), spectra.end());
+}
+
+// Parse a list of spectra and / or inclusive ranges of spectra (e.g. "1,5,10-20"), all of which must lie between 1 and the
+// specified maximum
+std::vector<int> parseSpectra(std::string_view text, int maxSpectrum)
+{
+    std::vector<int> spectra;
+
+    auto toInt = [text](std::string_view value)
+    {
+        try
+        {
+            std::size_t nChars = 0;
+            auto result = std::stoi(std::string(value), &nChars);
+            if (nChars == value.size())
+                return result;
+        }
+        catch (...)
+        {
+        }
+        throw(std::runtime_error(fmt::format("Invalid spectrum list '{}'.\n", text)));
+    };
+
+    // Spectra are checked before any range is expanded, so a mistyped range can never request huge amounts of memory
+    auto checkSpectrum = [maxSpectrum](int spectrum)
+    {
+        if (spectrum < 1 || spectrum > maxSpectrum)
+            throw(std::runtime_error(
+                fmt::format("Spectrum {} is out of range - spectra must lie between 1 and {}.\n", spectrum, maxSpectrum)));
+    };
+
+    std::size_t start = 0;
+    while (start <= text.size())
+    {
+        auto end = std::min(text.find(',', start), text.size());
+        auto item = text.substr(start, end - start);
+        auto dash = item.find('-', 1);
+        if (dash == std::string_view::npos)
+        {
+            auto spectrum = toInt(item);
+            checkSpectrum(spectrum);
+            spectra.push_back(spectrum);
+        }
+        else
+        {
+            auto first = toInt(item.substr(0, dash)), last = toInt(item.substr(dash + 1));
+            if (last < first)
+                throw(std::runtime_error(fmt::format("Invalid spectrum range '{}'.\n", item)));
+            checkSpectrum(first);
+            checkSpectrum(last);
+            for (long long spectrum = first; spectrum <= last; ++spectrum)
+                spectra.push_back(int(spectrum));
+        }
+        start = end + 1;
+    }
+
+    std::sort(spectra.begin(), spectra.end());
+    spectra.erase(std::unique(spectra.begin(), spectra.end()), spectra.end());
+
+    return spectra;
+}
+
+// Get events for the specified spectra, writing them to the output file (binary, or HDF5 if its extension is .h5 / .hdf5)
+// and / or printing them, and returning the number of events found for each spectrum
+std::map<int, unsigned long long> getEvents(const std::vector<std::string> &inputNeXusFiles, const std::vector<int> &spectra,
+                                            std::string_view outputFile, bool printEvents, bool firstOnly)
 {
     /*
-     * Dump all events for the specified detector spectrum
+     * Extract all events for the specified detector spectra in a single pass over the input files
      */
 
     printf("Get events...\n");
-    fmt::print("Target detector spectrum is {}\n", spectrumId);
+    std::map<int, unsigned long long> eventCounts;
+    if (spectra.empty())
+        return eventCounts;
+    if (spectra.size() == 1)
+        fmt::print("Target detector spectrum is {}\n", spectra.front());
+    else
+        fmt::print("Target detector spectra are {} spectra between {} and {}\n", spectra.size(), spectra.front(),
+                   spectra.back());
+    if (!outputFile.empty())
+        fmt::print("Events will be written to '{}'.\n", outputFile);
+
+    std::map<int, double> lastSecondsSinceEpoch;
 
-    std::map<int, std::vector<double>> eventMap;
-    std::optional<double> lastSecondsSinceEpoch;
+    // Create a bitmap of the target spectra so we can test each event in constant time
+    std::vector<char> targets(std::max(spectra.back() + 1, 0), 0);
+    for (auto spectrum : spectra)
+        if (spectrum >= 0)
+            targets[spectrum] = 1;
+    auto isTarget = [&](int spectrum) { return spectrum >= 0 && spectrum < targets.size() && targets[spectrum]; };
+
+    EventOutput output(outputFile);
 
     // Loop over input Nexus files
-    for (auto &nxsFileName : inputNeXusFiles)
+    EventReader reader(inputNeXusFiles, eventChunkSize_, readAheadDepth_, readAheadMemory_ * 1024 * 1024);
+    while (auto nxsPtr = reader.nextFile())
     {
-        // Open the Nexus file ready for use
-        NeXuSFile nxs(nxsFileName);
-        nxs.loadEventData();
-        nxs.loadTimes();
-        fmt::print("... file '{}' has {} events...\n", nxsFileName, nxs.eventTimes().size());
+        auto &nxs = *nxsPtr;
+        fmt::print("... file '{}' has {} events...\n", nxs.filename(), nxs.nEvents());
 
-        auto eventStart = 0, eventEnd = 0;
         const auto &eventsPerFrame = nxs.eventsPerFrame();
-        const auto &eventIndices = nxs.eventIndices();
-        const auto &eventTimes = nxs.eventTimes();
         const auto &frameOffsets = nxs.frameOffsets();
 
-        // Loop over frames in the Nexus file
-        for (auto frameIndex = 0; frameIndex < nxs.eventsPerFrame().size(); ++frameIndex)
+        // Loop over frame-aligned chunks of events in the Nexus file
+        while (reader.nextChunk())
         {
-            // Set new end event index and get zero for frame
-            eventEnd += eventsPerFrame[frameIndex];
-            auto frameZero = frameOffsets[frameIndex];
+            const auto &chunk = nxs.eventChunk();
+
+            // Divide the frames in the chunk between threads, each collecting the events it finds for the target spectra
+            auto threadFrames = partitionFrames(nxs, chunk.firstFrame, chunk.lastFrame, nThreads_);
+            std::vector<std::vector<EventHit>> threadHits(nThreads_);
+            auto findEvents = [&](int thread)
+            {
+                if (threadFrames[thread] == threadFrames[thread + 1])
+                    return;
 
-            for (auto k = eventStart; k < eventEnd; ++k)
+                // Search the events in the types held by the file
+                nxs.visitEvents(
+                    [&](auto eventIndices, auto eventTimes)
+                    {
+                        auto eventStart = nxs.chunkEvents(threadFrames[thread], threadFrames[thread + 1]).first;
+                        for (auto frameIndex = threadFrames[thread]; frameIndex < threadFrames[thread + 1]; ++frameIndex)
+                        {
+                            auto eventEnd = eventStart + eventsPerFrame[frameIndex];
+                            for (auto k = eventStart; k < eventEnd; ++k)
+                            {
+                                // Unsigned ids beyond the signed range become negative, so are never targets
+                                int spectrum = eventIndices[k];
+                                if (isTarget(spectrum))
+                                    threadHits[thread].push_back({spectrum, eventTimes[k], frameOffsets[frameIndex]});
+                            }
+                            eventStart = eventEnd;
+                        }
+                    });
+            };
+            if (nThreads_ == 1)
+                findEvents(0);
+            else
             {
-                if (eventIndices[k] == spectrumId)
+                std::vector<std::thread> threads;
+                for (auto thread = 0; thread < nThreads_; ++thread)
+                    threads.emplace_back(findEvents, thread);
+                for (auto &thread : threads)
+                    thread.join();
+            }
+
+            // Process the found events in order
+            std::vector<int> hitSpectra;
+            std::vector<double> hitTimes;
+            for (const auto &hits : threadHits)
+                for (const auto &hit : hits)
                 {
-                    auto eMicroSeconds = eventTimes[k];
-                    auto eSeconds = eMicroSeconds * 0.000001;
-                    auto eSecondsSinceEpoch = eSeconds + frameZero + nxs.startSinceEpoch();
-                    if (lastSecondsSinceEpoch)
-                        fmt::print("{:20.6f}  {:20.10f}  {:20.5f}  {}\n", eMicroSeconds, eSeconds + frameZero,
-                                   eSecondsSinceEpoch, eSecondsSinceEpoch - *lastSecondsSinceEpoch);
-                    else
-                        fmt::print("{:20.6f}  {:20.10f}  {:20.5f}\n", eMicroSeconds, eSeconds + frameZero, eSecondsSinceEpoch);
-                    eventMap[spectrumId].push_back(eSecondsSinceEpoch);
-                    lastSecondsSinceEpoch = eSecondsSinceEpoch;
+                    auto eSeconds = hit.timeOffset * 0.000001;
+                    auto eSecondsSinceEpoch = eSeconds + hit.frameZero + nxs.startSinceEpoch();
+                    if (printEvents)
+                    {
+                        // The spectrum is only printed if there is more than one, so single-spectrum output is unchanged
+                        if (spectra.size() > 1)
+                            fmt::print("{:8d}  ", hit.spectrum);
+                        auto lastIt = lastSecondsSinceEpoch.find(hit.spectrum);
+                        if (lastIt != lastSecondsSinceEpoch.end())
+                            fmt::print("{:20.6f}  {:20.10f}  {:20.5f}  {}\n", hit.timeOffset, eSeconds + hit.frameZero,
+                                       eSecondsSinceEpoch, eSecondsSinceEpoch - lastIt->second);
+                        else
+                            fmt::print("{:20.6f}  {:20.10f}  {:20.5f}\n", hit.timeOffset, eSeconds + hit.frameZero,
+                                       eSecondsSinceEpoch);
+                        lastSecondsSinceEpoch[hit.spectrum] = eSecondsSinceEpoch;
+                    }
+                    hitSpectra.push_back(hit.spectrum);
+                    hitTimes.push_back(eSecondsSinceEpoch);
+                    ++eventCounts[hit.spectrum];
+
                     if (firstOnly)
-                        return eventMap;
+                    {
+                        output.write(hitSpectra, hitTimes);
+                        output.close();
+                        return eventCounts;
+                    }
                 }
-            }
-
-            // Update start event index
-            eventStart = eventEnd;
+            output.write(hitSpectra, hitTimes);
         }
     }
 
-    return eventMap;
+    output.close();
+
+    unsigned long long nTotal = 0;
+    for (auto &&[spectrum, count] : eventCounts)
+        nTotal += count;
+    fmt::print("Found {} events in {} of {} target spectra.\n", nTotal, eventCounts.size(), spectra.size());
+
+    return eventCounts;
 }
 
 } // namespace Processors
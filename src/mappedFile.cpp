@@ -0,0 +1,81 @@
+#include "mappedFile.h"
+#include <algorithm>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string &filename)
+{
+#ifndef _WIN32
+    auto fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    // The mapping remains valid once the descriptor is closed
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        auto *address = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (address != MAP_FAILED)
+        {
+            data_ = static_cast<const char *>(address);
+            size_ = info.st_size;
+        }
+    }
+    close(fd);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+    if (data_)
+        munmap(const_cast<char *>(data_), size_);
+#endif
+}
+
+// Return whether the file is mapped
+bool MappedFile::isMapped() const { return data_ != nullptr; }
+
+// Return start of the mapped file
+const char *MappedFile::data() const { return data_; }
+
+// Return size of the mapped file, in bytes
+std::size_t MappedFile::size() const { return size_; }
+
+namespace
+{
+// Apply advice to the pages covering the specified range of a mapping
+void advise(const char *data, std::size_t size, std::size_t offset, std::size_t length, int advice)
+{
+#ifndef _WIN32
+    if (!data || length == 0 || offset >= size)
+        return;
+
+    // Advice must start on a page boundary
+    static const auto pageSize = std::size_t(sysconf(_SC_PAGESIZE));
+    auto start = offset - offset % pageSize;
+    auto end = std::min(offset + length, size);
+    madvise(const_cast<char *>(data + start), end - start, advice);
+#endif
+}
+} // namespace
+
+// Advise that the specified range of the file will be read sequentially
+void MappedFile::adviseSequential(std::size_t offset, std::size_t length) const
+{
+#ifndef _WIN32
+    advise(data_, size_, offset, length, MADV_SEQUENTIAL);
+#endif
+}
+
+// Advise that the specified range of the file will be read soon
+void MappedFile::adviseWillNeed(std::size_t offset, std::size_t length) const
+{
+#ifndef _WIN32
+    advise(data_, size_, offset, length, MADV_WILLNEED);
+#endif
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file, which is simply left unmapped if the platform or file does not allow it
+class MappedFile
+{
+    public:
+    MappedFile(const std::string &filename);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    private:
+    // Start of the mapped file
+    const char *data_{nullptr};
+    // Size of the mapped file, in bytes
+    std::size_t size_{0};
+
+    public:
+    // Return whether the file is mapped
+    [[nodiscard]] bool isMapped() const;
+    // Return start of the mapped file
+    [[nodiscard]] const char *data() const;
+    // Return size of the mapped file, in bytes
+    [[nodiscard]] std::size_t size() const;
+    // Advise that the specified range of the file will be read sequentially
+    void adviseSequential(std::size_t offset, std::size_t length) const;
+    // Advise that the specified range of the file will be read soon
+    void adviseWillNeed(std::size_t offset, std::size_t length) const;
+};
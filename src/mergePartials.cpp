@@ -0,0 +1,252 @@
+#include "nexusFile.h"
+#include "processors.h"
+#include "profiler.h"
+#include "window.h"
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cmath>
+#include <filesystem>
+#include <fmt/core.h>
+#include <mutex>
+#include <stdexcept>
+
+/*
+ * Partial outputs are ordinary per-slice NeXuS files holding unscaled detector counts, with an additional /np_partial group
+ * whose attributes record the detector and monitor frame counts and the window of the slice. Monitor counts and frames are
+ * those of the file each partial output was templated from, so merged outputs take them from the first partial output given
+ * for each slice, just as summed processing takes them from its first input file.
+ */
+
+namespace Processors
+{
+namespace
+{
+// Name of the group marking partial outputs
+const std::string partialGroupName_ = "np_partial";
+// Approximate amount of memory to use for each block of merged detector counts (bytes)
+constexpr hsize_t mergeBlockBytes_ = 64 * 1024 * 1024;
+
+// Frame counts and window of a partial output
+struct PartialInfo
+{
+    int detectorFrames{0}, monitorFrames{0};
+    double windowStart{0.0}, windowEnd{0.0};
+};
+
+// Read partial output information from the supplied file, throwing if it is not a partial output
+PartialInfo readPartialInfo(const H5::H5File &file)
+{
+    if (!file.nameExists(partialGroupName_))
+        throw(std::runtime_error(fmt::format("File '{}' is not a partial output.\n", file.getFileName())));
+
+    auto group = file.openGroup(partialGroupName_);
+    PartialInfo info;
+    info.detectorFrames = NeXuSFile::readAttribute<int>(group, "detector_frames", H5::PredType::NATIVE_INT);
+    info.monitorFrames = NeXuSFile::readAttribute<int>(group, "monitor_frames", H5::PredType::NATIVE_INT);
+    info.windowStart = NeXuSFile::readAttribute<double>(group, "window_start", H5::PredType::NATIVE_DOUBLE);
+    info.windowEnd = NeXuSFile::readAttribute<double>(group, "window_end", H5::PredType::NATIVE_DOUBLE);
+    return info;
+}
+
+// Return paths to the monitor count datasets in the supplied file
+std::vector<std::string> monitorDataPaths(const H5::H5File &file)
+{
+    std::vector<std::string> paths;
+    auto rawData = file.openGroup("raw_data_1");
+    for (hsize_t i = 0; i < rawData.getNumObjs(); ++i)
+    {
+        auto name = rawData.getObjnameByIdx(i);
+        if (name.rfind("monitor_", 0) == 0 && rawData.nameExists(name + "/data"))
+            paths.push_back("raw_data_1/" + name + "/data");
+    }
+    return paths;
+}
+
+// Merge the supplied partial outputs for a single slice into the specified output file, applying any post-processing
+void mergeSlice(const std::string &outputFilename, const std::vector<std::string> &partialFiles)
+{
+    Profiler::Scope profile(Profiler::Phase::Save, outputFilename);
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+    // Open the partial outputs and check that they are for the same slice and of the same size
+    std::vector<H5::H5File> inputs;
+    std::vector<PartialInfo> infos;
+    for (const auto &filename : partialFiles)
+    {
+        if (std::filesystem::exists(outputFilename) && std::filesystem::equivalent(outputFilename, filename))
+            throw(std::runtime_error(fmt::format("Merged output '{}' would overwrite a partial output.\n", outputFilename)));
+        inputs.emplace_back(filename, H5F_ACC_RDONLY);
+        infos.push_back(readPartialInfo(inputs.back()));
+        auto duration = infos.back().windowEnd - infos.back().windowStart;
+        if (std::fabs(duration - (infos.front().windowEnd - infos.front().windowStart)) > 1.0e-6)
+            throw(std::runtime_error(fmt::format("Partial output '{}' is for a slice of different width to '{}'.\n", filename,
+                                                 partialFiles.front())));
+    }
+    std::vector<H5::DataSet> inputCounts;
+    for (auto &input : inputs)
+        inputCounts.push_back(input.openDataSet("raw_data_1/detector_1/counts"));
+    std::vector<hsize_t> dims(inputCounts.front().getSpace().getSimpleExtentNdims());
+    inputCounts.front().getSpace().getSimpleExtentDims(dims.data());
+    for (auto i = 1; i < inputCounts.size(); ++i)
+    {
+        std::vector<hsize_t> otherDims(inputCounts[i].getSpace().getSimpleExtentNdims());
+        inputCounts[i].getSpace().getSimpleExtentDims(otherDims.data());
+        if (otherDims != dims)
+            throw(std::runtime_error(fmt::format("Partial output '{}' has detector counts of a different size to '{}'.\n",
+                                                 partialFiles[i], partialFiles.front())));
+    }
+
+    // Detector frames are summed, while monitors come from the first partial output - each job leaves its slice at the
+    // window occurrence of its own last input file, so the last partial output gives the final window
+    auto nDetectorFrames = 0;
+    for (const auto &info : infos)
+        nDetectorFrames += info.detectorFrames;
+    const auto nMonitorFrames = infos.front().monitorFrames;
+    fmt::print("Output '{}' ({} -> {}) has {} detector frames and {} monitor frames from {} partial output(s).\n",
+               outputFilename, infos.back().windowStart, infos.back().windowEnd, nDetectorFrames, nMonitorFrames,
+               partialFiles.size());
+    double detectorFactor = 1.0, monitorFactor = 1.0;
+    switch (postProcessingMode_)
+    {
+        case (Processors::PostProcessingMode::None):
+            break;
+        case (Processors::PostProcessingMode::ScaleMonitors):
+            monitorFactor = (double)nDetectorFrames / (double)nMonitorFrames;
+            fmt::print(" --> Scaling monitors by processed detector-to-monitor frame ratio ({}).\n", monitorFactor);
+            break;
+        case (Processors::PostProcessingMode::ScaleDetectors):
+            detectorFactor = (double)nMonitorFrames / (double)nDetectorFrames;
+            fmt::print(" --> Scaling detectors by processed monitor-to-detector frame ratio ({}).\n", detectorFactor);
+            break;
+        default:
+            throw(std::runtime_error("Unhandled post processing mode.\n"));
+    }
+
+    // The output starts as a copy of the first partial output, which provides its metadata and monitors
+    std::filesystem::copy_file(partialFiles.front(), outputFilename, std::filesystem::copy_options::overwrite_existing);
+    H5::H5File output(outputFilename, H5F_ACC_RDWR);
+    output.unlink(partialGroupName_);
+
+    // Stream detector counts in blocks along the first dimension (other than the last) which isn't unity, summing the
+    // partial outputs and scaling the totals, and checking that they fit the stored type
+    auto outputCounts = output.openDataSet("raw_data_1/detector_1/counts");
+    auto countsType = outputCounts.getIntType();
+    auto maxCount = (long long)INT_MAX;
+    if (countsType.getSize() < sizeof(int))
+        maxCount = (1LL << (8 * countsType.getSize() - (countsType.getSign() == H5T_SGN_NONE ? 0 : 1))) - 1;
+    auto blockDim = 0;
+    while (blockDim < int(dims.size()) - 1 && dims[blockDim] == 1)
+        ++blockDim;
+    hsize_t unitSize = 1;
+    for (auto i = blockDim + 1; i < dims.size(); ++i)
+        unitSize *= dims[i];
+    const auto unitsPerBlock = std::max(hsize_t(1), mergeBlockBytes_ / (unitSize * (2 * sizeof(int) + sizeof(long long))));
+    std::vector<int> buffer;
+    std::vector<long long> totals;
+    unsigned long long nCounts = 0;
+    for (hsize_t first = 0; first < dims[blockDim]; first += unitsPerBlock)
+    {
+        std::vector<hsize_t> start(dims.size(), 0), count = dims;
+        start[blockDim] = first;
+        count[blockDim] = std::min(unitsPerBlock, dims[blockDim] - first);
+        hsize_t blockSize = count[blockDim] * unitSize;
+        H5::DataSpace memorySpace(1, &blockSize);
+        buffer.resize(blockSize);
+        totals.assign(blockSize, 0);
+
+        for (auto &counts : inputCounts)
+        {
+            auto fileSpace = counts.getSpace();
+            fileSpace.selectHyperslab(H5S_SELECT_SET, count.data(), start.data());
+            counts.read(buffer.data(), H5::PredType::NATIVE_INT, memorySpace, fileSpace);
+            for (hsize_t i = 0; i < blockSize; ++i)
+                totals[i] += buffer[i];
+        }
+
+        for (hsize_t i = 0; i < blockSize; ++i)
+        {
+            auto total = postProcessingMode_ == PostProcessingMode::ScaleDetectors ? (long long)(totals[i] * detectorFactor)
+                                                                                   : totals[i];
+            if (total < 0 || total > maxCount)
+                throw(std::runtime_error(
+                    fmt::format("Merged detector counts exceed the range of the output data type (maximum {}).\n", maxCount)));
+            buffer[i] = total;
+            nCounts += total;
+        }
+
+        auto fileSpace = outputCounts.getSpace();
+        fileSpace.selectHyperslab(H5S_SELECT_SET, count.data(), start.data());
+        outputCounts.write(buffer.data(), H5::PredType::NATIVE_INT, memorySpace, fileSpace);
+    }
+    if (postProcessingMode_ == PostProcessingMode::ScaleDetectors)
+    {
+        nDetectorFrames *= detectorFactor;
+        fmt::print(" ... Detector counts scaled to {}, and effective contributing detector frames to {}.\n", nCounts,
+                   nDetectorFrames);
+    }
+
+    // Write good frames, and scale monitors if requested
+    std::array<int, 1> framesBuffer{nDetectorFrames};
+    output.openDataSet("raw_data_1/good_frames").write(framesBuffer.data(), H5::PredType::STD_I32LE);
+    if (postProcessingMode_ == PostProcessingMode::ScaleMonitors)
+    {
+        for (const auto &path : monitorDataPaths(output))
+        {
+            auto monitor = output.openDataSet(path);
+            std::vector<int> counts(monitor.getSpace().getSimpleExtentNpoints());
+            monitor.read(counts.data(), H5::PredType::NATIVE_INT);
+            for (auto &bin : counts)
+                bin *= monitorFactor;
+            monitor.write(counts.data(), H5::PredType::NATIVE_INT);
+        }
+    }
+
+    output.flush(H5F_SCOPE_LOCAL);
+    profile.add(Profiler::Counter::BytesWritten, outputCounts.getStorageSize());
+    output.close();
+}
+} // namespace
+
+// Mark saved slices as partial outputs, recording their unscaled detector and monitor frame counts and windows
+void markPartial(const std::vector<std::pair<Window, NeXuSFile>> &slices)
+{
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+    for (const auto &[slice, nxs] : slices)
+    {
+        H5::H5File file(nxs.filename(), H5F_ACC_RDWR);
+        if (file.nameExists(partialGroupName_))
+            file.unlink(partialGroupName_);
+        auto group = file.createGroup(partialGroupName_);
+        NeXuSFile::writeAttribute(group, "detector_frames", H5::PredType::NATIVE_INT, nxs.nDetectorFrames());
+        NeXuSFile::writeAttribute(group, "monitor_frames", H5::PredType::NATIVE_INT, nxs.nMonitorFrames());
+        NeXuSFile::writeAttribute(group, "window_start", H5::PredType::NATIVE_DOUBLE, slice.startTime());
+        NeXuSFile::writeAttribute(group, "window_end", H5::PredType::NATIVE_DOUBLE, slice.endTime());
+        file.close();
+    }
+}
+
+// Merge partial outputs of summed processing into final slice files, applying any post-processing
+void mergePartials(const std::vector<std::string> &partialFiles, std::string_view outputFilePath)
+{
+    fmt::print("Merging {} partial output(s)...\n", partialFiles.size());
+
+    // Partial outputs of the same slice from different jobs share a filename, so group them by it (in order of appearance)
+    std::vector<std::pair<std::string, std::vector<std::string>>> slices;
+    for (const auto &file : partialFiles)
+    {
+        auto name = std::filesystem::path(file).filename().string();
+        auto it = std::find_if(slices.begin(), slices.end(), [&name](const auto &slice) { return slice.first == name; });
+        if (it == slices.end())
+            slices.push_back({name, {file}});
+        else
+            it->second.push_back(file);
+    }
+
+    for (const auto &[name, files] : slices)
+        mergeSlice(fmt::format("{}{}", outputFilePath, name), files);
+
+    fmt::print("Merged {} slice(s).\n", slices.size());
+}
+} // namespace Processors
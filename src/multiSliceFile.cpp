@@ -0,0 +1,180 @@
+#include "multiSliceFile.h"
+#include "nexusTemplate.h"
+#include "profiler.h"
+#include <algorithm>
+#include <array>
+#include <fmt/core.h>
+#include <mutex>
+
+/*
+ * Detector counts for all slices are stored in /slices/counts, with the spectrum and TOF bin axes in
+ * /slices/spectrum_index and /slices/time_of_flight. Frame counts and start times for each slice are stored in
+ * /slices/good_frames and /slices/start_time. All other metadata and the monitors are taken from the template once.
+ */
+
+MultiSliceFile::MultiSliceFile(std::string filename, const std::string &templatingSourceFilename, int nSlices)
+    : filename_(std::move(filename)), nSlices_(nSlices)
+{
+    auto nxsTemplate = NeXuSTemplate::get(templatingSourceFilename);
+    nSpectra_ = nxsTemplate->spectra().size();
+    nBins_ = nxsTemplate->tofBins().size() - 1;
+
+    fmt::print("Creating single output file '{}' for all slices...\n", filename_);
+
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+    file_ = nxsTemplate->createMetadataFile(filename_);
+    auto group = file_.createGroup("slices");
+
+    // Write the axes
+    hsize_t nSpectra = nSpectra_, nEdges = nBins_ + 1;
+    group.createDataSet("spectrum_index", H5::PredType::STD_I32LE, H5::DataSpace(1, &nSpectra))
+        .write(nxsTemplate->spectra().data(), H5::PredType::NATIVE_INT);
+    group.createDataSet("time_of_flight", H5::PredType::IEEE_F64LE, H5::DataSpace(1, &nEdges))
+        .write(nxsTemplate->tofBins().data(), H5::PredType::NATIVE_DOUBLE);
+
+    // Create the extendable counts dataset, stored as requested for detector counts
+    const auto &storage = NeXuSTemplate::countsStorage();
+    std::vector<hsize_t> dims{0, hsize_t(nSlices_), nSpectra_, nBins_};
+    std::vector<hsize_t> maxDims{H5S_UNLIMITED, hsize_t(nSlices_), nSpectra_, nBins_};
+    H5::DataSpace countsSpace(dims.size(), dims.data(), maxDims.data());
+    auto properties = storage.creationProperties(dims, true);
+    counts_ =
+        H5Dcreate2(group.getId(), "counts", storage.fileType(), countsSpace.getId(), H5P_DEFAULT, properties, H5P_DEFAULT);
+    H5Pclose(properties);
+    if (counts_ < 0)
+        throw(std::runtime_error("Failed to create detector counts dataset.\n"));
+
+    // Create the extendable side datasets
+    std::array<hsize_t, 2> sideDims{0, hsize_t(nSlices_)}, sideMaxDims{H5S_UNLIMITED, hsize_t(nSlices_)},
+        sideChunk{64, hsize_t(nSlices_)};
+    H5::DataSpace sideSpace(2, sideDims.data(), sideMaxDims.data());
+    H5::DSetCreatPropList sideProperties;
+    sideProperties.setChunk(2, sideChunk.data());
+    goodFrames_ = group.createDataSet("good_frames", H5::PredType::STD_I32LE, sideSpace, sideProperties);
+    startTimes_ = group.createDataSet("start_time", H5::PredType::IEEE_F64LE, sideSpace, sideProperties);
+    H5::StrType unitsType(H5::PredType::C_S1, 6);
+    startTimes_.createAttribute("units", unitsType, H5::DataSpace(H5S_SCALAR)).write(unitsType, std::string("second"));
+}
+
+MultiSliceFile::~MultiSliceFile()
+{
+    // Errors can no longer be reported
+    try
+    {
+        close();
+    }
+    catch (...)
+    {
+    }
+}
+
+/*
+ * Data
+ */
+
+// Return output filename
+const std::string &MultiSliceFile::filename() const { return filename_; }
+
+// Return number of windows written so far
+hsize_t MultiSliceFile::nWindows() const { return nWindows_; }
+
+/*
+ * Output
+ */
+
+// Append the supplied slices as the next window
+void MultiSliceFile::append(const std::vector<std::pair<Window, NeXuSFile>> &slices)
+{
+    if (slices.empty())
+        return;
+    if (slices.size() != nSlices_)
+        throw(std::runtime_error(fmt::format("Expected {} slices to append to '{}' but got {}.\n", nSlices_, filename_,
+                                             slices.size())));
+
+    // Check counts fit the stored type before we write anything
+    const auto maxCount = NeXuSTemplate::countsStorage().maxCount();
+    std::vector<int> denseBuffer;
+    for (const auto &[slice, nxs] : slices)
+    {
+        const auto &counts = nxs.detectorCounts();
+        if (counts.nRows() != nSpectra_ || counts.nBins() != nBins_)
+            throw(std::runtime_error("Slice detector counts do not match the layout of the output file.\n"));
+        auto *data = counts.denseData(denseBuffer);
+        auto [minCount, maxSliceCount] = std::minmax_element(data, data + counts.size());
+        if (counts.size() > 0 && (*minCount < 0 || *maxSliceCount > maxCount))
+            throw(std::runtime_error(
+                fmt::format("Detector counts exceed the range of the output data type (maximum {}).\n", maxCount)));
+    }
+
+    fmt::print("Appending {} slice(s) to output file '{}' as window {}...\n", nSlices_, filename_, nWindows_);
+
+    Profiler::Scope profile(Profiler::Phase::Save, filename_);
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+    const auto initialStorageSize = H5Dget_storage_size(counts_);
+
+    // Extend the datasets by one window
+    std::array<hsize_t, 4> countsDims{nWindows_ + 1, hsize_t(nSlices_), nSpectra_, nBins_};
+    if (H5Dset_extent(counts_, countsDims.data()) < 0)
+        throw(std::runtime_error("Failed to extend detector counts dataset.\n"));
+    std::array<hsize_t, 2> sideDims{nWindows_ + 1, hsize_t(nSlices_)};
+    goodFrames_.extend(sideDims.data());
+    startTimes_.extend(sideDims.data());
+
+    // Write detector counts for each slice - rows are stored in spectrum_index order, so can be written directly
+    std::array<hsize_t, 2> memDims{nSpectra_, nBins_};
+    H5::DataSpace memSpace(2, memDims.data());
+    auto fileSpace = H5Dget_space(counts_);
+    for (auto i = 0; i < nSlices_; ++i)
+    {
+        std::array<hsize_t, 4> offset{nWindows_, hsize_t(i), 0, 0}, count{1, 1, nSpectra_, nBins_};
+        H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, offset.data(), nullptr, count.data(), nullptr);
+        if (H5Dwrite(counts_, H5T_NATIVE_INT, memSpace.getId(), fileSpace, H5P_DEFAULT,
+                     slices[i].second.detectorCounts().denseData(denseBuffer)) < 0)
+        {
+            H5Sclose(fileSpace);
+            throw(std::runtime_error("Failed to write detector counts.\n"));
+        }
+    }
+    H5Sclose(fileSpace);
+
+    // Write frame counts and start times
+    std::vector<int> goodFrames;
+    std::vector<double> startTimes;
+    for (const auto &[slice, nxs] : slices)
+    {
+        goodFrames.push_back(nxs.nDetectorFrames());
+        startTimes.push_back(slice.startTime());
+    }
+    std::array<hsize_t, 2> sideOffset{nWindows_, 0}, sideCount{1, hsize_t(nSlices_)};
+    H5::DataSpace sideMemSpace(2, sideCount.data());
+    auto writeSide = [&](H5::DataSet &dataset, const H5::PredType &type, const void *data)
+    {
+        auto space = dataset.getSpace();
+        space.selectHyperslab(H5S_SELECT_SET, sideCount.data(), sideOffset.data());
+        dataset.write(data, type, sideMemSpace, space);
+    };
+    writeSide(goodFrames_, H5::PredType::NATIVE_INT, goodFrames.data());
+    writeSide(startTimes_, H5::PredType::NATIVE_DOUBLE, startTimes.data());
+
+    // Flush so that completed windows are available to readers while we continue
+    file_.flush(H5F_SCOPE_LOCAL);
+    profile.add(Profiler::Counter::BytesWritten, H5Dget_storage_size(counts_) - initialStorageSize);
+
+    ++nWindows_;
+}
+
+// Close the file
+void MultiSliceFile::close()
+{
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+    if (counts_ >= 0)
+    {
+        H5Dclose(counts_);
+        counts_ = -1;
+        goodFrames_.close();
+        startTimes_.close();
+        file_.close();
+    }
+}
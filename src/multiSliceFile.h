@@ -0,0 +1,51 @@
+#pragma once
+
+#include "nexusFile.h"
+#include "window.h"
+#include <H5Cpp.h>
+#include <string>
+#include <vector>
+
+// Single HDF5 output file holding detector counts for every slice of every window, appended as windows complete
+class MultiSliceFile
+{
+    public:
+    MultiSliceFile(std::string filename, const std::string &templatingSourceFilename, int nSlices);
+    ~MultiSliceFile();
+    MultiSliceFile(const MultiSliceFile &) = delete;
+    MultiSliceFile &operator=(const MultiSliceFile &) = delete;
+
+    /*
+     * Data
+     */
+    private:
+    // Output filename
+    std::string filename_;
+    // Number of slices per window
+    int nSlices_{0};
+    // Number of detector spectra and TOF bins
+    hsize_t nSpectra_{0}, nBins_{0};
+    // Number of windows written so far
+    hsize_t nWindows_{0};
+    // Output file
+    H5::H5File file_;
+    // Detector counts [window, slice, spectrum, tof]
+    hid_t counts_{-1};
+    // Frame counts and start times (seconds since epoch) [window, slice]
+    H5::DataSet goodFrames_, startTimes_;
+
+    public:
+    // Return output filename
+    [[nodiscard]] const std::string &filename() const;
+    // Return number of windows written so far
+    [[nodiscard]] hsize_t nWindows() const;
+
+    /*
+     * Output
+     */
+    public:
+    // Append the supplied slices as the next window
+    void append(const std::vector<std::pair<Window, NeXuSFile>> &slices);
+    // Close the file
+    void close();
+};
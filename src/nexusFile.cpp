@@ -1,27 +1,21 @@
 #include "nexusFile.h"
+#include "eventBinning.h"
+#include "mappedFile.h"
+#include "nexusTemplate.h"
+#include "profiler.h"
 #include <algorithm>
 #include <array>
 #include <ctime>
 #include <fmt/core.h>
 #include <iostream>
+#include <mutex>
+#include <optional>
 
-// Basic paths required when copying / creating a NeXuS file
-std::vector<std::string> neXuSBasicPaths_ = {"/raw_data_1/title",
-                                             "/raw_data_1/user_1/name",
-                                             "/raw_data_1/start_time",
-                                             "/raw_data_1/good_frames",
-                                             "/raw_data_1/raw_frames",
-                                             "/raw_data_1/monitor_1/data",
-                                             "/raw_data_1/monitor_1/time_of_flight",
-                                             "/raw_data_1/monitor_2/data",
-                                             "/raw_data_1/monitor_3/data",
-                                             "/raw_data_1/monitor_4/data",
-                                             "/raw_data_1/monitor_5/data",
-                                             "/raw_data_1/monitor_6/data",
-                                             "/raw_data_1/monitor_7/data",
-                                             "/raw_data_1/monitor_8/data",
-                                             "/raw_data_1/monitor_9/data",
-                                             "/raw_data_1/detector_1/counts"};
+namespace
+{
+// Whether event data may be mapped directly from files
+bool eventMapping_ = true;
+} // namespace
 
 NeXuSFile::NeXuSFile(std::string filename, bool loadEvents) : filename_(filename)
 {
@@ -31,7 +25,7 @@ NeXuSFile::NeXuSFile(std::string filename, bool loadEvents) : filename_(filename
         loadFrameCounts();
         loadEventData();
         loadTimes();
-        fmt::print("... file '{}' has {} goodframes and {} events...\n", filename_, nGoodFrames_, eventTimes_.size());
+        fmt::print("... file '{}' has {} goodframes and {} events...\n", filename_, nGoodFrames_, nEvents());
     }
 }
 
@@ -39,6 +33,41 @@ NeXuSFile::NeXuSFile(std::string filename, bool loadEvents) : filename_(filename
  * I/O
  */
 
+// Return mutex which must be held while calling HDF5, since the library is not necessarily built thread-safe
+std::recursive_mutex &NeXuSFile::hdf5Mutex()
+{
+    static std::recursive_mutex mutex;
+    return mutex;
+}
+
+// Return seconds since epoch for the supplied ISO 8601 time string, which is taken to be in local standard time
+std::time_t NeXuSFile::parseTime(const std::string &time)
+{
+    int y = 0, M = 0, d = 0, h = 0, m = 0, s = 0;
+    sscanf(time.c_str(), "%d-%d-%dT%d:%d:%d", &y, &M, &d, &h, &m, &s);
+    std::tm tm = {0};
+    tm.tm_year = y - 1900;
+    tm.tm_mon = M - 1;
+    tm.tm_mday = d;
+    tm.tm_hour = h;
+    tm.tm_min = m;
+    tm.tm_sec = s;
+    return mktime(&tm);
+}
+
+// Return the supplied time (seconds since epoch) as an ISO 8601 string in local standard time, as read by parseTime()
+std::string NeXuSFile::formatTime(std::time_t time)
+{
+    // Find the standard (non-DST) offset of local time from UTC by reading the UTC time back as local standard time
+    std::tm utc = *std::gmtime(&time);
+    utc.tm_isdst = 0;
+    auto local = time + (time - mktime(&utc));
+
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", std::gmtime(&local));
+    return buffer;
+}
+
 // Return handle and (simple) dimension for named leaf dataset
 std::pair<H5::DataSet, long int> NeXuSFile::find1DDataset(H5::H5File file, H5std_string groupName, H5std_string datasetName)
 {
@@ -59,80 +88,146 @@ std::pair<H5::DataSet, long int> NeXuSFile::find1DDataset(H5::H5File file, H5std
     return {dataset, spaceDims[0]};
 }
 
-// Return filename
-std::string NeXuSFile::filename() const { return filename_; }
-
-// Template basic paths from the referenceFile, and make ready for histogram binning
-void NeXuSFile::templateFile(std::string referenceFile, std::string outputFile)
+// Read the specified (start, count) ranges of the supplied 1D dataset consecutively into the destination buffer
+void NeXuSFile::read1DRanges(const H5::DataSet &dataset, hid_t memType, const std::vector<std::pair<hsize_t, hsize_t>> &ranges,
+                             void *destination)
 {
-    filename_ = outputFile;
-
-    // Open input Nexus file in read only mode.
-    H5::H5File input = H5::H5File(referenceFile, H5F_ACC_RDONLY);
+    // Select the union of the ranges in the file, to be read with a single call
+    H5::DataSpace fileSpace = dataset.getSpace();
+    fileSpace.selectNone();
+    hsize_t nTotal = 0;
+    for (const auto &[start, count] : ranges)
+    {
+        if (count == 0)
+            continue;
+        fileSpace.selectHyperslab(H5S_SELECT_OR, &count, &start);
+        nTotal += count;
+    }
+    if (nTotal == 0)
+        return;
 
-    // Create new Nexus file for output.
-    H5::H5File output = H5::H5File(filename_, H5F_ACC_TRUNC);
+    H5::DataSpace memSpace(1, &nTotal);
 
-    printf("Templating file '%s' to '%s'...\n", referenceFile.c_str(), filename_.c_str());
-    hid_t ocpl_id, lcpl_id;
-    ocpl_id = H5Pcreate(H5P_OBJECT_COPY);
-    if (ocpl_id < 0)
-        throw(std::runtime_error("File templating failed.\n"));
-    lcpl_id = H5Pcreate(H5P_LINK_CREATE);
-    if (lcpl_id < 0)
-        throw(std::runtime_error("File templating failed.\n"));
-    if (H5Pset_create_intermediate_group(lcpl_id, 1) < 0)
-        throw(std::runtime_error("File templating failed.\n"));
+    if (H5Dread(dataset.getId(), memType, memSpace.getId(), fileSpace.getId(), H5P_DEFAULT, destination) < 0)
+        throw(std::runtime_error("Failed to read dataset range.\n"));
+}
 
-    for (const auto &path : neXuSBasicPaths_)
+// Determine in-memory event types from the stored types of the event datasets in the supplied (open) file
+void NeXuSFile::detectEventTypes(const H5::H5File &input)
+{
+    // Unsigned 32-bit ids and single-precision times are kept as they are - anything else is converted as before
+    eventIdType_ = EventIdType::Int32;
+    eventTimeType_ = EventTimeType::Float64;
+    auto &&[eventIndicesID, eventIndicesDimension] =
+        NeXuSFile::find1DDataset(input, "raw_data_1/detector_1_events", "event_id");
+    if (eventIndicesDimension > 0)
     {
-        if (H5Ocopy(input.getId(), path.c_str(), output.getId(), path.c_str(), ocpl_id, lcpl_id) < 0)
-            throw(std::runtime_error("Failed to copy one or more paths.\n"));
+        auto type = eventIndicesID.getDataType();
+        if (type.getClass() == H5T_INTEGER && type.getSize() == 4 && H5Tget_sign(type.getId()) == H5T_SGN_NONE)
+            eventIdType_ = EventIdType::UInt32;
     }
+    auto &&[eventTimesID, eventTimesDimension] =
+        NeXuSFile::find1DDataset(input, "raw_data_1/detector_1_events", "event_time_offset");
+    if (eventTimesDimension > 0)
+    {
+        auto type = eventTimesID.getDataType();
+        if (type.getClass() == H5T_FLOAT && type.getSize() == 4)
+            eventTimeType_ = EventTimeType::Float32;
+    }
+}
 
-    H5Pclose(ocpl_id);
-    H5Pclose(lcpl_id);
+// Return size in bytes and HDF5 memory type of event ids and times of the specified types
+std::size_t NeXuSFile::idTypeSize(EventIdType type)
+{
+    return type == EventIdType::UInt32 ? sizeof(unsigned int) : sizeof(int);
+}
+std::size_t NeXuSFile::timeTypeSize(EventTimeType type)
+{
+    return type == EventTimeType::Float32 ? sizeof(float) : sizeof(double);
+}
+hid_t NeXuSFile::idMemType(EventIdType type) { return type == EventIdType::UInt32 ? H5T_NATIVE_UINT : H5T_NATIVE_INT; }
+hid_t NeXuSFile::timeMemType(EventTimeType type)
+{
+    return type == EventTimeType::Float32 ? H5T_NATIVE_FLOAT : H5T_NATIVE_DOUBLE;
+}
 
-    // Read in detector spectra information
-    auto &&[spectraID, spectraDimension] = NeXuSFile::find1DDataset(input, "raw_data_1/detector_1", "spectrum_index");
-    spectra_.resize(spectraDimension);
-    H5Dread(spectraID.getId(), H5T_STD_I32LE, H5S_ALL, H5S_ALL, H5P_DEFAULT, spectra_.data());
+// Map event data directly from the supplied (open) file if its datasets allow it
+void NeXuSFile::mapEventData(const H5::H5File &input)
+{
+    mappedFile_.reset();
+    mappedEventIndices_ = nullptr;
+    mappedEventTimes_ = nullptr;
+    if (!eventMapping())
+        return;
+
+    // Each dataset must be stored contiguously and unfiltered in the file itself, in exactly our in-memory type, and
+    // suitably aligned - otherwise HDF5 must read it for us
+    auto mappableOffset = [&](const H5::DataSet &dataset, hid_t memType) -> std::optional<hsize_t>
+    {
+        auto properties = dataset.getCreatePlist();
+        auto type = dataset.getDataType();
+        auto offset = H5Dget_offset(dataset.getId());
+        if (H5Pget_layout(properties.getId()) != H5D_CONTIGUOUS || properties.getNfilters() != 0 ||
+            properties.getExternalCount() != 0 || H5Tequal(type.getId(), memType) <= 0 || offset == HADDR_UNDEF ||
+            offset % H5Tget_size(memType) != 0)
+            return std::nullopt;
+        return offset;
+    };
 
-    // Read in TOF bin information.
-    auto &&[tofBinsID, tofBinsDimension] = NeXuSFile::find1DDataset(input, "raw_data_1/monitor_1", "time_of_flight");
-    tofBins_.resize(tofBinsDimension);
-    H5Dread(tofBinsID.getId(), H5T_IEEE_F64LE, H5S_ALL, H5S_ALL, H5P_DEFAULT, tofBins_.data());
+    auto &&[eventIndicesID, eventIndicesDimension] =
+        NeXuSFile::find1DDataset(input, "raw_data_1/detector_1_events", "event_id");
+    auto &&[eventTimesID, eventTimesDimension] =
+        NeXuSFile::find1DDataset(input, "raw_data_1/detector_1_events", "event_time_offset");
+    if (eventIndicesDimension != nEvents() || eventTimesDimension != nEvents() || nEvents() == 0)
+        return;
+    auto indicesOffset = mappableOffset(eventIndicesID, idMemType(eventIdType_));
+    auto timesOffset = mappableOffset(eventTimesID, timeMemType(eventTimeType_));
+    if (!indicesOffset || !timesOffset)
+        return;
+
+    // Both datasets must lie within the mapped file
+    auto mappedFile = std::make_shared<const MappedFile>(filename_);
+    auto indicesBytes = nEvents() * idTypeSize(eventIdType_), timesBytes = nEvents() * timeTypeSize(eventTimeType_);
+    if (!mappedFile->isMapped() || *indicesOffset + indicesBytes > mappedFile->size() ||
+        *timesOffset + timesBytes > mappedFile->size())
+        return;
+
+    mappedFile->adviseSequential(*indicesOffset, indicesBytes);
+    mappedFile->adviseSequential(*timesOffset, timesBytes);
+    mappedEventIndices_ = mappedFile->data() + *indicesOffset;
+    mappedEventTimes_ = mappedFile->data() + *timesOffset;
+    mappedFile_ = std::move(mappedFile);
+    fmt::print("... event data in file '{}' will be mapped directly from disk.\n", filename_);
+}
 
-    // Set up detector histograms
-    for (auto spec : spectra_)
-    {
-        detectorHistograms_[spec] = gsl_histogram_alloc(tofBins_.size() - 1);
-        gsl_histogram_set_ranges(detectorHistograms_[spec], tofBins_.data(), tofBins_.size());
-    }
+// Return filename
+std::string NeXuSFile::filename() const { return filename_; }
 
-    // Read in monitor data - start from index 1 and end when we fail to find the named dataset with this suffix
-    auto i = 1;
-    while (true)
-    {
-        auto &&[monitorSpectrum, monitorSpectrumDimension] =
-            NeXuSFile::find1DDataset(input, "/raw_data_1/monitor_" + std::to_string(i), "data");
-        if (monitorSpectrum.getId() <= 0)
-            break;
+// Template basic paths from the referenceFile, and make ready for histogram binning
+void NeXuSFile::templateFile(std::string referenceFile, std::string outputFile)
+{
+    templateFile(*NeXuSTemplate::get(referenceFile), outputFile);
+}
 
-        monitorCounts_[i].resize(tofBinsDimension);
-        H5Dread(monitorSpectrum.getId(), H5T_STD_I32LE, H5S_ALL, H5S_ALL, H5P_DEFAULT, monitorCounts_[i].data());
+// Create a new output file from the supplied template (unless told not to), and make ready for histogram binning (leaving
+// detector counts unallocated if requested)
+void NeXuSFile::templateFile(const NeXuSTemplate &nxsTemplate, std::string outputFile, bool createFile, bool allocateCounts)
+{
+    filename_ = outputFile;
 
-        ++i;
+    if (createFile)
+    {
+        printf("Templating file '%s' to '%s'...\n", nxsTemplate.referenceFile().c_str(), filename_.c_str());
+        nxsTemplate.createFile(filename_);
     }
 
-    // Read in good frames - this will reflect our current monitor frame count since we copied those histograms in full
-    auto &&[goodFramesID, goodFramesDimension] = NeXuSFile::find1DDataset(input, "raw_data_1", "good_frames");
-    auto goodFramesTemp = new int[(long int)goodFramesDimension];
-    H5Dread(goodFramesID.getId(), H5T_STD_I32LE, H5S_ALL, H5S_ALL, H5P_DEFAULT, goodFramesTemp);
-    nMonitorFrames_ = goodFramesTemp[0];
-
-    input.close();
-    output.close();
+    spectra_ = nxsTemplate.spectra();
+    spectrumRows_ = nxsTemplate.spectrumRows();
+    tofBins_ = nxsTemplate.tofBins();
+    tofBinning_ = nxsTemplate.tofBinning();
+    monitorCounts_ = nxsTemplate.monitorCounts();
+    nMonitorFrames_ = nxsTemplate.nMonitorFrames();
+    detectorCounts_.initialise(spectra_.size(), tofBins_.size() - 1, allocateCounts);
 }
 
 // Load frame counts
@@ -140,6 +235,8 @@ void NeXuSFile::loadFrameCounts()
 {
     printf("Load frame counts...\n");
 
+    std::lock_guard<std::recursive_mutex> lock(hdf5Mutex());
+
     // Open our Nexus file in read only mode.
     H5::H5File input = H5::H5File(filename_, H5F_ACC_RDONLY);
 
@@ -152,91 +249,93 @@ void NeXuSFile::loadFrameCounts()
     input.close();
 }
 
-// Load event data
-void NeXuSFile::loadEventData()
+// Load frame data (events per frame and frame offsets)
+void NeXuSFile::loadFrameData()
 {
-    printf("Load event data...\n");
+    printf("Load frame data...\n");
+
+    Profiler::Scope profile(Profiler::Phase::Load, filename_);
+    std::lock_guard<std::recursive_mutex> lock(hdf5Mutex());
 
     // Open our Nexus file in read only mode.
     H5::H5File input = H5::H5File(filename_, H5F_ACC_RDONLY);
 
-    // Read in event indices.
-    auto &&[eventIndicesID, eventIndicesDimension] =
-        NeXuSFile::find1DDataset(input, "raw_data_1/detector_1_events", "event_id");
-    eventIndices_.resize(eventIndicesDimension);
-    H5Dread(eventIndicesID.getId(), H5T_STD_I32LE, H5S_ALL, H5S_ALL, H5P_DEFAULT, eventIndices_.data());
-
-    // Read in events.
-    auto &&[eventTimesID, eventTimesDimension] =
-        NeXuSFile::find1DDataset(input, "raw_data_1/detector_1_events", "event_time_offset");
-    eventTimes_.resize(eventTimesDimension);
-    H5Dread(eventTimesID.getId(), H5T_IEEE_F64LE, H5S_ALL, H5S_ALL, H5P_DEFAULT, eventTimes_.data());
-
     // Read in event counts per frame
     auto &&[eventsPerFrameID, eventsPerFrameDimension] =
         NeXuSFile::find1DDataset(input, "raw_data_1/framelog/events_log", "value");
     eventsPerFrame_.resize(eventsPerFrameDimension);
     H5Dread(eventsPerFrameID.getId(), H5T_STD_I32LE, H5S_ALL, H5S_ALL, H5P_DEFAULT, eventsPerFrame_.data());
 
+    // Construct the index of the first event in each frame (plus the total number of events at the end)
+    frameFirstEvents_.resize(eventsPerFrame_.size() + 1);
+    frameFirstEvents_[0] = 0;
+    for (auto i = 0; i < eventsPerFrame_.size(); ++i)
+        frameFirstEvents_[i + 1] = frameFirstEvents_[i] + eventsPerFrame_[i];
+
     // Read in frame offsets.
     auto &&[frameOffsetsID, frameOffsetsDimension] =
         NeXuSFile::find1DDataset(input, "raw_data_1/detector_1_events", "event_time_zero");
     frameOffsets_.resize(frameOffsetsDimension);
     H5Dread(frameOffsetsID.getId(), H5T_IEEE_F64LE, H5S_ALL, H5S_ALL, H5P_DEFAULT, frameOffsets_.data());
+    profile.add(Profiler::Counter::BytesRead, eventsPerFrame_.size() * sizeof(int) + frameOffsets_.size() * sizeof(double));
+
+    // Keep event data in its stored types, and map it if we can so that chunks need not be read
+    detectEventTypes(input);
+    mapEventData(input);
 
     input.close();
 }
 
+// Load event data
+void NeXuSFile::loadEventData()
+{
+    printf("Load event data...\n");
+
+    loadFrameData();
+
+    // Load all frames as a single chunk
+    auto chunks = eventChunks(std::max(nEvents(), hsize_t(1)));
+    if (!chunks.empty())
+        loadEventChunk(chunks.front());
+}
+
 // Load start/end times
 void NeXuSFile::loadTimes()
 {
     printf("Load times....\n");
 
+    std::lock_guard<std::recursive_mutex> lock(hdf5Mutex());
+
     // Open our Nexus file in read only mode.
     H5::H5File input = H5::H5File(filename_, H5F_ACC_RDONLY);
 
-    // Read in start time in Unix time.
+    // Read in start and end times in Unix time.
     hid_t memType = H5Tcopy(H5T_C_S1);
     H5Tset_size(memType, UCHAR_MAX);
     char timeBuffer[UCHAR_MAX];
-    int y = 0, M = 0, d = 0, h = 0, m = 0, s = 0;
 
     auto &&[startTimeID, startTimeDimension] = NeXuSFile::find1DDataset(input, "raw_data_1", "start_time");
     H5Dread(startTimeID.getId(), memType, H5S_ALL, H5S_ALL, H5P_DEFAULT, timeBuffer);
+    startSinceEpoch_ = (int)parseTime(timeBuffer);
 
-    sscanf(timeBuffer, "%d-%d-%dT%d:%d:%d", &y, &M, &d, &h, &m, &s);
-    std::tm stime = {0};
-    stime.tm_year = y - 1900;
-    stime.tm_mon = M - 1;
-    stime.tm_mday = d;
-    stime.tm_hour = h;
-    stime.tm_min = m;
-    stime.tm_sec = s;
-    startSinceEpoch_ = (int)mktime(&stime);
-
-    // Read in end time in Unix time.
     auto &&[endTimeID, endTimeDimension] = NeXuSFile::find1DDataset(input, "raw_data_1", "end_time");
     H5Dread(endTimeID.getId(), memType, H5S_ALL, H5S_ALL, H5P_DEFAULT, timeBuffer);
-
-    sscanf(timeBuffer, "%d-%d-%dT%d:%d:%d", &y, &M, &d, &h, &m, &s);
-    std::tm etime = {0};
-    etime.tm_year = y - 1900;
-    etime.tm_mon = M - 1;
-    etime.tm_mday = d;
-    etime.tm_hour = h;
-    etime.tm_min = m;
-    etime.tm_sec = s;
-
-    endSinceEpoch_ = (int)mktime(&etime);
+    endSinceEpoch_ = (int)parseTime(timeBuffer);
 
     input.close();
 }
 
 // Save key modified data back to the file
-bool NeXuSFile::saveModifiedData()
+bool NeXuSFile::saveModifiedData() { return saveModifiedData(filename_); }
+
+// Save key modified data to the specified file, which must have been templated in the same way as our own
+bool NeXuSFile::saveModifiedData(const std::string &filename)
 {
+    Profiler::Scope profile(Profiler::Phase::Save, filename);
+    std::lock_guard<std::recursive_mutex> lock(hdf5Mutex());
+
     // Open Nexus file in read/write mode.
-    H5::H5File output = H5::H5File(filename_, H5F_ACC_RDWR);
+    H5::H5File output = H5::H5File(filename, H5F_ACC_RDWR);
 
     // Write good frames
     std::array<int, 1> framesBuffer{0};
@@ -252,24 +351,35 @@ bool NeXuSFile::saveModifiedData()
         monitorCounts.write(counts.data(), H5::PredType::STD_I32LE);
     }
 
-    // Write detector counts
-    const auto nSpec = spectra_.size();
-    const auto nTofBins = tofBins_.size() - 1;
-
-    auto *countsBuffer = new int[nSpec * nTofBins]; // HDF5 expects contiguous memory. This is a pain.
-    for (auto i = 0; i < nSpec; ++i)
-        for (auto j = 0; j < nTofBins; ++j)
-            countsBuffer[i * nTofBins + j] = gsl_histogram_get(detectorHistograms_[spectra_[i]], j);
+    // Write detector counts - rows are stored in spectrum_index order, so can be written directly, but first check that
+    // they fit the stored type if it is narrower than our own
     auto &&[counts, detectorCountsDimension] = NeXuSFile::find1DDataset(output, "raw_data_1/detector_1", "counts");
-    counts.write(countsBuffer, H5::PredType::STD_I32LE);
-
-    delete[](countsBuffer);
+    auto countsType = counts.getIntType();
+    std::vector<int> denseBuffer;
+    auto *data = detectorCounts_.denseData(denseBuffer);
+    if (countsType.getSize() < sizeof(int))
+    {
+        auto maxCount = (1LL << (8 * countsType.getSize() - (countsType.getSign() == H5T_SGN_NONE ? 0 : 1))) - 1;
+        if (std::any_of(data, data + detectorCounts_.size(), [maxCount](int c) { return c < 0 || c > maxCount; }))
+            throw(std::runtime_error(
+                fmt::format("Detector counts exceed the range of the output data type (maximum {}).\n", maxCount)));
+    }
+    counts.write(data, H5::PredType::NATIVE_INT);
+    output.flush(H5F_SCOPE_LOCAL);
+    countsStorageSize_ = counts.getStorageSize();
+    profile.add(Profiler::Counter::BytesWritten, countsStorageSize_);
 
     output.close();
 
     return true;
 }
 
+// Set whether event data may be mapped directly from files rather than read into memory
+void NeXuSFile::setEventMapping(bool enabled) { eventMapping_ = enabled; }
+
+// Return whether event data may be mapped directly from files rather than read into memory
+bool NeXuSFile::eventMapping() { return eventMapping_; }
+
 /*
  * Data
  */
@@ -280,19 +390,238 @@ int NeXuSFile::nDetectorFrames() const { return nDetectorFrames_; }
 void NeXuSFile::incrementDetectorFrameCount(int delta) { nDetectorFrames_ += delta; }
 int NeXuSFile::startSinceEpoch() const { return startSinceEpoch_; }
 int NeXuSFile::endSinceEpoch() const { return endSinceEpoch_; }
-const std::vector<int> &NeXuSFile::eventIndices() const { return eventIndices_; }
-const std::vector<double> &NeXuSFile::eventTimes() const { return eventTimes_; }
+NeXuSFile::EventIdType NeXuSFile::eventIdType() const { return eventIdType_; }
+NeXuSFile::EventTimeType NeXuSFile::eventTimeType() const { return eventTimeType_; }
+std::size_t NeXuSFile::eventSize() const { return idTypeSize(eventIdType_) + timeTypeSize(eventTimeType_); }
+bool NeXuSFile::isEventDataMapped() const { return mappedFile_ != nullptr; }
 const std::vector<int> &NeXuSFile::eventsPerFrame() const { return eventsPerFrame_; }
+const std::vector<hsize_t> &NeXuSFile::frameFirstEvents() const { return frameFirstEvents_; }
+hsize_t NeXuSFile::nEvents() const { return frameFirstEvents_.empty() ? 0 : frameFirstEvents_.back(); }
 const std::vector<double> &NeXuSFile::frameOffsets() const { return frameOffsets_; }
 const std::vector<double> &NeXuSFile::tofBins() const { return tofBins_; }
+const TOFBinning &NeXuSFile::tofBinning() const { return tofBinning_; }
+const std::vector<int> &NeXuSFile::spectrumRows() const { return spectrumRows_; }
 const std::map<int, std::vector<int>> &NeXuSFile::monitorCounts() const { return monitorCounts_; }
-std::map<unsigned int, gsl_histogram *> &NeXuSFile::detectorHistograms() { return detectorHistograms_; }
+CountsMatrix &NeXuSFile::detectorCounts() { return detectorCounts_; }
+const CountsMatrix &NeXuSFile::detectorCounts() const { return detectorCounts_; }
 const std::map<unsigned int, std::vector<double>> &NeXuSFile::partitions() const { return partitions_; }
+hsize_t NeXuSFile::countsStorageSize() const { return countsStorageSize_; }
+
+/*
+ * Event Chunks
+ */
+
+// Partition frames into chunks containing no more than the specified number of events (unless a single frame exceeds it)
+std::vector<NeXuSFile::EventChunk> NeXuSFile::eventChunks(hsize_t maxEvents) const
+{
+    return eventChunks(maxEvents, {{0, int(eventsPerFrame_.size())}});
+}
+
+// Partition frames into chunks, loading events only for the selected frame ranges (which must be sorted and disjoint)
+std::vector<NeXuSFile::EventChunk> NeXuSFile::eventChunks(hsize_t maxEvents, const std::vector<FrameRange> &selection) const
+{
+    std::vector<EventChunk> chunks;
+
+    const int nFrames = eventsPerFrame_.size();
+    if (nFrames == 0)
+        return chunks;
+
+    // Split the selected ranges into chunks, each loading as many frames as possible within the event limit
+    EventChunk chunk;
+    for (const auto &range : selection)
+    {
+        auto firstFrame = std::max(range.firstFrame, 0);
+        const auto rangeLastFrame = std::min(range.lastFrame, nFrames);
+        while (firstFrame < rangeLastFrame)
+        {
+            // Find the first frame whose end would take us over the event limit - always take at least one frame per chunk
+            auto nLoaded = chunk.nLoadedEvents();
+            auto limit = frameFirstEvents_[firstFrame] + (maxEvents > nLoaded ? maxEvents - nLoaded : 0);
+            int lastFrame = std::upper_bound(frameFirstEvents_.begin() + firstFrame + 1,
+                                             frameFirstEvents_.begin() + rangeLastFrame + 1, limit) -
+                            frameFirstEvents_.begin() - 1;
+            if (lastFrame <= firstFrame)
+            {
+                if (nLoaded > 0)
+                {
+                    chunks.push_back(chunk);
+                    chunk = EventChunk();
+                    continue;
+                }
+                lastFrame = firstFrame + 1;
+            }
+
+            chunk.loadedFrames.push_back({firstFrame, lastFrame});
+            chunk.loadedOffsets.push_back(nLoaded + frameFirstEvents_[lastFrame] - frameFirstEvents_[firstFrame]);
+            firstFrame = lastFrame;
+
+            // If we stopped short of the end of the range the chunk is full
+            if (firstFrame < rangeLastFrame)
+            {
+                chunks.push_back(chunk);
+                chunk = EventChunk();
+            }
+        }
+    }
+    if (!chunk.loadedFrames.empty() || chunks.empty())
+        chunks.push_back(chunk);
+
+    // Make the chunks cover all frames, with any unselected frames belonging to the chunk that follows them
+    for (auto i = 0; i < chunks.size(); ++i)
+    {
+        chunks[i].firstFrame = i == 0 ? 0 : chunks[i - 1].lastFrame;
+        chunks[i].lastFrame = i == chunks.size() - 1 ? nFrames : chunks[i].loadedFrames.back().lastFrame;
+        chunks[i].firstEvent = frameFirstEvents_[chunks[i].firstFrame];
+        chunks[i].lastEvent = frameFirstEvents_[chunks[i].lastFrame];
+    }
+
+    return chunks;
+}
+
+// Read event data for the specified chunk into the supplied buffers, leaving our own event data untouched
+void NeXuSFile::readEventChunk(const EventChunk &chunk, EventBuffer &eventIndices, EventBuffer &eventTimes) const
+{
+    Profiler::Scope profile(Profiler::Phase::Load, filename_);
+
+    // Mapped event data need not be read, but we can ask for its pages to be brought in ahead of use
+    if (mappedFile_)
+    {
+        eventIndices.clear();
+        eventTimes.clear();
+        for (const auto &range : chunk.loadedFrames)
+        {
+            auto first = frameFirstEvents_[range.firstFrame], count = frameFirstEvents_[range.lastFrame] - first;
+            auto idSize = idTypeSize(eventIdType_), timeSize = timeTypeSize(eventTimeType_);
+            mappedFile_->adviseWillNeed(mappedEventIndices_ - mappedFile_->data() + first * idSize, count * idSize);
+            mappedFile_->adviseWillNeed(mappedEventTimes_ - mappedFile_->data() + first * timeSize, count * timeSize);
+        }
+        return;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(hdf5Mutex());
+
+    // Open our Nexus file in read only mode.
+    H5::H5File input = H5::H5File(filename_, H5F_ACC_RDONLY);
+
+    // Assemble the event ranges to read
+    std::vector<std::pair<hsize_t, hsize_t>> eventRanges;
+    for (const auto &range : chunk.loadedFrames)
+        eventRanges.emplace_back(frameFirstEvents_[range.firstFrame],
+                                 frameFirstEvents_[range.lastFrame] - frameFirstEvents_[range.firstFrame]);
+
+    // Read in event indices.
+    auto &&[eventIndicesID, eventIndicesDimension] =
+        NeXuSFile::find1DDataset(input, "raw_data_1/detector_1_events", "event_id");
+    eventIndices.resize(chunk.nLoadedEvents() * idTypeSize(eventIdType_));
+    read1DRanges(eventIndicesID, idMemType(eventIdType_), eventRanges, eventIndices.data());
+
+    // Read in events.
+    auto &&[eventTimesID, eventTimesDimension] =
+        NeXuSFile::find1DDataset(input, "raw_data_1/detector_1_events", "event_time_offset");
+    eventTimes.resize(chunk.nLoadedEvents() * timeTypeSize(eventTimeType_));
+    read1DRanges(eventTimesID, timeMemType(eventTimeType_), eventRanges, eventTimes.data());
+    profile.add(Profiler::Counter::BytesRead, eventIndices.size() + eventTimes.size());
+
+    input.close();
+}
+
+// Load event data for the specified chunk, replacing any existing event data
+void NeXuSFile::loadEventChunk(const EventChunk &chunk)
+{
+    readEventChunk(chunk, eventIndices_, eventTimes_);
+    eventChunk_ = chunk;
+}
+
+// Take ownership of previously-read event data for the specified chunk, replacing any existing event data
+void NeXuSFile::adoptEventChunk(const EventChunk &chunk, EventBuffer &eventIndices, EventBuffer &eventTimes)
+{
+    // Mapped event data are never read into buffers
+    auto nExpected = mappedFile_ ? 0 : chunk.nLoadedEvents();
+    if (eventIndices.size() != nExpected * idTypeSize(eventIdType_) ||
+        eventTimes.size() != nExpected * timeTypeSize(eventTimeType_))
+        throw(std::runtime_error("Event data provided do not match the size of the chunk.\n"));
+
+    // Swap rather than move so the caller gets our old buffers back to reuse
+    eventIndices_.swap(eventIndices);
+    eventTimes_.swap(eventTimes);
+    eventChunk_ = chunk;
+}
+
+// Return the currently-loaded event chunk
+const NeXuSFile::EventChunk &NeXuSFile::eventChunk() const { return eventChunk_; }
+
+// Return the range of indices in the loaded event data for the specified frames, which must all be loaded
+std::pair<hsize_t, hsize_t> NeXuSFile::chunkEvents(int firstFrame, int lastFrame) const
+{
+    // Find the loaded range containing the first frame
+    const auto &loadedFrames = eventChunk_.loadedFrames;
+    auto index = std::partition_point(loadedFrames.begin(), loadedFrames.end(),
+                                      [firstFrame](const auto &range) { return range.lastFrame <= firstFrame; }) -
+                 loadedFrames.begin();
+    if (index == loadedFrames.size() || firstFrame < loadedFrames[index].firstFrame ||
+        lastFrame > loadedFrames[index].lastFrame)
+        throw(std::runtime_error("Requested frames do not have their events loaded.\n"));
+
+    // Mapped event data cover the whole file, so are indexed directly
+    if (mappedFile_)
+        return {frameFirstEvents_[firstFrame], frameFirstEvents_[lastFrame]};
+
+    const auto &range = loadedFrames[index];
+    auto start = eventChunk_.loadedOffsets[index] + frameFirstEvents_[firstFrame] - frameFirstEvents_[range.firstFrame];
+    return {start, start + frameFirstEvents_[lastFrame] - frameFirstEvents_[firstFrame]};
+}
+
+/*
+ * Frame Search
+ */
+
+// Return index of the first frame in the specified range whose zero (seconds since epoch) is not before the given time
+int NeXuSFile::findFrame(double time, int firstFrame, int lastFrame) const
+{
+    return std::partition_point(frameOffsets_.begin() + firstFrame, frameOffsets_.begin() + lastFrame,
+                                [&](const auto offset) { return offset + startSinceEpoch_ < time; }) -
+           frameOffsets_.begin();
+}
+
+// Return index of the first frame in the specified range whose zero (seconds since epoch) is after the given time
+int NeXuSFile::findFrameAfter(double time, int firstFrame, int lastFrame) const
+{
+    return std::partition_point(frameOffsets_.begin() + firstFrame, frameOffsets_.begin() + lastFrame,
+                                [&](const auto offset) { return offset + startSinceEpoch_ <= time; }) -
+           frameOffsets_.begin();
+}
 
 /*
  * Manipulation
  */
 
+// Bin the specified range of events into the supplied counts matrix, using our spectrum and TOF bin layout
+template <class IdType, class TimeType>
+void NeXuSFile::binEvents(EventSpan<IdType> eventIndices, EventSpan<TimeType> eventTimes, hsize_t eventStart,
+                          hsize_t eventEnd, CountsMatrix &destination) const
+{
+    EventBinning::binEvents(eventIndices.data() + eventStart, eventTimes.data() + eventStart, eventEnd - eventStart,
+                            spectrumRows_, tofBinning_, destination);
+}
+
+// Bin the specified range of events into our detector counts
+template <class IdType, class TimeType>
+void NeXuSFile::binEvents(EventSpan<IdType> eventIndices, EventSpan<TimeType> eventTimes, hsize_t eventStart,
+                          hsize_t eventEnd)
+{
+    binEvents(eventIndices, eventTimes, eventStart, eventEnd, detectorCounts_);
+}
+
+// Instantiate binning for the supported event id and time types
+#define NP_INSTANTIATE_BIN_EVENTS(IdType, TimeType)                                                                           \
+    template void NeXuSFile::binEvents(EventSpan<IdType>, EventSpan<TimeType>, hsize_t, hsize_t, CountsMatrix &) const;     \
+    template void NeXuSFile::binEvents(EventSpan<IdType>, EventSpan<TimeType>, hsize_t, hsize_t);
+NP_INSTANTIATE_BIN_EVENTS(int, double)
+NP_INSTANTIATE_BIN_EVENTS(int, float)
+NP_INSTANTIATE_BIN_EVENTS(unsigned int, double)
+NP_INSTANTIATE_BIN_EVENTS(unsigned int, float)
+#undef NP_INSTANTIATE_BIN_EVENTS
+
 // Scale monitors by specified factor
 void NeXuSFile::scaleMonitors(double factor)
 {
@@ -311,13 +640,9 @@ void NeXuSFile::scaleMonitors(double factor)
 // Scale detectors by specified factor
 void NeXuSFile::scaleDetectors(double factor)
 {
-    auto oldSum = 0, newSum = 0;
-    for (auto i : spectra_)
-    {
-        oldSum += gsl_histogram_sum(detectorHistograms_[i]);
-        gsl_histogram_scale(detectorHistograms_[i], factor);
-        newSum += gsl_histogram_sum(detectorHistograms_[i]);
-    }
+    auto oldSum = detectorCounts_.sum();
+    detectorCounts_.scale(factor);
+    auto newSum = detectorCounts_.sum();
     fmt::print(" ... Old counts was {}, now scaled to {} (ratio = {}).\n", oldSum, newSum, double(oldSum) / double(newSum));
 
     nDetectorFrames_ *= factor;
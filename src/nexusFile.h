@@ -1,16 +1,33 @@
 #pragma once
 
+#include "countsMatrix.h"
+#include "eventSpan.h"
+#include "tofBinning.h"
 #include <H5Cpp.h>
-#include <gsl/gsl_histogram.h>
+#include <ctime>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+// Forward Declarations
+class MappedFile;
+class NeXuSTemplate;
+
 class NeXuSFile
 {
+    // The template reads from reference files with our dataset helpers
+    friend class NeXuSTemplate;
+
     public:
     NeXuSFile(std::string filename = "", bool loadEvents = false);
     ~NeXuSFile() = default;
+    NeXuSFile(const NeXuSFile &) = default;
+    NeXuSFile &operator=(const NeXuSFile &) = default;
+    NeXuSFile(NeXuSFile &&) = default;
+    NeXuSFile &operator=(NeXuSFile &&) = default;
 
     /*
      * I/O
@@ -19,23 +36,108 @@ class NeXuSFile
     // Filename
     std::string filename_;
 
+    public:
+    // Return mutex which must be held while calling HDF5, since the library is not necessarily built thread-safe
+    static std::recursive_mutex &hdf5Mutex();
+    // Return seconds since epoch for the supplied ISO 8601 time string, which is taken to be in local standard time
+    static std::time_t parseTime(const std::string &time);
+    // Return the supplied time (seconds since epoch) as an ISO 8601 string in local standard time, as read by parseTime()
+    static std::string formatTime(std::time_t time);
+
     private:
     // Return handle and (simple) dimension for named leaf dataset
     static std::pair<H5::DataSet, long int> find1DDataset(H5::H5File file, H5std_string terminal, H5std_string datasetName);
+    // Read the specified (start, count) ranges of the supplied 1D dataset consecutively into the destination buffer
+    static void read1DRanges(const H5::DataSet &dataset, hid_t memType, const std::vector<std::pair<hsize_t, hsize_t>> &ranges,
+                             void *destination);
+
+    public:
+    // Write a scalar attribute to the supplied group
+    template <class T> static void writeAttribute(H5::Group &group, const std::string &name, const H5::PredType &type, T value)
+    {
+        group.createAttribute(name, type, H5::DataSpace(H5S_SCALAR)).write(type, &value);
+    }
+    // Read a scalar attribute from the supplied group
+    template <class T> static T readAttribute(const H5::Group &group, const std::string &name, const H5::PredType &type)
+    {
+        T value{};
+        group.openAttribute(name).read(type, &value);
+        return value;
+    }
+
+    private:
+    // Determine in-memory event types from the stored types of the event datasets in the supplied (open) file
+    void detectEventTypes(const H5::H5File &input);
+    // Map event data directly from the supplied (open) file if its datasets allow it
+    void mapEventData(const H5::H5File &input);
 
     public:
     // Return filename
     std::string filename() const;
     // Template basic paths from the referenceFile, and make ready for histogram binning
     void templateFile(std::string referenceFile, std::string outputFile);
+    // Create a new output file from the supplied template (unless told not to), and make ready for histogram binning (leaving
+    // detector counts unallocated if requested)
+    void templateFile(const NeXuSTemplate &nxsTemplate, std::string outputFile, bool createFile = true,
+                      bool allocateCounts = true);
     // Load frame counts
     void loadFrameCounts();
+    // Load frame data (events per frame and frame offsets)
+    void loadFrameData();
     // Load event data
     void loadEventData();
     // Load start/end times
     void loadTimes();
     // Save key modified data back to the file
     bool saveModifiedData();
+    // Save key modified data to the specified file, which must have been templated in the same way as our own
+    bool saveModifiedData(const std::string &filename);
+    // Set whether event data may be mapped directly from files rather than read into memory
+    static void setEventMapping(bool enabled);
+    // Return whether event data may be mapped directly from files rather than read into memory
+    static bool eventMapping();
+
+    public:
+    // In-memory types of event ids and times, which match those stored in the file where possible
+    enum class EventIdType
+    {
+        Int32,
+        UInt32
+    };
+    enum class EventTimeType
+    {
+        Float64,
+        Float32
+    };
+    // Untyped buffer of event ids or times
+    using EventBuffer = std::vector<char, AlignedAllocator<char>>;
+    // Contiguous range of frames (first, one past last)
+    struct FrameRange
+    {
+        int firstFrame{0}, lastFrame{0};
+    };
+    // Frame-aligned chunk of event data
+    struct EventChunk
+    {
+        // Frame range covered by the chunk (first, one past last)
+        int firstFrame{0}, lastFrame{0};
+        // Event range covered by the chunk (first, one past last)
+        hsize_t firstEvent{0}, lastEvent{0};
+        // Ranges of frames within the chunk whose events are loaded
+        std::vector<FrameRange> loadedFrames;
+        // Index of the first event of each loaded frame range in the chunk data, plus the total number of loaded events
+        std::vector<hsize_t> loadedOffsets{0};
+
+        // Return number of loaded events
+        [[nodiscard]] hsize_t nLoadedEvents() const { return loadedOffsets.back(); }
+    };
+
+    private:
+    // Return size in bytes and HDF5 memory type of event ids and times of the specified types
+    static std::size_t idTypeSize(EventIdType type);
+    static std::size_t timeTypeSize(EventTimeType type);
+    static hid_t idMemType(EventIdType type);
+    static hid_t timeMemType(EventTimeType type);
 
     /*
      * Data
@@ -47,14 +149,26 @@ class NeXuSFile
     int nGoodFrames_{0};
     int startSinceEpoch_{0};
     int endSinceEpoch_{0};
-    std::vector<int> eventIndices_;
-    std::vector<double> eventTimes_;
+    EventChunk eventChunk_;
+    EventIdType eventIdType_{EventIdType::Int32};
+    EventTimeType eventTimeType_{EventTimeType::Float64};
+    EventBuffer eventIndices_;
+    EventBuffer eventTimes_;
+    // Mapping of the file, and the complete event data within it, if the event datasets can be read from it directly
+    std::shared_ptr<const MappedFile> mappedFile_;
+    const char *mappedEventIndices_{nullptr};
+    const char *mappedEventTimes_{nullptr};
     std::vector<int> eventsPerFrame_;
+    std::vector<hsize_t> frameFirstEvents_;
     std::vector<double> frameOffsets_;
     std::vector<double> tofBins_;
+    TOFBinning tofBinning_;
+    std::vector<int> spectrumRows_;
     std::map<int, std::vector<int>> monitorCounts_;
-    std::map<unsigned int, gsl_histogram *> detectorHistograms_;
+    CountsMatrix detectorCounts_;
     std::map<unsigned int, std::vector<double>> partitions_;
+    // Bytes occupied in the file by detector counts when last saved
+    hsize_t countsStorageSize_{0};
 
     public:
     [[nodiscard]] int nGoodFrames() const;
@@ -63,19 +177,96 @@ class NeXuSFile
     void incrementDetectorFrameCount(int delta = 1);
     [[nodiscard]] int startSinceEpoch() const;
     [[nodiscard]] int endSinceEpoch() const;
-    [[nodiscard]] const std::vector<int> &eventIndices() const;
-    [[nodiscard]] const std::vector<double> &eventTimes() const;
+    [[nodiscard]] EventIdType eventIdType() const;
+    [[nodiscard]] EventTimeType eventTimeType() const;
+    // Return size in bytes of a single event (id and time) in memory
+    [[nodiscard]] std::size_t eventSize() const;
+    // Return loaded event ids, which must be of the specified type
+    template <class IdType> [[nodiscard]] EventSpan<IdType> eventIndices() const
+    {
+        if (sizeof(IdType) != idTypeSize(eventIdType_))
+            throw(std::runtime_error("Event ids requested as the wrong type.\n"));
+        return mappedEventIndices_ ? EventSpan<IdType>(reinterpret_cast<const IdType *>(mappedEventIndices_), nEvents())
+                                   : EventSpan<IdType>(reinterpret_cast<const IdType *>(eventIndices_.data()),
+                                                       eventIndices_.size() / sizeof(IdType));
+    }
+    // Return loaded event times, which must be of the specified type
+    template <class TimeType> [[nodiscard]] EventSpan<TimeType> eventTimes() const
+    {
+        if (sizeof(TimeType) != timeTypeSize(eventTimeType_))
+            throw(std::runtime_error("Event times requested as the wrong type.\n"));
+        return mappedEventTimes_ ? EventSpan<TimeType>(reinterpret_cast<const TimeType *>(mappedEventTimes_), nEvents())
+                                 : EventSpan<TimeType>(reinterpret_cast<const TimeType *>(eventTimes_.data()),
+                                                       eventTimes_.size() / sizeof(TimeType));
+    }
+    // Call the supplied function with the loaded event ids and times, as spans of their in-memory types
+    template <class Function> void visitEvents(Function &&function) const
+    {
+        auto withTimes = [&](auto eventIndices)
+        {
+            if (eventTimeType_ == EventTimeType::Float32)
+                function(eventIndices, eventTimes<float>());
+            else
+                function(eventIndices, eventTimes<double>());
+        };
+        if (eventIdType_ == EventIdType::UInt32)
+            withTimes(eventIndices<unsigned int>());
+        else
+            withTimes(eventIndices<int>());
+    }
+    [[nodiscard]] bool isEventDataMapped() const;
     [[nodiscard]] const std::vector<int> &eventsPerFrame() const;
+    [[nodiscard]] const std::vector<hsize_t> &frameFirstEvents() const;
+    [[nodiscard]] hsize_t nEvents() const;
     [[nodiscard]] const std::vector<double> &frameOffsets() const;
     [[nodiscard]] const std::vector<double> &tofBins() const;
+    [[nodiscard]] const TOFBinning &tofBinning() const;
+    [[nodiscard]] const std::vector<int> &spectrumRows() const;
     [[nodiscard]] const std::map<int, std::vector<int>> &monitorCounts() const;
-    std::map<unsigned int, gsl_histogram *> &detectorHistograms();
+    CountsMatrix &detectorCounts();
+    [[nodiscard]] const CountsMatrix &detectorCounts() const;
     [[nodiscard]] const std::map<unsigned int, std::vector<double>> &partitions() const;
+    [[nodiscard]] hsize_t countsStorageSize() const;
+
+    /*
+     * Event Chunks
+     */
+    public:
+    // Partition frames into chunks containing no more than the specified number of events (unless a single frame exceeds it)
+    [[nodiscard]] std::vector<EventChunk> eventChunks(hsize_t maxEvents) const;
+    // Partition frames into chunks, loading events only for the selected frame ranges (which must be sorted and disjoint)
+    [[nodiscard]] std::vector<EventChunk> eventChunks(hsize_t maxEvents, const std::vector<FrameRange> &selection) const;
+    // Read event data for the specified chunk into the supplied buffers, leaving our own event data untouched
+    void readEventChunk(const EventChunk &chunk, EventBuffer &eventIndices, EventBuffer &eventTimes) const;
+    // Load event data for the specified chunk, replacing any existing event data
+    void loadEventChunk(const EventChunk &chunk);
+    // Take ownership of previously-read event data for the specified chunk, replacing any existing event data
+    void adoptEventChunk(const EventChunk &chunk, EventBuffer &eventIndices, EventBuffer &eventTimes);
+    // Return the currently-loaded event chunk
+    [[nodiscard]] const EventChunk &eventChunk() const;
+    // Return the range of indices in the loaded event data for the specified frames, which must all be loaded
+    [[nodiscard]] std::pair<hsize_t, hsize_t> chunkEvents(int firstFrame, int lastFrame) const;
+
+    /*
+     * Frame Search
+     */
+    public:
+    // Return index of the first frame in the specified range whose zero (seconds since epoch) is not before the given time
+    [[nodiscard]] int findFrame(double time, int firstFrame, int lastFrame) const;
+    // Return index of the first frame in the specified range whose zero (seconds since epoch) is after the given time
+    [[nodiscard]] int findFrameAfter(double time, int firstFrame, int lastFrame) const;
 
     /*
      * Manipulation
      */
     public:
+    // Bin the specified range of events into the supplied counts matrix, using our spectrum and TOF bin layout
+    template <class IdType, class TimeType>
+    void binEvents(EventSpan<IdType> eventIndices, EventSpan<TimeType> eventTimes, hsize_t eventStart, hsize_t eventEnd,
+                   CountsMatrix &destination) const;
+    // Bin the specified range of events into our detector counts
+    template <class IdType, class TimeType>
+    void binEvents(EventSpan<IdType> eventIndices, EventSpan<TimeType> eventTimes, hsize_t eventStart, hsize_t eventEnd);
     // Scale monitors by specified factor
     void scaleMonitors(double factor);
     // Scale detectors by specified factor
@@ -0,0 +1,371 @@
+#include "nexusTemplate.h"
+#include "nexusFile.h"
+#include "profiler.h"
+#include <algorithm>
+#include <fmt/core.h>
+#include <fstream>
+#include <mutex>
+
+// Basic paths required when copying / creating a NeXuS file
+std::vector<std::string> neXuSBasicPaths_ = {"/raw_data_1/title",
+                                             "/raw_data_1/user_1/name",
+                                             "/raw_data_1/start_time",
+                                             "/raw_data_1/good_frames",
+                                             "/raw_data_1/raw_frames",
+                                             "/raw_data_1/monitor_1/data",
+                                             "/raw_data_1/monitor_1/time_of_flight",
+                                             "/raw_data_1/monitor_2/data",
+                                             "/raw_data_1/monitor_3/data",
+                                             "/raw_data_1/monitor_4/data",
+                                             "/raw_data_1/monitor_5/data",
+                                             "/raw_data_1/monitor_6/data",
+                                             "/raw_data_1/monitor_7/data",
+                                             "/raw_data_1/monitor_8/data",
+                                             "/raw_data_1/monitor_9/data",
+                                             "/raw_data_1/detector_1/counts"};
+
+NeXuSTemplate::NeXuSTemplate(std::string referenceFile) : referenceFile_(std::move(referenceFile))
+{
+    fmt::print("Reading output file template from '{}'...\n", referenceFile_);
+
+    Profiler::Scope profile(Profiler::Phase::Template, referenceFile_);
+
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+    // Open input Nexus file in read only mode.
+    H5::H5File input = H5::H5File(referenceFile_, H5F_ACC_RDONLY);
+
+    // Create a new in-memory Nexus file to hold the copied paths
+    H5::FileAccPropList imageAccess;
+    imageAccess.setCore(1 << 20, false);
+    H5::H5File image = H5::H5File(referenceFile_ + ".template", H5F_ACC_TRUNC, H5::FileCreatPropList::DEFAULT, imageAccess);
+
+    hid_t ocpl_id, lcpl_id;
+    ocpl_id = H5Pcreate(H5P_OBJECT_COPY);
+    if (ocpl_id < 0)
+        throw(std::runtime_error("File templating failed.\n"));
+    lcpl_id = H5Pcreate(H5P_LINK_CREATE);
+    if (lcpl_id < 0)
+        throw(std::runtime_error("File templating failed.\n"));
+    if (H5Pset_create_intermediate_group(lcpl_id, 1) < 0)
+        throw(std::runtime_error("File templating failed.\n"));
+
+    // Detector counts are created afresh rather than copied if we are to store them differently
+    const std::string countsPath = "/raw_data_1/detector_1/counts";
+    for (const auto &path : neXuSBasicPaths_)
+    {
+        if (path == countsPath && !countsStorage().isDefault())
+            continue;
+        if (H5Ocopy(input.getId(), path.c_str(), image.getId(), path.c_str(), ocpl_id, lcpl_id) < 0)
+            throw(std::runtime_error("Failed to copy one or more paths.\n"));
+    }
+
+    H5Pclose(ocpl_id);
+    H5Pclose(lcpl_id);
+
+    if (!countsStorage().isDefault())
+        createCounts(image, input.openDataSet(countsPath));
+
+    // Retrieve the file image
+    image.flush(H5F_SCOPE_GLOBAL);
+    auto imageSize = H5Fget_file_image(image.getId(), nullptr, 0);
+    if (imageSize < 0)
+        throw(std::runtime_error("File templating failed.\n"));
+    fileImage_.resize(imageSize);
+    if (H5Fget_file_image(image.getId(), fileImage_.data(), fileImage_.size()) != imageSize)
+        throw(std::runtime_error("File templating failed.\n"));
+    image.close();
+
+    // Read in detector spectra information
+    auto &&[spectraID, spectraDimension] = NeXuSFile::find1DDataset(input, "raw_data_1/detector_1", "spectrum_index");
+    spectra_.resize(spectraDimension);
+    H5Dread(spectraID.getId(), H5T_STD_I32LE, H5S_ALL, H5S_ALL, H5P_DEFAULT, spectra_.data());
+
+    // Read in TOF bin information.
+    auto &&[tofBinsID, tofBinsDimension] = NeXuSFile::find1DDataset(input, "raw_data_1/monitor_1", "time_of_flight");
+    tofBins_.resize(tofBinsDimension);
+    H5Dread(tofBinsID.getId(), H5T_IEEE_F64LE, H5S_ALL, H5S_ALL, H5P_DEFAULT, tofBins_.data());
+    tofBinning_ = TOFBinning(tofBins_);
+
+    // Set up the spectrum-to-row remap table (-1 indicates an unknown spectrum)
+    spectrumRows_.assign(spectra_.empty() ? 0 : *std::max_element(spectra_.begin(), spectra_.end()) + 1, -1);
+    for (auto row = 0; row < spectra_.size(); ++row)
+        if (spectra_[row] >= 0)
+            spectrumRows_[spectra_[row]] = row;
+
+    // Read in monitor data - start from index 1 and end when we fail to find the named dataset with this suffix
+    auto i = 1;
+    while (true)
+    {
+        auto &&[monitorSpectrum, monitorSpectrumDimension] =
+            NeXuSFile::find1DDataset(input, "/raw_data_1/monitor_" + std::to_string(i), "data");
+        if (monitorSpectrum.getId() <= 0)
+            break;
+
+        monitorCounts_[i].resize(tofBinsDimension);
+        H5Dread(monitorSpectrum.getId(), H5T_STD_I32LE, H5S_ALL, H5S_ALL, H5P_DEFAULT, monitorCounts_[i].data());
+
+        ++i;
+    }
+
+    // Read in good frames - this will reflect our current monitor frame count since we copied those histograms in full
+    auto &&[goodFramesID, goodFramesDimension] = NeXuSFile::find1DDataset(input, "raw_data_1", "good_frames");
+    std::vector<int> goodFrames(goodFramesDimension);
+    H5Dread(goodFramesID.getId(), H5T_STD_I32LE, H5S_ALL, H5S_ALL, H5P_DEFAULT, goodFrames.data());
+    nMonitorFrames_ = goodFrames[0];
+
+    input.close();
+}
+
+/*
+ * Data
+ */
+
+const std::string &NeXuSTemplate::referenceFile() const { return referenceFile_; }
+const std::vector<int> &NeXuSTemplate::spectra() const { return spectra_; }
+const std::vector<int> &NeXuSTemplate::spectrumRows() const { return spectrumRows_; }
+const std::vector<double> &NeXuSTemplate::tofBins() const { return tofBins_; }
+const TOFBinning &NeXuSTemplate::tofBinning() const { return tofBinning_; }
+const std::map<int, std::vector<int>> &NeXuSTemplate::monitorCounts() const { return monitorCounts_; }
+int NeXuSTemplate::nMonitorFrames() const { return nMonitorFrames_; }
+
+/*
+ * Counts Storage
+ */
+
+namespace
+{
+// Storage options for detector counts
+CountsStorage countsStorage_;
+// HDF5 filter identifiers for third-party compression plugins
+constexpr H5Z_filter_t lz4FilterId = 32004;
+constexpr H5Z_filter_t zstdFilterId = 32015;
+} // namespace
+
+// Return whether the options leave the counts exactly as in the reference file
+bool CountsStorage::isDefault() const { return type == Type::Int32 && chunkSpectra == 0 && !isChunked(); }
+
+// Return whether the options require chunked storage
+bool CountsStorage::isChunked() const
+{
+    return chunkSpectra > 0 || shuffle || deflateLevel > 0 || scaleOffset || plugin != Plugin::None;
+}
+
+// Return a short description of the storage
+std::string CountsStorage::description() const
+{
+    if (isDefault())
+        return "int32 (reference layout)";
+
+    std::string result = type == Type::Int32 ? "int32" : (type == Type::UInt16 ? "uint16" : "uint8");
+    if (!isChunked())
+        return result + ", contiguous";
+
+    result += chunkSpectra > 0 ? fmt::format(", chunked ({} spectra per chunk)", chunkSpectra) : ", chunked";
+    std::vector<std::string> filters;
+    if (scaleOffset)
+        filters.emplace_back("scale-offset");
+    if (shuffle)
+        filters.emplace_back("shuffle");
+    if (deflateLevel > 0)
+        filters.emplace_back(fmt::format("deflate({})", deflateLevel));
+    if (plugin != Plugin::None)
+        filters.emplace_back(plugin == Plugin::LZ4 ? "lz4" : "zstd");
+    for (auto i = 0; i < filters.size(); ++i)
+        result += (i == 0 ? ", " : " + ") + filters[i];
+
+    return result;
+}
+
+// Return HDF5 file type for stored counts
+hid_t CountsStorage::fileType() const
+{
+    if (type == Type::UInt16)
+        return H5T_STD_U16LE;
+    else if (type == Type::UInt8)
+        return H5T_STD_U8LE;
+    return H5T_STD_I32LE;
+}
+
+// Return largest count which can be stored
+long long CountsStorage::maxCount() const { return (1LL << (8 * H5Tget_size(fileType()) - (type == Type::Int32 ? 1 : 0))) - 1; }
+
+// Create dataset creation properties for counts of the specified dimensions (spectra and TOF bins last), chunking them if
+// our options require it or if requested - the caller must close the returned property list
+hid_t CountsStorage::creationProperties(const std::vector<hsize_t> &dims, bool chunked) const
+{
+    const int rank = dims.size();
+    auto properties = H5Pcreate(H5P_DATASET_CREATE);
+    const int fillValue = 0;
+    H5Pset_fill_value(properties, H5T_NATIVE_INT, &fillValue);
+    if ((chunked || isChunked()) && rank > 0)
+    {
+        // Chunks span whole rows of TOF bins, and a number of spectra - by default enough to make roughly 1 MiB
+        std::vector<hsize_t> chunkDims(rank, 1);
+        chunkDims[rank - 1] = std::max(dims[rank - 1], hsize_t(1));
+        if (rank > 1)
+        {
+            auto rowBytes = chunkDims[rank - 1] * H5Tget_size(fileType());
+            hsize_t nSpectra = chunkSpectra > 0 ? chunkSpectra : std::max(hsize_t(1), hsize_t(1 << 20) / rowBytes);
+            chunkDims[rank - 2] = std::clamp(nSpectra, hsize_t(1), std::max(dims[rank - 2], hsize_t(1)));
+        }
+        H5Pset_chunk(properties, rank, chunkDims.data());
+
+        if (scaleOffset)
+            H5Pset_scaleoffset(properties, H5Z_SO_INT, H5Z_SO_INT_MINBITS_DEFAULT);
+        if (shuffle)
+            H5Pset_shuffle(properties);
+        if (deflateLevel > 0)
+            H5Pset_deflate(properties, deflateLevel);
+        if (plugin != Plugin::None)
+        {
+            auto filterId = plugin == Plugin::LZ4 ? lz4FilterId : zstdFilterId;
+            if (H5Zfilter_avail(filterId) <= 0)
+            {
+                H5Pclose(properties);
+                throw(std::runtime_error("Requested compression filter is not available - is the HDF5 plugin installed?\n"));
+            }
+            H5Pset_filter(properties, filterId, H5Z_FLAG_MANDATORY, 0, nullptr);
+        }
+    }
+
+    return properties;
+}
+
+// Create the detector counts dataset in the supplied file, using the layout of the reference dataset and our storage
+// options, and copying its attributes
+void NeXuSTemplate::createCounts(H5::H5File &file, const H5::DataSet &reference)
+{
+    const auto &storage = countsStorage();
+
+    auto space = reference.getSpace();
+    std::vector<hsize_t> dims(space.getSimpleExtentNdims());
+    space.getSimpleExtentDims(dims.data());
+
+    auto properties = storage.creationProperties(dims);
+    auto fileType = storage.fileType();
+
+    auto linkProperties = H5Pcreate(H5P_LINK_CREATE);
+    H5Pset_create_intermediate_group(linkProperties, 1);
+    auto counts = H5Dcreate2(file.getId(), "/raw_data_1/detector_1/counts", fileType, space.getId(), linkProperties,
+                             properties, H5P_DEFAULT);
+    H5Pclose(linkProperties);
+    H5Pclose(properties);
+    if (counts < 0)
+        throw(std::runtime_error("Failed to create detector counts dataset.\n"));
+
+    // Copy attributes from the reference dataset, reading and writing them in their own (file) type
+    for (auto i = 0; i < reference.getNumAttrs(); ++i)
+    {
+        auto attribute = reference.openAttribute(i);
+        auto type = H5Aget_type(attribute.getId());
+        auto attributeSpace = H5Aget_space(attribute.getId());
+        std::vector<char> buffer(std::max(H5Sget_simple_extent_npoints(attributeSpace), hssize_t(1)) * H5Tget_size(type));
+        H5Aread(attribute.getId(), type, buffer.data());
+
+        auto newAttribute =
+            H5Acreate2(counts, attribute.getName().c_str(), type, attributeSpace, H5P_DEFAULT, H5P_DEFAULT);
+        H5Awrite(newAttribute, type, buffer.data());
+        H5Aclose(newAttribute);
+
+        if (H5Tdetect_class(type, H5T_VLEN) > 0 || (H5Tget_class(type) == H5T_STRING && H5Tis_variable_str(type) > 0))
+            H5Dvlen_reclaim(type, attributeSpace, H5P_DEFAULT, buffer.data());
+        H5Sclose(attributeSpace);
+        H5Tclose(type);
+    }
+
+    H5Dclose(counts);
+}
+
+// Set storage options for detector counts in templates read from now on
+void NeXuSTemplate::setCountsStorage(const CountsStorage &storage) { countsStorage_ = storage; }
+
+// Return storage options for detector counts
+const CountsStorage &NeXuSTemplate::countsStorage() { return countsStorage_; }
+
+/*
+ * Output
+ */
+
+// Open our file image as a read-only, in-memory file
+H5::H5File NeXuSTemplate::openImage() const
+{
+    H5::FileAccPropList imageAccess;
+    imageAccess.setCore(1 << 20, false);
+    if (H5Pset_file_image(imageAccess.getId(), const_cast<char *>(fileImage_.data()), fileImage_.size()) < 0)
+        throw(std::runtime_error("File templating failed.\n"));
+    return {referenceFile_ + ".template", H5F_ACC_RDONLY, H5::FileCreatPropList::DEFAULT, imageAccess};
+}
+
+// Create a new NeXuS file from the template
+void NeXuSTemplate::createFile(const std::string &filename) const
+{
+    Profiler::Scope profile(Profiler::Phase::Template, filename);
+    std::ofstream output(filename, std::ios::binary | std::ios::trunc);
+    output.write(fileImage_.data(), fileImage_.size());
+    if (!output)
+        throw(std::runtime_error(fmt::format("Failed to create templated file '{}'.\n", filename)));
+    profile.add(Profiler::Counter::BytesWritten, fileImage_.size());
+}
+
+// Create a new HDF5 file containing the template's metadata and monitors, but no detector counts, and return it
+H5::H5File NeXuSTemplate::createMetadataFile(const std::string &filename) const
+{
+    Profiler::Scope profile(Profiler::Phase::Template, filename);
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+    // Open our file image as an in-memory file, and copy everything but detector counts from it
+    auto image = openImage();
+    H5::H5File output(filename, H5F_ACC_TRUNC);
+
+    auto linkProperties = H5Pcreate(H5P_LINK_CREATE);
+    H5Pset_create_intermediate_group(linkProperties, 1);
+    for (const auto &path : neXuSBasicPaths_)
+    {
+        if (path == "/raw_data_1/detector_1/counts")
+            continue;
+        if (H5Ocopy(image.getId(), path.c_str(), output.getId(), path.c_str(), H5P_DEFAULT, linkProperties) < 0)
+        {
+            H5Pclose(linkProperties);
+            throw(std::runtime_error("Failed to copy one or more paths.\n"));
+        }
+    }
+    H5Pclose(linkProperties);
+
+    return output;
+}
+
+// Add the detector spectra and TOF bins to the supplied metadata file, along with an empty detector counts dataset of the
+// reference layout, so that the file may itself be used as a template
+void NeXuSTemplate::createDetectorLayout(H5::H5File &file) const
+{
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+
+    // Counts are created exactly as for a templated file, but never written, so take no space in the file
+    createCounts(file, openImage().openDataSet("/raw_data_1/detector_1/counts"));
+
+    auto detector = file.openGroup("/raw_data_1/detector_1");
+    hsize_t nSpectra = spectra_.size(), nEdges = tofBins_.size();
+    detector.createDataSet("spectrum_index", H5::PredType::STD_I32LE, H5::DataSpace(1, &nSpectra))
+        .write(spectra_.data(), H5::PredType::NATIVE_INT);
+    detector.createDataSet("time_of_flight", H5::PredType::IEEE_F64LE, H5::DataSpace(1, &nEdges))
+        .write(tofBins_.data(), H5::PredType::NATIVE_DOUBLE);
+}
+
+/*
+ * Cache
+ */
+
+// Return the template for the specified reference file, reading it if it has not been already
+std::shared_ptr<const NeXuSTemplate> NeXuSTemplate::get(const std::string &referenceFile)
+{
+    static std::mutex cacheMutex;
+    static std::map<std::string, std::shared_ptr<const NeXuSTemplate>> cache;
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = cache.find(referenceFile);
+    if (it == cache.end())
+        it = cache.emplace(referenceFile, std::make_shared<const NeXuSTemplate>(referenceFile)).first;
+
+    return it->second;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "tofBinning.h"
+#include <H5Cpp.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Storage options for detector counts in output files
+struct CountsStorage
+{
+    // Integer type to store counts as
+    enum class Type
+    {
+        Int32,
+        UInt16,
+        UInt8
+    };
+    Type type{Type::Int32};
+    // Number of spectra per chunk (zero to choose automatically if chunking is required)
+    int chunkSpectra{0};
+    // Whether to apply the byte shuffle filter
+    bool shuffle{false};
+    // Deflate (gzip) compression level (zero for none)
+    int deflateLevel{0};
+    // Whether to apply the integer scale-offset filter
+    bool scaleOffset{false};
+    // Optional third-party compression filter (must be available as an HDF5 plugin)
+    enum class Plugin
+    {
+        None,
+        LZ4,
+        Zstd
+    };
+    Plugin plugin{Plugin::None};
+
+    // Return whether the options leave the counts exactly as in the reference file
+    [[nodiscard]] bool isDefault() const;
+    // Return whether the options require chunked storage
+    [[nodiscard]] bool isChunked() const;
+    // Return a short description of the storage
+    [[nodiscard]] std::string description() const;
+    // Return HDF5 file type for stored counts
+    [[nodiscard]] hid_t fileType() const;
+    // Return largest count which can be stored
+    [[nodiscard]] long long maxCount() const;
+    // Create dataset creation properties for counts of the specified dimensions (spectra and TOF bins last), chunking them if
+    // our options require it or if requested - the caller must close the returned property list
+    [[nodiscard]] hid_t creationProperties(const std::vector<hsize_t> &dims, bool chunked = false) const;
+};
+
+// Immutable template for output NeXuS files, read once from a reference file
+class NeXuSTemplate
+{
+    public:
+    NeXuSTemplate(std::string referenceFile);
+    ~NeXuSTemplate() = default;
+
+    /*
+     * Data
+     */
+    private:
+    // Reference file from which the template was read
+    std::string referenceFile_;
+    // Image of a NeXuS file containing the basic paths copied from the reference file
+    std::vector<char> fileImage_;
+    // Detector spectra, and their spectrum-to-row remap table (-1 indicates an unknown spectrum)
+    std::vector<int> spectra_;
+    std::vector<int> spectrumRows_;
+    // TOF bin edges and binning
+    std::vector<double> tofBins_;
+    TOFBinning tofBinning_;
+    // Monitor counts
+    std::map<int, std::vector<int>> monitorCounts_;
+    // Number of good frames contributing to monitor counts
+    int nMonitorFrames_{0};
+
+    public:
+    // Return reference file from which the template was read
+    [[nodiscard]] const std::string &referenceFile() const;
+    // Return detector spectra
+    [[nodiscard]] const std::vector<int> &spectra() const;
+    // Return spectrum-to-row remap table
+    [[nodiscard]] const std::vector<int> &spectrumRows() const;
+    // Return TOF bin edges
+    [[nodiscard]] const std::vector<double> &tofBins() const;
+    // Return TOF binning
+    [[nodiscard]] const TOFBinning &tofBinning() const;
+    // Return monitor counts
+    [[nodiscard]] const std::map<int, std::vector<int>> &monitorCounts() const;
+    // Return number of good frames contributing to monitor counts
+    [[nodiscard]] int nMonitorFrames() const;
+
+    /*
+     * Counts Storage
+     */
+    private:
+    // Create the detector counts dataset in the supplied file, using the layout of the reference dataset and our storage
+    // options, and copying its attributes
+    static void createCounts(H5::H5File &file, const H5::DataSet &reference);
+
+    public:
+    // Set storage options for detector counts in templates read from now on
+    static void setCountsStorage(const CountsStorage &storage);
+    // Return storage options for detector counts
+    static const CountsStorage &countsStorage();
+
+    /*
+     * Output
+     */
+    private:
+    // Open our file image as a read-only, in-memory file
+    [[nodiscard]] H5::H5File openImage() const;
+
+    public:
+    // Create a new NeXuS file from the template
+    void createFile(const std::string &filename) const;
+    // Create a new HDF5 file containing the template's metadata and monitors, but no detector counts, and return it
+    [[nodiscard]] H5::H5File createMetadataFile(const std::string &filename) const;
+    // Add the detector spectra and TOF bins to the supplied metadata file, along with an empty detector counts dataset of the
+    // reference layout, so that the file may itself be used as a template
+    void createDetectorLayout(H5::H5File &file) const;
+
+    /*
+     * Cache
+     */
+    public:
+    // Return the template for the specified reference file, reading it if it has not been already
+    static std::shared_ptr<const NeXuSTemplate> get(const std::string &referenceFile);
+};
@@ -1,23 +1,72 @@
+#include "eventBinning.h"
+#include "multiSliceFile.h"
 #include "nexusFile.h"
+#include "nexusTemplate.h"
 #include "processors.h"
+#include "profiler.h"
 #include "window.h"
 #include <fmt/core.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
 #include <iomanip>
 #include <sstream>
+#include <thread>
 
 // Externals
 Processors::ProcessingDirection Processors::processingDirection_ = Processors::ProcessingDirection::Forwards;
 Processors::PostProcessingMode Processors::postProcessingMode_ = Processors::PostProcessingMode::None;
+unsigned long long Processors::eventChunkSize_ = 10000000;
+int Processors::nThreads_ = 1;
+int Processors::nFileThreads_ = 1;
+int Processors::readAheadDepth_ = 2;
+unsigned long long Processors::readAheadMemory_ = 1024;
+int Processors::writeQueueDepth_ = 2;
+std::string Processors::outputFile_;
+bool Processors::useCheckpoint_ = false;
+bool Processors::writePartial_ = false;
+unsigned long long Processors::memoryLimit_ = 0;
 
 namespace Processors
 {
+// Return windows for the slices of the specified window, named after it
+std::vector<Window> sliceWindows(const Window &window, int nSlices)
+{
+    // Each boundary is calculated directly from the window start, and the last slice ends exactly where the window does, so
+    // adjacent slices share their boundaries exactly and together cover the whole window
+    std::vector<Window> windows;
+    const auto sliceDuration = window.duration() / nSlices;
+    auto boundary = [&](int i)
+    { return i == nSlices ? window.endTime() : window.startTime() + i * window.duration() / nSlices; };
+    windows.reserve(nSlices);
+    for (auto i = 0; i < nSlices; ++i)
+    {
+        std::stringstream sliceName;
+        sliceName << window.id() << i + 1;
+        windows.emplace_back(sliceName.str(), boundary(i), sliceDuration, boundary(i + 1));
+    }
+
+    return windows;
+}
+
+// Return output filename for the specified slice (counting from zero) of the window
+std::string sliceFilename(const Window &window, int nSlices, int slice, std::string_view outputFilePath)
+{
+    std::stringstream outputFileName;
+    outputFileName << outputFilePath << window.id() << "-" << std::to_string(int(window.startTime()));
+    if (nSlices > 1)
+        outputFileName << "-" << std::setw(3) << std::setfill('0') << (slice + 1);
+    outputFileName << ".nxs";
+
+    return outputFileName.str();
+}
+
 // Prepare slices for specified Window
 std::vector<std::pair<Window, NeXuSFile>> prepareSlices(const Window &window, int nSlices, std::string templatingSourceFilename,
                                                         std::string_view outputFilePath)
 {
     std::vector<std::pair<Window, NeXuSFile>> slices;
-    const auto sliceDuration = window.duration() / nSlices;
-    auto sliceStartTime = window.startTime();
 
     // Output slice details on first prep
     static bool firstRun = true;
@@ -25,25 +74,31 @@ std::vector<std::pair<Window, NeXuSFile>> prepareSlices(const Window &window, in
     {
         fmt::print("Input window duration was {} seconds.\n", window.duration());
         fmt::print("Number of slices into which window will be partitioned is {}.\n", nSlices);
-        fmt::print("Individual slice duration is {} seconds.\n", sliceDuration);
+        fmt::print("Individual slice duration is {} seconds.\n", window.duration() / nSlices);
     }
 
+    // Output files are created from a template of the source file, which is read only once however many slices we create
+    auto nxsTemplate = NeXuSTemplate::get(templatingSourceFilename);
+    auto windows = sliceWindows(window, nSlices);
+    slices.reserve(nSlices);
     for (auto i = 0; i < nSlices; ++i)
     {
-        std::stringstream outputFileName;
-        outputFileName << outputFilePath << window.id() << "-" << std::to_string(int(window.startTime()));
-        if (nSlices > 1)
-            outputFileName << "-" << std::setw(3) << std::setfill('0') << (i + 1);
-        outputFileName << ".nxs";
-
-        std::stringstream sliceName;
-        sliceName << window.id() << i + 1;
+        auto &[newWin, nexus] = slices.emplace_back(windows[i], NeXuSFile());
 
-        auto &[newWin, nexus] = slices.emplace_back(Window(sliceName.str(), sliceStartTime, sliceDuration), NeXuSFile());
-
-        nexus.templateFile(templatingSourceFilename, outputFileName.str());
+        // If all slices are written to a single output file, there is no file to create for each slice. When memory is
+        // limited, counts are only allocated once events are binned into the slice
+        nexus.templateFile(*nxsTemplate, outputFile_.empty() ? sliceFilename(window, nSlices, i, outputFilePath) : outputFile_,
+                           outputFile_.empty(), memoryLimit_ == 0);
+    }
 
-        sliceStartTime += sliceDuration;
+    if (firstRun && !slices.empty())
+    {
+        const auto &tofBinning = slices.front().second.tofBinning();
+        fmt::print("Detector TOF binning is {} ({} bins).\n", TOFBinning::binningType(tofBinning.type()), tofBinning.nBins());
+        fmt::print("Events will be binned using the {} kernel.\n",
+                   EventBinning::instructionSet(EventBinning::instructionSet()));
+        fmt::print("Detector counts will be stored as {}.\n", NeXuSTemplate::countsStorage().description());
+        firstRun = false;
     }
 
     return slices;
@@ -55,6 +110,7 @@ void postProcess(std::vector<std::pair<Window, NeXuSFile>> &slices)
     double factor = 0.0;
     for (auto &&[slice, outputNeXuSFile] : slices)
     {
+        Profiler::Scope profile(Profiler::Phase::PostProcess, outputNeXuSFile.filename());
         fmt::print("Output '{}' ({} -> {}) has {} detector frames and {} monitor frames.\n", std::string(slice.id()).c_str(),
                    slice.startTime(), slice.endTime(), outputNeXuSFile.nDetectorFrames(), outputNeXuSFile.nMonitorFrames());
         switch (postProcessingMode_)
@@ -77,16 +133,320 @@ void postProcess(std::vector<std::pair<Window, NeXuSFile>> &slices)
     }
 }
 
-// Write slice data
-void saveSlices(std::vector<std::pair<Window, NeXuSFile>> &slices)
+// Write slice data, replacing existing per-slice files atomically if requested
+void saveSlices(std::vector<std::pair<Window, NeXuSFile>> &slices, MultiSliceFile *output, bool atomic)
 {
+    if (output)
+    {
+        auto saveStart = std::chrono::steady_clock::now();
+        output->append(slices);
+        std::chrono::duration<double> saveTime = std::chrono::steady_clock::now() - saveStart;
+        fmt::print("... wrote {} slice(s) in {:.3f} seconds.\n", slices.size(), saveTime.count());
+        return;
+    }
+
     for (auto &&[slice, outputNeXuSFile] : slices)
     {
         printf("Writing data to output NeXuS file '%s' for slice '%s'...\n", outputNeXuSFile.filename().c_str(),
                std::string(slice.id()).c_str());
 
-        if (!outputNeXuSFile.saveModifiedData())
-            fmt::print("!! Error saving file '{}'.", outputNeXuSFile.filename());
+        // Atomic replacement saves to a copy of the file, which is then renamed over the original
+        auto saveStart = std::chrono::steady_clock::now();
+        const auto filename = outputNeXuSFile.filename(), saveFilename = atomic ? filename + ".tmp" : filename;
+        if (atomic)
+            std::filesystem::copy_file(filename, saveFilename, std::filesystem::copy_options::overwrite_existing);
+        if (!outputNeXuSFile.saveModifiedData(saveFilename))
+            fmt::print("!! Error saving file '{}'.", filename);
+        if (atomic)
+            std::filesystem::rename(saveFilename, filename);
+        std::chrono::duration<double> saveTime = std::chrono::steady_clock::now() - saveStart;
+
+        const auto storedBytes = outputNeXuSFile.countsStorageSize();
+        const auto countsBytes = outputNeXuSFile.detectorCounts().size() * sizeof(int);
+        fmt::print("... wrote {} bytes of detector counts ({:.1f}% of {} in memory) in {:.3f} seconds.\n", storedBytes,
+                   countsBytes == 0 ? 0.0 : 100.0 * storedBytes / countsBytes, countsBytes, saveTime.count());
+    }
+}
+
+// Return the first occurrence of the window (counting from zero, and no earlier than the specified one) which ends at or after
+// the given time, or -1 if there is none
+long findOccurrence(const Window &window, double windowDelta, double time, long firstOccurrence)
+{
+    auto occurrence = std::max(firstOccurrence, window.nShiftsToReach(time, windowDelta));
+    if (occurrence > 0 && windowDelta <= 0.0)
+        return -1;
+
+    return window.occurrence(occurrence, windowDelta).endTime() < time ? -1 : occurrence;
+}
+
+// Return frame ranges of the file which may fall inside occurrences of the window, with the specified delta between them
+std::vector<NeXuSFile::FrameRange> selectWindowFrames(const NeXuSFile &nxs, const Window &window, double windowDelta)
+{
+    std::vector<NeXuSFile::FrameRange> selection;
+    const auto &frameOffsets = nxs.frameOffsets();
+    const int nFrames = frameOffsets.size();
+    auto frameIndex = 0;
+    while (frameIndex < nFrames)
+    {
+        // Find the window occurrence which the frame falls in or precedes, positioned exactly as the processors position it
+        auto frameZero = frameOffsets[frameIndex] + nxs.startSinceEpoch();
+        auto nShifts = findOccurrence(window, windowDelta, frameZero);
+        if (nShifts == -1)
+            break;
+        auto occurrence = window.occurrence(nShifts, windowDelta);
+
+        // Select the frames within it, merging with the previous range if they touch
+        auto firstFrame = nxs.findFrame(occurrence.startTime(), frameIndex, nFrames);
+        auto lastFrame = nxs.findFrameAfter(occurrence.endTime(), firstFrame, nFrames);
+        if (firstFrame < lastFrame)
+        {
+            if (!selection.empty() && selection.back().lastFrame == firstFrame)
+                selection.back().lastFrame = lastFrame;
+            else
+                selection.push_back({firstFrame, lastFrame});
+        }
+
+        frameIndex = std::max(lastFrame, frameIndex + 1);
+    }
+
+    return selection;
+}
+
+// Return frame ranges of the file which may fall inside occurrences of any of the supplied window schedules
+std::vector<NeXuSFile::FrameRange> selectWindowFrames(const NeXuSFile &nxs, const std::vector<WindowSchedule> &schedules)
+{
+    // Gather the selections of all schedules, then merge any which overlap or touch
+    std::vector<NeXuSFile::FrameRange> ranges;
+    for (const auto &schedule : schedules)
+    {
+        auto selection = selectWindowFrames(nxs, schedule.window, schedule.windowDelta);
+        ranges.insert(ranges.end(), selection.begin(), selection.end());
+    }
+    std::sort(ranges.begin(), ranges.end(),
+              [](const auto &a, const auto &b) { return a.firstFrame < b.firstFrame; });
+
+    std::vector<NeXuSFile::FrameRange> selection;
+    for (const auto &range : ranges)
+    {
+        if (!selection.empty() && range.firstFrame <= selection.back().lastFrame)
+            selection.back().lastFrame = std::max(selection.back().lastFrame, range.lastFrame);
+        else
+            selection.push_back(range);
+    }
+
+    return selection;
+}
+
+// Move slices to the specified occurrence of the window they were prepared for
+void placeSlices(std::vector<std::pair<Window, NeXuSFile>> &slices, const Window &window, long occurrence, double windowDelta)
+{
+    auto windows = sliceWindows(window.occurrence(occurrence, windowDelta), slices.size());
+    for (auto i = 0; i < slices.size(); ++i)
+        slices[i].first = windows[i];
+}
+
+// Return index of the slice which the specified time belongs to (the first whose end time is not before it)
+int findSlice(const std::vector<std::pair<Window, NeXuSFile>> &slices, double time)
+{
+    // Slices are contiguous and of equal duration, so we can calculate the index directly...
+    const auto &firstSlice = slices.front().first;
+    const int lastIndex = slices.size() - 1;
+    auto index = 0;
+    if (firstSlice.duration() > 0.0)
+        index = std::clamp(std::floor((time - firstSlice.startTime()) / firstSlice.duration()), 0.0, double(lastIndex));
+
+    // ...but must correct for any rounding, since the time may lie exactly on a boundary
+    while (index > 0 && slices[index - 1].first.endTime() >= time)
+        --index;
+    while (index < lastIndex && slices[index].first.endTime() < time)
+        ++index;
+
+    return index;
+}
+
+// Add the specified range of frames to the list of frame runs, extending the last run if possible
+void addFramesToRuns(std::vector<FrameRun> &runs, int firstFrame, int lastFrame, int sliceIndex)
+{
+    if (!runs.empty() && runs.back().slice == sliceIndex && runs.back().lastFrame == firstFrame)
+        runs.back().lastFrame = lastFrame;
+    else
+        runs.push_back({firstFrame, lastFrame, sliceIndex});
+}
+
+// Walk the specified range of frames through the slices of a window schedule, passing each run of frames falling inside a slice
+// to takeFrames and counting them in that slice, and returning the number of frames taken
+int walkFrames(const NeXuSFile &nxs, int firstFrame, int lastFrame, const WindowSchedule &schedule,
+               std::vector<std::pair<Window, NeXuSFile>> &slices, long &nextOccurrence,
+               const std::function<void(long occurrence)> &moveSlices,
+               const std::function<void(int sliceIndex, int firstFrame, int lastFrame)> &takeFrames)
+{
+    const auto &frameOffsets = nxs.frameOffsets();
+    auto nTakenFrames = 0;
+    auto frameIndex = firstFrame;
+    while (frameIndex < lastFrame)
+    {
+        // Get zero for frame
+        auto frameZero = frameOffsets[frameIndex] + nxs.startSinceEpoch();
+
+        // If the frame is beyond the end of the slices, move them on to the window which the frame falls in or precedes
+        if (slices.empty() || slices.back().first.endTime() < frameZero)
+        {
+            auto occurrence = findOccurrence(schedule.window, schedule.windowDelta, frameZero, nextOccurrence);
+            if (occurrence == -1)
+                break;
+            if (occurrence > 0)
+                printf("Propagated window forwards... new start time is %16.2f\n",
+                       schedule.window.occurrence(occurrence, schedule.windowDelta).startTime());
+            nextOccurrence = occurrence + 1;
+            moveSlices(occurrence);
+        }
+
+        // Find the slice the frame belongs to - if it precedes the slice start, skip to the first frame which doesn't
+        auto sliceIndex = findSlice(slices, frameZero);
+        auto &[slice, sliceNxs] = slices[sliceIndex];
+        if (frameZero < slice.startTime())
+        {
+            frameIndex = nxs.findFrame(slice.startTime(), frameIndex, lastFrame);
+            continue;
+        }
+
+        // Take all frames up to the end of the slice, and increment its frame counter
+        auto sliceLastFrame = nxs.findFrameAfter(slice.endTime(), frameIndex, lastFrame);
+        takeFrames(sliceIndex, frameIndex, sliceLastFrame);
+        sliceNxs.incrementDetectorFrameCount(sliceLastFrame - frameIndex);
+        nTakenFrames += sliceLastFrame - frameIndex;
+        frameIndex = sliceLastFrame;
+    }
+
+    return nTakenFrames;
+}
+
+// Divide the specified frames into contiguous ranges containing roughly equal numbers of events, returning the boundaries
+std::vector<int> partitionFrames(const NeXuSFile &nxs, int firstFrame, int lastFrame, int nParts)
+{
+    const auto &frameFirstEvents = nxs.frameFirstEvents();
+    const auto firstEvent = frameFirstEvents[firstFrame], nEvents = frameFirstEvents[lastFrame] - firstEvent;
+    std::vector<int> boundaries(nParts + 1, lastFrame);
+    boundaries[0] = firstFrame;
+    for (auto part = 1; part < nParts; ++part)
+    {
+        auto targetEvent = firstEvent + nEvents * part / nParts;
+        boundaries[part] = std::lower_bound(frameFirstEvents.begin() + boundaries[part - 1],
+                                            frameFirstEvents.begin() + lastFrame, targetEvent) -
+                           frameFirstEvents.begin();
+    }
+
+    return boundaries;
+}
+
+namespace
+{
+// Bin events of the specified types for the supplied frame runs into their destination slices
+template <class IdType, class TimeType>
+void binFrameRuns(const NeXuSFile &nxs, EventSpan<IdType> eventIndices, EventSpan<TimeType> eventTimes,
+                  const std::vector<FrameRun> &runs, std::vector<std::pair<Window, NeXuSFile>> &slices, SliceReplicas &replicas)
+{
+    // Single-threaded binning goes straight into the destination slices
+    if (nThreads_ == 1)
+    {
+        Profiler::Scope profile(Profiler::Phase::Bin, nxs.filename());
+        for (const auto &run : runs)
+        {
+            auto [eventStart, eventEnd] = nxs.chunkEvents(run.firstFrame, run.lastFrame);
+            slices[run.slice].second.binEvents(eventIndices, eventTimes, eventStart, eventEnd);
+            profile.add(Profiler::Counter::EventsBinned, eventEnd - eventStart);
+        }
+        return;
+    }
+
+    // Divide the frames spanned by the runs into contiguous ranges containing roughly equal numbers of events
+    auto threadFrames = partitionFrames(nxs, runs.front().firstFrame, runs.back().lastFrame, nThreads_);
+
+    // Clip the runs to the frame range of each thread, noting which threads touch each slice
+    std::vector<std::vector<FrameRun>> threadRuns(nThreads_);
+    std::vector<int> sliceThreads(slices.size(), 0), sliceOwner(slices.size(), -1);
+    for (auto thread = 0; thread < nThreads_; ++thread)
+        for (const auto &run : runs)
+        {
+            auto first = std::max(run.firstFrame, threadFrames[thread]);
+            auto last = std::min(run.lastFrame, threadFrames[thread + 1]);
+            if (first >= last)
+                continue;
+            threadRuns[thread].push_back({first, last, run.slice});
+            if (sliceOwner[run.slice] != thread)
+            {
+                sliceOwner[run.slice] = thread;
+                ++sliceThreads[run.slice];
+            }
+        }
+
+    // Slices touched by more than one thread are binned into thread-local replicas - others are binned directly
+    replicas.resize(nThreads_);
+    for (auto thread = 0; thread < nThreads_; ++thread)
+        for (const auto &run : threadRuns[thread])
+            if (sliceThreads[run.slice] > 1 && replicas[thread].find(run.slice) == replicas[thread].end())
+            {
+                const auto &sliceCounts = slices[run.slice].second.detectorCounts();
+                replicas[thread].try_emplace(run.slice, sliceCounts.nRows(), sliceCounts.nBins());
+            }
+
+    std::vector<std::thread> threads;
+    for (auto thread = 0; thread < nThreads_; ++thread)
+        threads.emplace_back(
+            [&, thread]()
+            {
+                Profiler::Scope profile(Profiler::Phase::Bin, nxs.filename());
+                for (const auto &run : threadRuns[thread])
+                {
+                    auto &destination = slices[run.slice].second;
+                    auto [eventStart, eventEnd] = nxs.chunkEvents(run.firstFrame, run.lastFrame);
+                    if (sliceThreads[run.slice] > 1)
+                        destination.binEvents(eventIndices, eventTimes, eventStart, eventEnd, replicas[thread].at(run.slice));
+                    else
+                        destination.binEvents(eventIndices, eventTimes, eventStart, eventEnd);
+                    profile.add(Profiler::Counter::EventsBinned, eventEnd - eventStart);
+                }
+            });
+    for (auto &thread : threads)
+        thread.join();
+}
+} // namespace
+
+// Bin events for the supplied frame runs from the currently-loaded event chunk into their destination slices
+void binFrameRuns(const NeXuSFile &nxs, const std::vector<FrameRun> &runs, std::vector<std::pair<Window, NeXuSFile>> &slices,
+                  SliceReplicas &replicas)
+{
+    if (runs.empty())
+        return;
+
+    // Bin with the event types held by the file
+    nxs.visitEvents([&](auto eventIndices, auto eventTimes)
+                    { binFrameRuns(nxs, eventIndices, eventTimes, runs, slices, replicas); });
+}
+
+// Reduce thread-local replicas into their destination slices, releasing them
+void reduceReplicas(SliceReplicas &replicas, std::vector<std::pair<Window, NeXuSFile>> &slices)
+{
+    Profiler::Scope profile(Profiler::Phase::Bin);
+    for (auto &threadReplicas : replicas)
+    {
+        for (auto &&[sliceIndex, counts] : threadReplicas)
+            slices[sliceIndex].second.detectorCounts().add(counts);
+        threadReplicas.clear();
+    }
+}
+
+// Accumulate detector counts and frame counts from one set of slices into another
+void accumulateSlices(const std::vector<std::pair<Window, NeXuSFile>> &source,
+                      std::vector<std::pair<Window, NeXuSFile>> &destination)
+{
+    if (source.size() != destination.size())
+        throw(std::runtime_error("Can't accumulate slices from a set of differing size.\n"));
+
+    for (auto i = 0; i < source.size(); ++i)
+    {
+        destination[i].second.detectorCounts().add(source[i].second.detectorCounts());
+        destination[i].second.incrementDetectorFrameCount(source[i].second.nDetectorFrames());
     }
 }
 } // namespace Processors
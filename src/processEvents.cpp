@@ -0,0 +1,150 @@
+#include "eventSliceFile.h"
+#include "nexusFile.h"
+#include "processors.h"
+#include "profiler.h"
+#include "window.h"
+#include <fmt/core.h>
+#include <memory>
+#include <set>
+#include <stdexcept>
+
+namespace Processors
+{
+namespace
+{
+// Current window of a single window schedule, along with the event files its slices are written to
+struct EventSlices
+{
+    EventSlices(const WindowSchedule &schedule) : schedule(schedule) {}
+
+    // Schedule the slices are prepared for
+    const WindowSchedule &schedule;
+    // First occurrence of the window which may still be prepared - the files of earlier ones have already been written
+    long nextOccurrence{0};
+    // Slices of the current window (whose files count the frames written to them)
+    std::vector<std::pair<Window, NeXuSFile>> slices;
+    // Event files for the slices, and the names of all files created so far
+    std::vector<std::unique_ptr<EventSliceFile>> outputs;
+    std::set<std::string> filenames;
+};
+
+// Create event files for the slices of the specified window, storing events with the specified types
+void prepareEventSlices(EventSlices &set, const Window &window, const H5::DataType &idType, const H5::DataType &timeType,
+                        const std::string &templatingSourceFilename, std::string_view outputFilePath)
+{
+    const auto nSlices = set.schedule.nSlices;
+    auto windows = sliceWindows(window, nSlices);
+    for (auto i = 0; i < nSlices; ++i)
+    {
+        // Windows starting within the same second share filenames, but a finished file must never be re-created
+        auto filename = sliceFilename(window, nSlices, i, outputFilePath);
+        if (!set.filenames.insert(filename).second)
+            throw(std::runtime_error(fmt::format(
+                "Event file '{}' has already been written for an earlier window starting in the same second.\n", filename)));
+        set.slices.emplace_back(windows[i], NeXuSFile(filename));
+        set.outputs.push_back(
+            std::make_unique<EventSliceFile>(filename, templatingSourceFilename, windows[i], idType, timeType));
+    }
+}
+
+// Close the event files of the current slices
+void finishEventSlices(EventSlices &set)
+{
+    for (auto i = 0; i < set.slices.size(); ++i)
+    {
+        const auto &slice = set.slices[i].first;
+        auto &output = *set.outputs[i];
+        output.close();
+        fmt::print("Output '{}' ({} -> {}) has {} frames and {} events.\n", std::string(slice.id()), slice.startTime(),
+                   slice.endTime(), output.nFrames(), output.nEvents());
+    }
+    set.slices.clear();
+    set.outputs.clear();
+}
+
+// Copy the events of frames in the file to the event files of the slices they fall in, preparing new slices as required, and
+// returning the number of frames copied
+int copyFrames(const NeXuSFile &nxs, const H5::DataSet &eventIds, const H5::DataSet &eventTimes, EventSlices &set,
+               const std::string &templatingSourceFilename, std::string_view outputFilePath)
+{
+    const auto &[windowDefinition, nSlices, windowDelta] = set.schedule;
+    auto moveSlices = [&](long occurrence)
+    {
+        // If we have slices we are done with them
+        if (!set.slices.empty())
+            finishEventSlices(set);
+
+        // Create the new slices, storing events in the types of the current file
+        prepareEventSlices(set, windowDefinition.occurrence(occurrence, windowDelta), eventIds.getDataType(),
+                           eventTimes.getDataType(), templatingSourceFilename, outputFilePath);
+    };
+    return walkFrames(nxs, 0, nxs.frameOffsets().size(), set.schedule, set.slices, set.nextOccurrence, moveSlices,
+                      [&](int sliceIndex, int firstFrame, int lastFrame)
+                      { set.outputs[sliceIndex]->append(nxs, eventIds, eventTimes, firstFrame, lastFrame, eventChunkSize_); });
+}
+} // namespace
+
+// Perform event processing
+void processEvents(const std::vector<std::string> &inputNeXusFiles, std::string_view outputFilePath,
+                   const Window &windowDefinition, int nSlices, double windowDelta)
+{
+    processEvents(inputNeXusFiles, outputFilePath, {{windowDefinition, nSlices, windowDelta}});
+}
+
+// Perform event processing for several window schedules in a single pass over the input files
+void processEvents(const std::vector<std::string> &inputNeXusFiles, std::string_view outputFilePath,
+                   const std::vector<WindowSchedule> &schedules)
+{
+    /*
+     * Windows are propagated forwards through the input files exactly as in individual processing, but rather than binning
+     * the events of each slice we copy them, along with the zero and event count of each of their frames, to a NeXuS event
+     * file per slice. Events are copied in their stored types a contiguous range of frames at a time, so are never decoded.
+     */
+
+    fmt::print("Processing in EVENTS mode...\n");
+
+    if (!outputFile_.empty())
+        throw(std::runtime_error("Events can only be written to a file per slice.\n"));
+    if (postProcessingMode_ != PostProcessingMode::None)
+        throw(std::runtime_error("Post-processing can't be applied to event output.\n"));
+    if (memoryLimit_ > 0)
+        throw(std::runtime_error("Memory limits can only be applied in summed processing mode.\n"));
+
+    std::vector<std::unique_ptr<EventSlices>> sets;
+    for (const auto &schedule : schedules)
+        sets.push_back(std::make_unique<EventSlices>(schedule));
+
+    // Loop over input Nexus files - only frame data is loaded, since events are copied straight from the file
+    for (const auto &inputFile : inputNeXusFiles)
+    {
+        NeXuSFile nxs(inputFile);
+        nxs.loadTimes();
+        nxs.loadFrameData();
+
+        std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+        H5::H5File input(inputFile, H5F_ACC_RDONLY);
+        auto eventIds = input.openDataSet("raw_data_1/detector_1_events/event_id");
+        auto eventTimes = input.openDataSet("raw_data_1/detector_1_events/event_time_offset");
+        if (eventIds.getSpace().getSimpleExtentNpoints() != nxs.nEvents() ||
+            eventTimes.getSpace().getSimpleExtentNpoints() != nxs.nEvents())
+            throw(std::runtime_error(
+                fmt::format("Event data in '{}' doesn't match the number of events in its frame log.\n", inputFile)));
+
+        auto nCopiedFrames = 0;
+        for (auto &set : sets)
+            nCopiedFrames += copyFrames(nxs, eventIds, eventTimes, *set, inputNeXusFiles[0], outputFilePath);
+
+        // Frames are counted once for each schedule they are copied to (or skipped by)
+        Profiler::count(Profiler::Phase::Save, nxs.filename(), Profiler::Counter::FramesProcessed, nCopiedFrames);
+        Profiler::count(Profiler::Phase::Save, nxs.filename(), Profiler::Counter::FramesSkipped,
+                        nxs.eventsPerFrame().size() * sets.size() - nCopiedFrames);
+
+        input.close();
+    }
+
+    // Close the files of any slices we still have
+    for (auto &set : sets)
+        finishEventSlices(*set);
+}
+
+} // namespace Processors
@@ -1,107 +1,151 @@
+#include "eventReader.h"
+#include "multiSliceFile.h"
 #include "nexusFile.h"
 #include "processors.h"
+#include "profiler.h"
+#include "sliceWriter.h"
 #include "window.h"
 #include <fmt/core.h>
+#include <memory>
+#include <optional>
 #include <stdexcept>
 
 namespace Processors
 {
-// Perform summed processing
+namespace
+{
+// Current window and slices of a single window schedule, along with the writer its finished slices are passed to
+struct IndividualSlices
+{
+    IndividualSlices(const WindowSchedule &schedule, MultiSliceFile *output)
+        : schedule(schedule), writer(writeQueueDepth_, output)
+    {
+    }
+
+    // Schedule the slices are prepared for
+    const WindowSchedule &schedule;
+    // First occurrence of the window which may still be prepared - earlier ones have already been written
+    long nextOccurrence{0};
+    // Slices of the current window
+    std::vector<std::pair<Window, NeXuSFile>> slices;
+    // Thread-local copies of slice detector counts
+    SliceReplicas replicas;
+    // Writer for finished slices
+    SliceWriter writer;
+};
+
+// Bin events from the current chunk into the slices, passing finished slices to the writer and preparing new ones as required,
+// and returning the number of frames binned
+int binChunk(const NeXuSFile &nxs, IndividualSlices &set, const std::string &templatingSourceFilename,
+             std::string_view outputFilePath)
+{
+    const auto &chunk = nxs.eventChunk();
+    auto &slices = set.slices;
+    const auto &[windowDefinition, nSlices, windowDelta] = set.schedule;
+
+    // Assemble runs of frames to bin into each slice, jumping straight over any frames which fall outside them
+    std::vector<FrameRun> frameRuns;
+    auto moveSlices = [&](long occurrence)
+    {
+        // If we have slices we are done with them - bin outstanding events, reduce any thread-local counts, and pass the
+        // slices to the writer
+        if (!slices.empty())
+        {
+            binFrameRuns(nxs, frameRuns, slices, set.replicas);
+            frameRuns.clear();
+            reduceReplicas(set.replicas, slices);
+            set.writer.write(std::move(slices));
+            slices.clear();
+        }
+
+        // A window starting within the same second as one still waiting to be written shares its filenames, so its files can
+        // only be templated once the earlier ones have been written
+        auto window = windowDefinition.occurrence(occurrence, windowDelta);
+        if (outputFile_.empty())
+        {
+            std::vector<std::string> filenames;
+            for (auto i = 0; i < nSlices; ++i)
+                filenames.push_back(sliceFilename(window, nSlices, i, outputFilePath));
+            set.writer.waitForFiles(filenames);
+        }
+
+        // Create the new slices
+        slices = prepareSlices(window, nSlices, templatingSourceFilename, outputFilePath);
+    };
+    auto nProcessedFrames =
+        walkFrames(nxs, chunk.firstFrame, chunk.lastFrame, set.schedule, slices, set.nextOccurrence, moveSlices,
+                   [&](int sliceIndex, int firstFrame, int lastFrame)
+                   { addFramesToRuns(frameRuns, firstFrame, lastFrame, sliceIndex); });
+
+    // Bin events for the chunk
+    binFrameRuns(nxs, frameRuns, slices, set.replicas);
+
+    return nProcessedFrames;
+}
+} // namespace
+
+// Perform individual processing
 void processIndividual(const std::vector<std::string> &inputNeXusFiles, std::string_view outputFilePath,
                        const Window &windowDefinition, int nSlices, double windowDelta)
+{
+    processIndividual(inputNeXusFiles, outputFilePath, {{windowDefinition, nSlices, windowDelta}});
+}
+
+// Perform individual processing for several window schedules in a single pass over the input files
+void processIndividual(const std::vector<std::string> &inputNeXusFiles, std::string_view outputFilePath,
+                       const std::vector<WindowSchedule> &schedules)
 {
     /*
-     * From our main windowDefinition we will continually propagate it forwards in time (by the window delta) splitting it into
-     * nSlices and until we go over the end time of the current file.
+     * From each windowDefinition we will continually propagate it forwards in time (by its window delta) splitting it into
+     * nSlices and until we go over the end time of the current file. Each chunk of events is binned into the current slices
+     * of every window schedule while it is loaded, so the input files are read only once.
      */
 
     fmt::print("Processing in INDIVIDUAL mode...\n");
 
-    // Copy the master window definition since we will be modifying it
-    auto window = windowDefinition;
-    std::vector<std::pair<Window, NeXuSFile>> slices;
-    auto sliceIt = slices.end();
-
-    // Loop over input Nexus files
-    for (auto &nxsFileName : inputNeXusFiles)
+    if (schedules.size() > 1 && !outputFile_.empty())
+        throw(std::runtime_error("A single output file can only be written for a single window definition.\n"));
+    if (memoryLimit_ > 0)
+        throw(std::runtime_error("Memory limits can only be applied in summed processing mode.\n"));
+
+    // Finished slices are post-processed and saved by the writer of their schedule, in the background if requested, and
+    // either to a file per slice or appended to a single output file
+    std::optional<MultiSliceFile> output;
+    if (!outputFile_.empty())
+        output.emplace(outputFile_, inputNeXusFiles[0], schedules.front().nSlices);
+    std::vector<std::unique_ptr<IndividualSlices>> sets;
+    for (const auto &schedule : schedules)
+        sets.push_back(std::make_unique<IndividualSlices>(schedule, output ? &*output : nullptr));
+
+    // Loop over input Nexus files, reading ahead into the next file while the current one is binned - only events from frames
+    // which may fall inside one of the windows need to be read
+    auto frameSelector = [&](const NeXuSFile &nxs) { return selectWindowFrames(nxs, schedules); };
+    EventReader reader(inputNeXusFiles, eventChunkSize_, readAheadDepth_, readAheadMemory_ * 1024 * 1024, frameSelector);
+    while (auto nxsPtr = reader.nextFile())
     {
-        // Open the NeXuS file and get its event data
-        NeXuSFile nxs(nxsFileName, true);
-
-        const auto &eventsPerFrame = nxs.eventsPerFrame();
-        const auto &eventIndices = nxs.eventIndices();
-        const auto &eventTimes = nxs.eventTimes();
-        const auto &frameOffsets = nxs.frameOffsets();
-
-        // Loop over frames in the Nexus file
-        auto eventStart = 0, eventEnd = 0;
-        for (auto frameIndex = 0; frameIndex < nxs.eventsPerFrame().size(); ++frameIndex)
-        {
-            // Set new end event index and get zero for frame
-            eventEnd += eventsPerFrame[frameIndex];
-            auto frameZero = frameOffsets[frameIndex] + nxs.startSinceEpoch();
-
-            // If the current slice end time is less than the frame zero, iterate the slices.
-            while (sliceIt != slices.end() && sliceIt->first.endTime() < frameZero)
-            {
-                sliceIt++;
-
-                // If we have run out of slices propagate the set forward.
-                if (sliceIt == slices.end())
-                {
-                    // Save current data
-                    postProcess(slices);
-                    saveSlices(slices);
-
-                    // Empty current slices
-                    slices.clear();
-                    sliceIt = slices.end();
-                }
-            }
-
-            // Do we need to generate new window / slices?
-            if (slices.empty())
-            {
-                // Set new window start time
-                while (window.endTime() < frameZero)
-                {
-                    window.shiftStartTime(windowDelta);
-                    printf("Propagated window forwards... new start time is %16.2f\n", sliceIt->first.startTime());
-                }
-
-                // Create the new slices
-                slices = prepareSlices(window, nSlices, inputNeXusFiles[0], outputFilePath);
-                sliceIt = slices.begin();
-            }
-
-            // If this frame zero is greater than or equal to the start time of the current window slice we can process events
-            if (frameZero >= sliceIt->first.startTime())
-            {
-                // Sanity check!
-                if (frameZero > sliceIt->first.endTime())
-                    throw(std::runtime_error("Somebody's done something wrong here....\n"));
-
-                // Grab the destination datafile for this slice and bin events
-                auto &destinationHistograms = sliceIt->second.detectorHistograms();
-                for (int k = eventStart; k < eventEnd; ++k)
-                {
-                    auto id = eventIndices[k];
-                    if (id > 0)
-                        gsl_histogram_accumulate(destinationHistograms[id], eventTimes[k], 1.0);
-                }
-
-                // Increment the frame counter for this slice
-                sliceIt->second.incrementDetectorFrameCount();
-            }
-
-            // Update start event index
-            eventStart = eventEnd;
-        }
+        auto &nxs = *nxsPtr;
+        auto nProcessedFrames = 0;
+
+        // Loop over frame-aligned chunks of events in the Nexus file
+        while (reader.nextChunk())
+            for (auto &set : sets)
+                nProcessedFrames += binChunk(nxs, *set, inputNeXusFiles[0], outputFilePath);
+
+        // Frames are counted once for each schedule they are binned into (or skipped by)
+        Profiler::count(Profiler::Phase::Bin, nxs.filename(), Profiler::Counter::FramesProcessed, nProcessedFrames);
+        Profiler::count(Profiler::Phase::Bin, nxs.filename(), Profiler::Counter::FramesSkipped,
+                        nxs.eventsPerFrame().size() * sets.size() - nProcessedFrames);
     }
 
-    // Perform post-processing on any slices we still have and save
-    postProcess(slices);
-    saveSlices(slices);
+    // Perform post-processing on any slices we still have and save, and wait for the writers to finish
+    for (auto &set : sets)
+    {
+        reduceReplicas(set->replicas, set->slices);
+        set->writer.write(std::move(set->slices));
+        set->writer.finish();
+    }
+    if (output)
+        output->close();
 }
 
 } // namespace Processors
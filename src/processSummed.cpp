@@ -1,91 +1,435 @@
+#include "checkpoint.h"
+#include "directoryWatcher.h"
+#include "eventReader.h"
+#include "multiSliceFile.h"
 #include "nexusFile.h"
 #include "processors.h"
+#include "profiler.h"
+#include "spillStore.h"
 #include "window.h"
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <fmt/core.h>
+#include <memory>
+#include <optional>
 #include <stdexcept>
+#include <thread>
 
 namespace Processors
 {
-// Perform summed processing
-void processSummed(const std::vector<std::string> &inputNeXusFiles, std::string_view outputFilePath,
-                   const Window &windowDefinition, int nSlices, double windowDelta)
+namespace
 {
-    /*
-     * From our main windowDefinition we will continually propagate it forwards in time (by the window delta) splitting it into
-     * nSlices and until we go over the end time of the current file.
-     */
-
-    printf("Processing in SUMMED mode...\n");
-
-    // Generate a new set of window "slices" and associated output NeXuS files to sum data into
-    auto slices = prepareSlices(windowDefinition, nSlices, inputNeXusFiles[0], outputFilePath);
+// Slices of a single window schedule, summed over all input files
+struct SummedSlices
+{
+    // Schedule the slices were prepared for
+    const WindowSchedule *schedule;
+    // Slices, and the first occurrence of the window they may next be moved to
+    std::vector<std::pair<Window, NeXuSFile>> slices;
+    long nextOccurrence{1};
+    // Thread-local copies of slice detector counts
+    SliceReplicas replicas;
+    // Number of chunks routed to the slices, and the chunk each slice was last binned in
+    long nChunks{0};
+    std::vector<long> lastUsed;
+    // Store for counts spilled from memory, if memory is limited
+    std::shared_ptr<SpillStore> spillStore;
+};
 
-    // Initialise the slice iterator and window slice / NeXuSFile references
-    auto sliceIt = slices.begin();
+// Assemble runs of frames from the current chunk to bin into each of the slices, jumping straight over any frames which fall
+// outside them, and returning the number of frames added
+int routeChunk(const NeXuSFile &nxs, SummedSlices &set, std::vector<FrameRun> &frameRuns)
+{
+    const auto &chunk = nxs.eventChunk();
+    const auto &[window, nSlices, windowDelta] = *set.schedule;
+    return walkFrames(
+        nxs, chunk.firstFrame, chunk.lastFrame, *set.schedule, set.slices, set.nextOccurrence,
+        [&](long occurrence) { placeSlices(set.slices, window, occurrence, windowDelta); },
+        [&](int sliceIndex, int firstFrame, int lastFrame) { addFramesToRuns(frameRuns, firstFrame, lastFrame, sliceIndex); });
+}
 
-    // Loop over input Nexus files
-    for (auto &nxsFileName : inputNeXusFiles)
+// Give released counts the storage of a spare matrix of the same size if there is one, rather than allocating it afresh
+void reuseCounts(CountsMatrix &counts, std::vector<CountsMatrix> &spares)
+{
+    if (!spares.empty() && spares.back().nRows() == counts.nRows() && spares.back().nBins() == counts.nBins())
     {
-        // Open the NeXuS file and get its event data
-        NeXuSFile nxs(nxsFileName, true);
-
-        const auto &eventsPerFrame = nxs.eventsPerFrame();
-        const auto &eventIndices = nxs.eventIndices();
-        const auto &eventTimes = nxs.eventTimes();
-        const auto &frameOffsets = nxs.frameOffsets();
+        counts = std::move(spares.back());
+        spares.pop_back();
+        counts.zero();
+    }
+    else
+        counts.initialise(counts.nRows(), counts.nBins());
+}
 
-        // Loop over frames in the Nexus file
-        auto eventStart = 0, eventEnd = 0;
-        for (auto frameIndex = 0; frameIndex < nxs.eventsPerFrame().size(); ++frameIndex)
+// Spill the least recently used slices to disk until those held in memory, plus any released slices about to be binned into,
+// fit within the limit (or only slices used by the current chunk remain), then give the released slices storage - preferably
+// that of the spilled slices, since repeatedly freeing and allocating similar large blocks can fragment the heap
+void limitMemory(std::vector<SummedSlices> &sets, const std::vector<std::vector<FrameRun>> &frameRuns)
+{
+    const auto limit = memoryLimit_ * 1024 * 1024;
+    std::size_t total = 0, required = 0;
+    for (auto i = 0; i < sets.size(); ++i)
+    {
+        auto &set = sets[i];
+        reduceReplicas(set.replicas, set.slices);
+        ++set.nChunks;
+        for (const auto &run : frameRuns[i])
         {
-            // Set new end event index and get zero for frame
-            eventEnd += eventsPerFrame[frameIndex];
-            auto frameZero = frameOffsets[frameIndex] + nxs.startSinceEpoch();
+            const auto &counts = set.slices[run.slice].second.detectorCounts();
+            if (counts.isReleased() && set.lastUsed[run.slice] != set.nChunks && CountsMatrix::sparseOccupancy() == 0.0)
+                required += counts.size() * sizeof(int);
+            set.lastUsed[run.slice] = set.nChunks;
+        }
+        for (const auto &[slice, nxs] : set.slices)
+            total += nxs.detectorCounts().memoryBytes();
+    }
 
-            // If the current slice end time is less than the frame zero, iterate the slices.
-            while (sliceIt->first.endTime() < frameZero)
+    std::vector<CountsMatrix> spares;
+    while (total + required > limit)
+    {
+        SummedSlices *coldestSet = nullptr;
+        auto coldest = -1;
+        for (auto &set : sets)
+            for (auto i = 0; i < set.slices.size(); ++i)
             {
-                sliceIt++;
-
-                // If we have run out of slices propagate the set forward.
-                if (sliceIt == slices.end())
+                if (set.slices[i].second.detectorCounts().isReleased() || set.lastUsed[i] == set.nChunks)
+                    continue;
+                if (!coldestSet || set.lastUsed[i] < coldestSet->lastUsed[coldest])
                 {
-                    sliceIt = slices.begin();
-                    for (auto &&[slice, _unused] : slices)
-                        slice.shiftStartTime(windowDelta);
-                    printf("Propagated window forwards... new start time is %16.2f\n", sliceIt->first.startTime());
+                    coldestSet = &set;
+                    coldest = i;
                 }
             }
+        if (!coldestSet)
+            break;
 
-            // If this frame zero is greater than or equal to the start time of the current window slice we can process events
-            if (frameZero >= sliceIt->first.startTime())
-            {
-                // Sanity check!
-                if (frameZero > sliceIt->first.endTime())
-                    throw(std::runtime_error("Somebody's done something wrong here....\n"));
+        auto &counts = coldestSet->slices[coldest].second.detectorCounts();
+        total -= counts.memoryBytes();
+        coldestSet->spillStore->spill(coldest, counts);
+        spares.push_back(std::move(counts));
+        counts.release();
+    }
+
+    for (auto i = 0; i < sets.size(); ++i)
+        for (const auto &run : frameRuns[i])
+        {
+            auto &counts = sets[i].slices[run.slice].second.detectorCounts();
+            if (counts.isReleased())
+                reuseCounts(counts, spares);
+        }
+}
+
+// Sum events from the current file of the supplied reader into the slices of every schedule
+void sumFile(NeXuSFile &nxs, EventReader &reader, std::vector<SummedSlices> &sets)
+{
+    // Reset the slices to the first occurrence of their window - they are propagated forwards as necessary for the frames in
+    // this file
+    for (auto &set : sets)
+    {
+        placeSlices(set.slices, set.schedule->window, 0, set.schedule->windowDelta);
+        set.nextOccurrence = 1;
+    }
+    auto nProcessedFrames = 0;
 
-                // Grab the destination datafile for this slice and bin events
-                auto &destinationHistograms = sliceIt->second.detectorHistograms();
-                for (int k = eventStart; k < eventEnd; ++k)
+    // Loop over frame-aligned chunks of events in the Nexus file, routing each to every schedule in turn while it is loaded
+    std::vector<std::vector<FrameRun>> frameRuns(sets.size());
+    while (reader.nextChunk())
+    {
+        for (auto i = 0; i < sets.size(); ++i)
+        {
+            frameRuns[i].clear();
+            nProcessedFrames += routeChunk(nxs, sets[i], frameRuns[i]);
+        }
+
+        // If memory is limited, make room for the slices about to be binned into
+        if (memoryLimit_ > 0)
+            limitMemory(sets, frameRuns);
+
+        // Bin events for the chunk
+        for (auto i = 0; i < sets.size(); ++i)
+            binFrameRuns(nxs, frameRuns[i], sets[i].slices, sets[i].replicas);
+    }
+
+    // Reduce any thread-local counts
+    for (auto &set : sets)
+        reduceReplicas(set.replicas, set.slices);
+
+    // Frames are counted once for each schedule they are routed to (or skipped by)
+    Profiler::count(Profiler::Phase::Bin, nxs.filename(), Profiler::Counter::FramesProcessed, nProcessedFrames);
+    Profiler::count(Profiler::Phase::Bin, nxs.filename(), Profiler::Counter::FramesSkipped,
+                    nxs.eventsPerFrame().size() * sets.size() - nProcessedFrames);
+}
+
+// Sum events from the supplied input files into the slices of every schedule, starting each file from the initial windows
+void sumFiles(const std::vector<std::string> &inputFiles, std::vector<SummedSlices> &sets,
+              const std::vector<WindowSchedule> &schedules)
+{
+    // Only events from frames which may fall inside one of the windows need to be read
+    auto frameSelector = [&](const NeXuSFile &nxs) { return selectWindowFrames(nxs, schedules); };
+
+    const auto nWorkers = std::min(nFileThreads_, int(inputFiles.size()));
+    if (nWorkers <= 1)
+    {
+        // Loop over input Nexus files, reading ahead into the next file while the current one is binned
+        EventReader reader(inputFiles, eventChunkSize_, readAheadDepth_, readAheadMemory_ * 1024 * 1024, frameSelector);
+        while (auto nxs = reader.nextFile())
+            sumFile(*nxs, reader, sets);
+        return;
+    }
+
+    fmt::print("Processing {} input files concurrently.\n", nWorkers);
+
+    // Each worker takes the next unprocessed file in turn and sums it into its own private, initially empty, copy of the
+    // slices, sharing the read-ahead memory budget equally with the others
+    std::vector<std::vector<SummedSlices>> workerSets(nWorkers, sets);
+    for (auto &copy : workerSets)
+        for (auto &set : copy)
+            for (auto &&[slice, nxs] : set.slices)
+            {
+                nxs.detectorCounts().zero();
+                nxs.incrementDetectorFrameCount(-nxs.nDetectorFrames());
+            }
+    std::vector<std::exception_ptr> workerErrors(nWorkers);
+    std::atomic<int> nextFile{0};
+    std::atomic<int> lastFileWorker{0};
+    std::vector<std::thread> workers;
+    for (auto worker = 0; worker < nWorkers; ++worker)
+        workers.emplace_back(
+            [&, worker]()
+            {
+                try
+                {
+                    for (auto i = nextFile++; i < inputFiles.size(); i = nextFile++)
+                    {
+                        EventReader reader({inputFiles[i]}, eventChunkSize_, readAheadDepth_,
+                                           readAheadMemory_ * 1024 * 1024 / nWorkers, frameSelector);
+                        sumFile(*reader.nextFile(), reader, workerSets[worker]);
+                        if (i == inputFiles.size() - 1)
+                            lastFileWorker = worker;
+                    }
+                }
+                catch (...)
                 {
-                    auto id = eventIndices[k];
-                    if (id > 0)
-                        gsl_histogram_accumulate(destinationHistograms[id], eventTimes[k], 1.0);
+                    workerErrors[worker] = std::current_exception();
                 }
+            });
+    for (auto &worker : workers)
+        worker.join();
+    for (auto &error : workerErrors)
+        if (error)
+            std::rethrow_exception(error);
 
-                // Increment the frame counter for this slice
-                sliceIt->second.incrementDetectorFrameCount();
-            }
+    // Merge worker slices, in worker order, leaving the windows where the final input file left them
+    for (auto setIndex = 0; setIndex < sets.size(); ++setIndex)
+    {
+        auto &slices = sets[setIndex].slices;
+        for (auto &source : workerSets)
+            accumulateSlices(source[setIndex].slices, slices);
+        for (auto i = 0; i < slices.size(); ++i)
+            slices[i].first = workerSets[lastFileWorker][setIndex].slices[i].first;
+        sets[setIndex].nextOccurrence = workerSets[lastFileWorker][setIndex].nextOccurrence;
+    }
+}
 
-            // Update start event index
-            eventStart = eventEnd;
-        }
+// Post-process and save the slices, replacing any existing outputs atomically if requested
+void saveTotals(std::vector<std::pair<Window, NeXuSFile>> &slices, const std::string &templatingSourceFilename, bool atomic)
+{
+    // Partial outputs are saved unscaled, since post-processing is only applied once they are merged
+    if (writePartial_)
+    {
+        saveSlices(slices, nullptr, atomic);
+        markPartial(slices);
+        return;
     }
 
-    // Perform post-processing
     postProcess(slices);
 
-    // Save slices
-    saveSlices(slices);
+    // Save slices, either to a file per slice or as the single window of a single output file
+    if (outputFile_.empty())
+        saveSlices(slices, nullptr, atomic);
+    else
+    {
+        const auto saveFilename = atomic ? outputFile_ + ".tmp" : outputFile_;
+        MultiSliceFile output(saveFilename, templatingSourceFilename, slices.size());
+        saveSlices(slices, &output);
+        output.close();
+        if (atomic)
+            std::filesystem::rename(saveFilename, outputFile_);
+    }
+}
+
+// Post-process and save the slices one at a time, bringing back any counts spilled from memory into storage passed on from
+// slice to slice
+void saveSpilledTotals(SummedSlices &set, const std::string &templatingSourceFilename)
+{
+    std::vector<CountsMatrix> spares;
+    for (auto i = 0; i < set.slices.size(); ++i)
+    {
+        auto &counts = set.slices[i].second.detectorCounts();
+        if (counts.isReleased())
+            reuseCounts(counts, spares);
+        set.spillStore->restore(i, counts);
+
+        std::vector<std::pair<Window, NeXuSFile>> slice;
+        slice.push_back(std::move(set.slices[i]));
+        saveTotals(slice, templatingSourceFilename, false);
+        set.slices[i] = std::move(slice.front());
+
+        spares.clear();
+        spares.push_back(std::move(set.slices[i].second.detectorCounts()));
+        set.slices[i].second.detectorCounts().release();
+    }
+
+    if (set.spillStore->nSpills() > 0)
+        fmt::print("Slice counts were spilled to '{}' {} time(s) to stay within the memory limit.\n",
+                   set.spillStore->filename(), set.spillStore->nSpills());
+}
+} // namespace
+
+// Perform summed processing, then continue adding new files reported by the watcher (if given) until it times out
+void processSummed(const std::vector<std::string> &inputNeXusFiles, std::string_view outputFilePath,
+                   const Window &windowDefinition, int nSlices, double windowDelta, DirectoryWatcher *watcher)
+{
+    processSummed(inputNeXusFiles, outputFilePath, {{windowDefinition, nSlices, windowDelta}}, watcher);
+}
+
+// Perform summed processing for several window schedules in a single pass over the input files, then continue adding new
+// files reported by the watcher (if given) until it times out
+void processSummed(const std::vector<std::string> &inputNeXusFiles, std::string_view outputFilePath,
+                   const std::vector<WindowSchedule> &schedules, DirectoryWatcher *watcher)
+{
+    /*
+     * From each windowDefinition we will continually propagate it forwards in time (by its window delta) splitting it into
+     * nSlices and until we go over the end time of the current file. The position of the window is determined independently
+     * for each file from its absolute frame times, so files may be processed in any order, and concurrently. Each chunk of
+     * events is routed to every window schedule while it is loaded, so the input files are read only once.
+     */
+
+    printf("Processing in SUMMED mode...\n");
+
+    if (schedules.size() > 1 && !outputFile_.empty())
+        throw(std::runtime_error("A single output file can only be written for a single window definition.\n"));
+    if (schedules.size() > 1 && useCheckpoint_)
+        throw(std::runtime_error("Checkpoints can only be kept for a single window definition.\n"));
+    if (writePartial_ && (!outputFile_.empty() || watcher))
+        throw(std::runtime_error("Partial outputs can only be written as a file per slice, and not while watching.\n"));
+    if (memoryLimit_ > 0 && (!outputFile_.empty() || watcher || useCheckpoint_ || nFileThreads_ > 1))
+        throw(std::runtime_error("Memory limits can't be combined with a single output file, watching, checkpoints, or "
+                                 "concurrent input files.\n"));
+
+    // If we are keeping a checkpoint (stored next to the outputs) only the input files it doesn't already include need to be
+    // binned, and outputs continue to be templated from the original source file - records of the new files (including their
+    // content hashes) are kept to be added to the checkpoint once they are binned
+    const auto &[windowDefinition, nSlices, windowDelta] = schedules.front();
+    std::optional<Checkpoint> checkpoint;
+    std::vector<Checkpoint::InputFile> newInputFiles;
+    auto inputFiles = inputNeXusFiles;
+    auto templatingSourceFilename = inputNeXusFiles[0];
+    if (useCheckpoint_)
+    {
+        checkpoint.emplace(outputFile_.empty()
+                               ? fmt::format("{}{}-{}.checkpoint.h5", outputFilePath, windowDefinition.id(),
+                                             int(windowDefinition.startTime()))
+                               : outputFile_ + ".checkpoint.h5");
+        if (checkpoint->isLoaded())
+        {
+            checkpoint->checkCompatible(windowDefinition, windowDelta, nSlices);
+            templatingSourceFilename = checkpoint->templatingSourceFilename();
+        }
+        newInputFiles = checkpoint->newInputFiles(inputNeXusFiles);
+        inputFiles = Checkpoint::filenames(newInputFiles);
+        if (checkpoint->isLoaded())
+            fmt::print("{} of {} input file(s) are not yet included in the checkpoint.\n", inputFiles.size(),
+                       inputNeXusFiles.size());
+    }
+
+    // Generate a new set of window "slices" and associated output NeXuS files to sum data into for each schedule
+    std::vector<SummedSlices> sets;
+    for (const auto &schedule : schedules)
+    {
+        auto &set = sets.emplace_back();
+        set.schedule = &schedule;
+        set.slices = prepareSlices(schedule.window, schedule.nSlices, templatingSourceFilename, outputFilePath);
+        set.lastUsed.assign(set.slices.size(), 0);
+
+        // If memory is limited, counts of slices not recently binned into are spilled to a scratch file next to the outputs
+        if (memoryLimit_ > 0)
+        {
+            const auto &counts = set.slices.front().second.detectorCounts();
+            set.spillStore = std::make_shared<SpillStore>(
+                fmt::format("{}{}-{}.spill", outputFilePath, schedule.window.id(), int(schedule.window.startTime())),
+                set.slices.size(), counts.nRows(), counts.nBins());
+        }
+    }
+
+    sumFiles(inputFiles, sets, schedules);
+
+    // Add in the checkpointed totals (keeping their window positions if we had nothing new to bin), and save the new totals
+    // before any post-processing scales them
+    auto &slices = sets.front().slices;
+    if (checkpoint)
+    {
+        checkpoint->takeTotals(slices, inputFiles.empty());
+        checkpoint->save(slices, newInputFiles, templatingSourceFilename, windowDefinition, windowDelta);
+    }
+
+    if (!watcher)
+    {
+        for (auto &set : sets)
+        {
+            if (set.spillStore)
+                saveSpilledTotals(set, templatingSourceFilename);
+            else
+                saveTotals(set.slices, templatingSourceFilename, false);
+        }
+        return;
+    }
+
+    // When watching, the unscaled totals stay resident and post-processed copies of them are saved, replacing the outputs
+    // atomically so that readers never see a partial file - our own outputs must never be taken as new input files
+    for (const auto &set : sets)
+        for (const auto &[slice, nxs] : set.slices)
+            watcher->ignore(nxs.filename());
+    auto saveCopy = [&]()
+    {
+        for (auto &set : sets)
+        {
+            if (postProcessingMode_ == PostProcessingMode::None)
+                saveTotals(set.slices, templatingSourceFilename, true);
+            else
+            {
+                auto scaledSlices = set.slices;
+                saveTotals(scaledSlices, templatingSourceFilename, true);
+            }
+        }
+    };
+    saveCopy();
+
+    while (true)
+    {
+        fmt::print("Waiting for new files in '{}'...\n", watcher->directory());
+        auto newFiles = watcher->waitForNewFiles();
+        if (newFiles.empty())
+        {
+            fmt::print("No new files arrived before the idle timeout - stopping.\n");
+            break;
+        }
+        if (checkpoint)
+        {
+            newInputFiles = checkpoint->newInputFiles(newFiles);
+            newFiles = Checkpoint::filenames(newInputFiles);
+        }
+        if (newFiles.empty())
+            continue;
+        for (const auto &file : newFiles)
+            fmt::print("New input file '{}' found.\n", file);
+
+        sumFiles(newFiles, sets, schedules);
+        if (checkpoint)
+            checkpoint->save(slices, newInputFiles, templatingSourceFilename, windowDefinition, windowDelta);
+        saveCopy();
+    }
 }
 
 } // namespace Processors
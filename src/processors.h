@@ -1,11 +1,16 @@
 #pragma once
 
+#include "countsMatrix.h"
+#include "nexusFile.h"
+#include "window.h"
+#include <functional>
+#include <map>
 #include <string>
 #include <vector>
 
 // Forward Declarations
-class NeXuSFile;
-class Window;
+class DirectoryWatcher;
+class MultiSliceFile;
 
 namespace Processors
 {
@@ -14,7 +19,8 @@ enum class ProcessingMode
 {
     None,
     Individual,
-    Summed
+    Summed,
+    Events
 };
 
 // Processing Direction
@@ -34,30 +40,127 @@ enum class PostProcessingMode
 };
 // Selected post-processing mode
 extern Processors::PostProcessingMode postProcessingMode_;
+// Maximum number of events to load from file at once
+extern unsigned long long eventChunkSize_;
+// Number of threads to use when binning events
+extern int nThreads_;
+// Number of input files to process concurrently (summed mode only)
+extern int nFileThreads_;
+// Number of event chunks to read ahead of binning (zero to read synchronously)
+extern int readAheadDepth_;
+// Maximum amount of event data to read ahead of binning, in MiB
+extern unsigned long long readAheadMemory_;
+// Number of finished windows which may wait to be written in the background (individual mode only, zero to disable)
+extern int writeQueueDepth_;
+// Single output file for all slices (if empty, a NeXuS file is written for each slice)
+extern std::string outputFile_;
+// Whether summed processing keeps a checkpoint of its totals, adding only unseen input files to any existing one
+extern bool useCheckpoint_;
+// Whether summed processing writes its unscaled totals as partial outputs, to be combined later by a merge
+extern bool writePartial_;
+// Maximum amount of memory to hold slice detector counts in before spilling them to disk, in MiB (summed mode only, zero for
+// no limit)
+extern unsigned long long memoryLimit_;
+
+// Contiguous range of frames whose events are destined for a single slice
+struct FrameRun
+{
+    // Frame range (first, one past last)
+    int firstFrame{0}, lastFrame{0};
+    // Index of the destination slice
+    int slice{0};
+};
+// Thread-local copies of slice detector counts, indexed by thread and then slice
+using SliceReplicas = std::vector<std::map<int, CountsMatrix>>;
+// Window definition, along with the number of slices to split it into and the time between its occurrences
+struct WindowSchedule
+{
+    Window window;
+    int nSlices{1};
+    double windowDelta{0.0};
+};
 
 /*
  * Common Functions
  */
 
+// Return windows for the slices of the specified window, named after it
+std::vector<Window> sliceWindows(const Window &window, int nSlices);
+// Return output filename for the specified slice (counting from zero) of the window
+std::string sliceFilename(const Window &window, int nSlices, int slice, std::string_view outputFilePath);
 // Prepare slices for specified Window
 std::vector<std::pair<Window, NeXuSFile>> prepareSlices(const Window &window, int nSlices, std::string templatingSourceFilename,
                                                         std::string_view outputFilePath);
 // Perform any post-processing required
 void postProcess(std::vector<std::pair<Window, NeXuSFile>> &slices);
-// Write slice data
-void saveSlices(std::vector<std::pair<Window, NeXuSFile>> &slices);
+// Write slice data, replacing existing per-slice files atomically if requested
+void saveSlices(std::vector<std::pair<Window, NeXuSFile>> &slices, MultiSliceFile *output = nullptr, bool atomic = false);
+// Mark saved slices as partial outputs, recording their unscaled detector and monitor frame counts and windows
+void markPartial(const std::vector<std::pair<Window, NeXuSFile>> &slices);
+// Return the first occurrence of the window (counting from zero, and no earlier than the specified one) which ends at or after
+// the given time, or -1 if there is none
+long findOccurrence(const Window &window, double windowDelta, double time, long firstOccurrence = 0);
+// Return frame ranges of the file which may fall inside occurrences of the window, with the specified delta between them
+std::vector<NeXuSFile::FrameRange> selectWindowFrames(const NeXuSFile &nxs, const Window &window, double windowDelta);
+// Return frame ranges of the file which may fall inside occurrences of any of the supplied window schedules
+std::vector<NeXuSFile::FrameRange> selectWindowFrames(const NeXuSFile &nxs, const std::vector<WindowSchedule> &schedules);
+// Move slices to the specified occurrence of the window they were prepared for
+void placeSlices(std::vector<std::pair<Window, NeXuSFile>> &slices, const Window &window, long occurrence, double windowDelta);
+// Return index of the slice which the specified time belongs to (the first whose end time is not before it)
+int findSlice(const std::vector<std::pair<Window, NeXuSFile>> &slices, double time);
+// Add the specified range of frames to the list of frame runs, extending the last run if possible
+void addFramesToRuns(std::vector<FrameRun> &runs, int firstFrame, int lastFrame, int sliceIndex);
+// Walk the specified range of frames through the slices of a window schedule, passing each run of frames falling inside a slice
+// to takeFrames and counting them in that slice, and returning the number of frames taken. Whenever a frame lies beyond the
+// end of the slices (or there are none) moveSlices is called to put them at the occurrence of the window which the frame falls
+// in or precedes, which is no earlier than nextOccurrence (advanced past it) - the walk stops if there is no such occurrence.
+int walkFrames(const NeXuSFile &nxs, int firstFrame, int lastFrame, const WindowSchedule &schedule,
+               std::vector<std::pair<Window, NeXuSFile>> &slices, long &nextOccurrence,
+               const std::function<void(long occurrence)> &moveSlices,
+               const std::function<void(int sliceIndex, int firstFrame, int lastFrame)> &takeFrames);
+// Divide the specified frames into contiguous ranges containing roughly equal numbers of events, returning the boundaries
+std::vector<int> partitionFrames(const NeXuSFile &nxs, int firstFrame, int lastFrame, int nParts);
+// Bin events for the supplied frame runs from the currently-loaded event chunk into their destination slices
+void binFrameRuns(const NeXuSFile &nxs, const std::vector<FrameRun> &runs, std::vector<std::pair<Window, NeXuSFile>> &slices,
+                  SliceReplicas &replicas);
+// Reduce thread-local replicas into their destination slices, releasing them
+void reduceReplicas(SliceReplicas &replicas, std::vector<std::pair<Window, NeXuSFile>> &slices);
+// Accumulate detector counts and frame counts from one set of slices into another
+void accumulateSlices(const std::vector<std::pair<Window, NeXuSFile>> &source,
+                      std::vector<std::pair<Window, NeXuSFile>> &destination);
 
 /*
  * Processors
  */
 
-// Get Events
-std::map<int, std::vector<double>> getEvents(const std::vector<std::string> &inputNeXusFiles, int detectorId,
-                                             bool firstOnly = false);
+// Return the largest detector spectrum in the specified NeXuS file
+int maxSpectrum(const std::string &filename);
+// Parse a list of spectra and / or inclusive ranges of spectra (e.g. "1,5,10-20"), all of which must lie between 1 and the
+// specified maximum
+std::vector<int> parseSpectra(std::string_view text, int maxSpectrum);
+// Get events for the specified spectra, writing them to the output file (binary, or HDF5 if its extension is .h5 / .hdf5)
+// and / or printing them, and returning the number of events found for each spectrum
+std::map<int, unsigned long long> getEvents(const std::vector<std::string> &inputNeXusFiles, const std::vector<int> &spectra,
+                                            std::string_view outputFile, bool printEvents, bool firstOnly = false);
 // Perform individual processing
 void processIndividual(const std::vector<std::string> &inputNeXusFiles, std::string_view outputFilePath,
                        const Window &windowDefinition, int nSlices, double windowDelta);
-// Perform summed processing
+// Perform individual processing for several window schedules in a single pass over the input files
+void processIndividual(const std::vector<std::string> &inputNeXusFiles, std::string_view outputFilePath,
+                       const std::vector<WindowSchedule> &schedules);
+// Perform summed processing, then continue adding new files reported by the watcher (if given) until it times out
+void processSummed(const std::vector<std::string> &inputNeXusFiles, std::string_view outputFilePath,
+                   const Window &windowDefinition, int nSlices, double windowDelta, DirectoryWatcher *watcher = nullptr);
+// Perform summed processing for several window schedules in a single pass over the input files, then continue adding new
+// files reported by the watcher (if given) until it times out
 void processSummed(const std::vector<std::string> &inputNeXusFiles, std::string_view outputFilePath,
+                   const std::vector<WindowSchedule> &schedules, DirectoryWatcher *watcher = nullptr);
+// Perform event processing, writing the events of each window / slice to NeXuS event files
+void processEvents(const std::vector<std::string> &inputNeXusFiles, std::string_view outputFilePath,
                    const Window &windowDefinition, int nSlices, double windowDelta);
+// Perform event processing for several window schedules in a single pass over the input files
+void processEvents(const std::vector<std::string> &inputNeXusFiles, std::string_view outputFilePath,
+                   const std::vector<WindowSchedule> &schedules);
+// Merge partial outputs of summed processing into final slice files, applying any post-processing
+void mergePartials(const std::vector<std::string> &partialFiles, std::string_view outputFilePath);
 }; // namespace Processors
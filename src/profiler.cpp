@@ -0,0 +1,256 @@
+#include "profiler.h"
+#include <atomic>
+#include <cstdio>
+#include <fmt/core.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Externals
+bool Profiler::enabled_ = false;
+
+namespace Profiler
+{
+namespace
+{
+// Single recorded piece of work
+struct TraceEvent
+{
+    Phase phase;
+    std::string file;
+    int thread;
+    // Start time and duration (microseconds since profiling was enabled)
+    double start, duration;
+    Counters counters;
+};
+// Work summed over a phase, file and thread
+struct PhaseSummary
+{
+    unsigned long long calls{0};
+    double seconds{0.0};
+    Counters counters{};
+    // Largest resident set size seen at the end of any of the work (bytes)
+    unsigned long long peakRSS{0};
+};
+
+// Output filename prefix
+std::string outputPrefix_;
+// Time at which profiling was enabled
+std::chrono::steady_clock::time_point startTime_;
+// Mutex protecting recorded data
+std::mutex mutex_;
+// Recorded work, in order of completion
+std::vector<TraceEvent> events_;
+// Summaries, keyed by phase, file and thread
+std::map<std::tuple<Phase, std::string, int>, PhaseSummary> summaries_;
+// Next thread index to assign
+std::atomic<int> nextThread_{0};
+
+// Return index of the calling thread, assigned in order of first use
+int threadIndex()
+{
+    thread_local int index = nextThread_++;
+    return index;
+}
+
+// Return current resident set size of the process (bytes), or zero if unavailable
+unsigned long long currentRSS()
+{
+#ifndef _WIN32
+    unsigned long long size = 0, resident = 0;
+    auto *statm = std::fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+    if (std::fscanf(statm, "%llu %llu", &size, &resident) != 2)
+        resident = 0;
+    std::fclose(statm);
+    return resident * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+// Return peak resident set size of the process (bytes), or zero if unavailable
+unsigned long long peakRSS()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+        if (line.rfind("VmHWM:", 0) == 0)
+            return std::stoull(line.substr(6)) * 1024;
+    return 0;
+}
+
+// Return string escaped for inclusion in JSON
+std::string escape(std::string_view text)
+{
+    std::string result;
+    for (auto c : text)
+    {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        result += c;
+    }
+    return result;
+}
+
+// Return counters formatted as JSON members
+std::string counterMembers(const Counters &counters)
+{
+    std::string result;
+    for (auto i = 0; i < counters.size(); ++i)
+        result += fmt::format("{}\"{}\": {}", i == 0 ? "" : ", ", counterName(Counter(i)), counters[i]);
+    return result;
+}
+
+// Open the specified file for writing
+std::ofstream openOutput(const std::string &filename)
+{
+    std::ofstream output(filename, std::ios::trunc);
+    if (!output)
+        throw(std::runtime_error(fmt::format("Failed to open profile output '{}' for writing.\n", filename)));
+    return output;
+}
+} // namespace
+
+// Return text name for the specified phase
+std::string phaseName(Phase phase)
+{
+    switch (phase)
+    {
+        case (Phase::Load):
+            return "load";
+        case (Phase::Template):
+            return "template";
+        case (Phase::Bin):
+            return "bin";
+        case (Phase::PostProcess):
+            return "post-process";
+        case (Phase::Save):
+            return "save";
+        default:
+            throw(std::runtime_error("Unhandled profiling phase.\n"));
+    }
+}
+
+// Return text name for the specified counter
+std::string counterName(Counter counter)
+{
+    switch (counter)
+    {
+        case (Counter::BytesRead):
+            return "bytes_read";
+        case (Counter::BytesWritten):
+            return "bytes_written";
+        case (Counter::EventsBinned):
+            return "events_binned";
+        case (Counter::FramesProcessed):
+            return "frames_processed";
+        case (Counter::FramesSkipped):
+            return "frames_skipped";
+        default:
+            throw(std::runtime_error("Unhandled profiling counter.\n"));
+    }
+}
+
+// Enable profiling, writing the summary to '<prefix>.json' and the Chrome trace to '<prefix>.trace.json'
+void enable(std::string outputPrefix)
+{
+    outputPrefix_ = std::move(outputPrefix);
+    startTime_ = std::chrono::steady_clock::now();
+    enabled_ = true;
+}
+
+// Record completed work for the specified phase and file on the calling thread
+void record(Phase phase, std::string_view file, std::chrono::steady_clock::time_point start,
+            std::chrono::steady_clock::time_point end, const Counters &counters)
+{
+    auto thread = threadIndex();
+    auto rss = currentRSS();
+    std::chrono::duration<double, std::micro> startOffset = start - startTime_, duration = end - start;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    events_.push_back({phase, std::string(file), thread, startOffset.count(), duration.count(), counters});
+
+    auto &summary = summaries_[{phase, std::string(file), thread}];
+    ++summary.calls;
+    summary.seconds += duration.count() * 1.0e-6;
+    for (auto i = 0; i < counters.size(); ++i)
+        summary.counters[i] += counters[i];
+    summary.peakRSS = std::max(summary.peakRSS, rss);
+}
+
+// Write the summary and trace files
+void write()
+{
+    if (!enabled_)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime_;
+
+    // Summary, by phase / file / thread and then totalled by phase
+    auto summaryFile = outputPrefix_ + ".json";
+    auto summary = openOutput(summaryFile);
+    summary << fmt::format("{{\n  \"wall_seconds\": {:.6f},\n  \"peak_rss_bytes\": {},\n  \"phases\": [\n", elapsed.count(),
+                           peakRSS());
+    std::map<Phase, PhaseSummary> totals;
+    auto nWritten = 0;
+    for (const auto &[key, phaseSummary] : summaries_)
+    {
+        const auto &[phase, file, thread] = key;
+        summary << fmt::format("    {{\"phase\": \"{}\", \"file\": \"{}\", \"thread\": {}, \"calls\": {}, \"seconds\": {:.6f}, "
+                               "{}, \"peak_rss_bytes\": {}}}{}\n",
+                               phaseName(phase), escape(file), thread, phaseSummary.calls, phaseSummary.seconds,
+                               counterMembers(phaseSummary.counters), phaseSummary.peakRSS,
+                               ++nWritten == summaries_.size() ? "" : ",");
+
+        auto &total = totals[phase];
+        total.calls += phaseSummary.calls;
+        total.seconds += phaseSummary.seconds;
+        for (auto i = 0; i < total.counters.size(); ++i)
+            total.counters[i] += phaseSummary.counters[i];
+        total.peakRSS = std::max(total.peakRSS, phaseSummary.peakRSS);
+    }
+    summary << "  ],\n  \"totals\": [\n";
+    nWritten = 0;
+    for (const auto &[phase, total] : totals)
+        summary << fmt::format("    {{\"phase\": \"{}\", \"calls\": {}, \"seconds\": {:.6f}, {}, \"peak_rss_bytes\": {}}}{}\n",
+                               phaseName(phase), total.calls, total.seconds, counterMembers(total.counters), total.peakRSS,
+                               ++nWritten == totals.size() ? "" : ",");
+    summary << "  ]\n}\n";
+
+    // Chrome / Perfetto trace, with untimed counter updates as instant events
+    auto traceFile = outputPrefix_ + ".trace.json";
+    auto trace = openOutput(traceFile);
+    std::vector<std::string> traceEvents;
+    for (auto thread = 0; thread < nextThread_; ++thread)
+        traceEvents.push_back(fmt::format("{{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": {}, "
+                                          "\"args\": {{\"name\": \"thread {}\"}}}}",
+                                          thread, thread));
+    for (const auto &event : events_)
+    {
+        auto timing = event.duration > 0.0 ? fmt::format("\"ph\": \"X\", \"ts\": {:.3f}, \"dur\": {:.3f}", event.start,
+                                                         event.duration)
+                                           : fmt::format("\"ph\": \"i\", \"s\": \"t\", \"ts\": {:.3f}", event.start);
+        traceEvents.push_back(fmt::format("{{\"name\": \"{}\", \"cat\": \"np\", {}, \"pid\": 1, \"tid\": {}, "
+                                          "\"args\": {{\"file\": \"{}\", {}}}}}",
+                                          phaseName(event.phase), timing, event.thread, escape(event.file),
+                                          counterMembers(event.counters)));
+    }
+    trace << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    for (auto i = 0; i < traceEvents.size(); ++i)
+        trace << traceEvents[i] << (i == traceEvents.size() - 1 ? "\n" : ",\n");
+    trace << "]}\n";
+
+    fmt::print("Profile summary written to '{}' and trace to '{}'.\n", summaryFile, traceFile);
+}
+} // namespace Profiler
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <string_view>
+
+// Phase timers and counters, recorded per file and per thread only when profiling is enabled
+namespace Profiler
+{
+// Profiled phases
+enum class Phase
+{
+    Load,
+    Template,
+    Bin,
+    PostProcess,
+    Save,
+    nPhases
+};
+// Return text name for the specified phase
+std::string phaseName(Phase phase);
+
+// Counters recorded against phases
+enum class Counter
+{
+    BytesRead,
+    BytesWritten,
+    EventsBinned,
+    FramesProcessed,
+    FramesSkipped,
+    nCounters
+};
+// Return text name for the specified counter
+std::string counterName(Counter counter);
+using Counters = std::array<unsigned long long, int(Counter::nCounters)>;
+
+// Whether profiling is enabled - set once, before any profiled work begins
+extern bool enabled_;
+
+// Enable profiling, writing the summary to '<prefix>.json' and the Chrome trace to '<prefix>.trace.json'
+void enable(std::string outputPrefix);
+// Return whether profiling is enabled
+inline bool enabled() { return enabled_; }
+// Record completed work for the specified phase and file on the calling thread
+void record(Phase phase, std::string_view file, std::chrono::steady_clock::time_point start,
+            std::chrono::steady_clock::time_point end, const Counters &counters);
+// Add to a counter for the specified phase and file on the calling thread, without timing anything
+inline void count(Phase phase, std::string_view file, Counter counter, unsigned long long value)
+{
+    if (enabled_)
+    {
+        Counters counters{};
+        counters[int(counter)] = value;
+        auto now = std::chrono::steady_clock::now();
+        record(phase, file, now, now, counters);
+    }
+}
+// Write the summary and trace files
+void write();
+
+// Times a phase over its lifetime, recording it along with any counters added to it
+class Scope
+{
+    public:
+    Scope(Phase phase, std::string_view file = {})
+    {
+        if (enabled_)
+        {
+            active_ = true;
+            phase_ = phase;
+            file_ = file;
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+    ~Scope()
+    {
+        if (active_)
+            record(phase_, file_, start_, std::chrono::steady_clock::now(), counters_);
+    }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+    private:
+    // Whether the scope is being recorded
+    bool active_{false};
+    // Phase and file being timed
+    Phase phase_{Phase::Load};
+    std::string file_;
+    // Start time
+    std::chrono::steady_clock::time_point start_;
+    // Counters accumulated so far
+    Counters counters_{};
+
+    public:
+    // Add to the specified counter
+    void add(Counter counter, unsigned long long value)
+    {
+        if (active_)
+            counters_[int(counter)] += value;
+    }
+};
+} // namespace Profiler
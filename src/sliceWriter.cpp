@@ -0,0 +1,117 @@
+#include "sliceWriter.h"
+#include "processors.h"
+#include <algorithm>
+
+SliceWriter::SliceWriter(int depth, MultiSliceFile *output) : depth_(depth), output_(output)
+{
+    if (depth_ > 0)
+        thread_ = std::thread(&SliceWriter::writeQueued, this);
+}
+
+SliceWriter::~SliceWriter()
+{
+    // Any slices still queued are written before we go, but errors can no longer be reported
+    try
+    {
+        finish();
+    }
+    catch (...)
+    {
+    }
+}
+
+// Write queued slice sets until told to finish
+void SliceWriter::writeQueued()
+{
+    while (true)
+    {
+        std::vector<std::pair<Window, NeXuSFile>> slices;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queueChanged_.wait(lock, [&]() { return finishing_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;
+            slices = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        queueChanged_.notify_all();
+
+        try
+        {
+            Processors::postProcess(slices);
+            Processors::saveSlices(slices, output_);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_)
+                error_ = std::current_exception();
+        }
+
+        // The files are finished with, whether or not they were written successfully
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto &[slice, nxs] : slices)
+                pendingFiles_.erase(pendingFiles_.find(nxs.filename()));
+        }
+        queueChanged_.notify_all();
+    }
+}
+
+// Rethrow any exception captured by the writer thread
+void SliceWriter::checkError()
+{
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::swap(error, error_);
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// Post-process and save the supplied slices, waiting for space in the queue if necessary
+void SliceWriter::write(std::vector<std::pair<Window, NeXuSFile>> &&slices)
+{
+    // Without a writer thread we just write the slices ourselves
+    if (depth_ == 0)
+    {
+        Processors::postProcess(slices);
+        Processors::saveSlices(slices, output_);
+        return;
+    }
+
+    checkError();
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        queueChanged_.wait(lock, [&]() { return queue_.size() < depth_; });
+        for (const auto &[slice, nxs] : slices)
+            pendingFiles_.insert(nxs.filename());
+        queue_.push_back(std::move(slices));
+    }
+    queueChanged_.notify_all();
+}
+
+// Wait until no queued slices are still to be written to any of the specified files
+void SliceWriter::waitForFiles(const std::vector<std::string> &filenames)
+{
+    auto isPending = [&](const std::string &filename) { return pendingFiles_.find(filename) != pendingFiles_.end(); };
+    std::unique_lock<std::mutex> lock(mutex_);
+    queueChanged_.wait(lock, [&]() { return std::none_of(filenames.begin(), filenames.end(), isPending); });
+}
+
+// Wait for all queued slices to be written
+void SliceWriter::finish()
+{
+    if (thread_.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finishing_ = true;
+        }
+        queueChanged_.notify_all();
+        thread_.join();
+    }
+
+    checkError();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "multiSliceFile.h"
+#include "nexusFile.h"
+#include "window.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Post-processes and saves finished sets of slices, optionally on a background thread
+class SliceWriter
+{
+    public:
+    SliceWriter(int depth, MultiSliceFile *output = nullptr);
+    ~SliceWriter();
+    SliceWriter(const SliceWriter &) = delete;
+    SliceWriter &operator=(const SliceWriter &) = delete;
+
+    private:
+    // Maximum number of slice sets waiting to be written (zero to write synchronously)
+    int depth_{0};
+    // Single output file for all slices, if any
+    MultiSliceFile *output_{nullptr};
+    // Background writer thread
+    std::thread thread_;
+    // Mutex protecting the queue
+    std::mutex mutex_;
+    // Condition signalled when the queue changes, or we are finishing
+    std::condition_variable queueChanged_;
+    // Slice sets waiting to be written
+    std::deque<std::vector<std::pair<Window, NeXuSFile>>> queue_;
+    // Files of slices queued or being written
+    std::multiset<std::string> pendingFiles_;
+    // Whether the writer thread should finish once the queue is empty
+    bool finishing_{false};
+    // Captured exception from the writer thread
+    std::exception_ptr error_;
+
+    private:
+    // Write queued slice sets until told to finish
+    void writeQueued();
+    // Rethrow any exception captured by the writer thread
+    void checkError();
+
+    public:
+    // Post-process and save the supplied slices, waiting for space in the queue if necessary
+    void write(std::vector<std::pair<Window, NeXuSFile>> &&slices);
+    // Wait until no queued slices are still to be written to any of the specified files
+    void waitForFiles(const std::vector<std::string> &filenames);
+    // Wait for all queued slices to be written
+    void finish();
+};
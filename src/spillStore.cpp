@@ -0,0 +1,101 @@
+#include "spillStore.h"
+#include "profiler.h"
+#include <algorithm>
+#include <filesystem>
+#include <fmt/core.h>
+#include <stdexcept>
+
+SpillStore::SpillStore(std::string filename, int nSlices, int nRows, int nBins)
+    : filename_(std::move(filename)), nRows_(nRows), nBins_(nBins), stored_(nSlices, false)
+{
+    // Regions are only written when a slice is first spilled, so the file stays as small as the filesystem allows
+    stream_.open(filename_, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!stream_)
+        throw(std::runtime_error(fmt::format("Failed to create spill file '{}'.\n", filename_)));
+}
+
+SpillStore::~SpillStore()
+{
+    stream_.close();
+    std::error_code error;
+    std::filesystem::remove(filename_, error);
+}
+
+// Return number of rows to transfer at once
+int SpillStore::blockRows() const
+{
+    constexpr auto blockBytes = 4 * 1024 * 1024;
+    return std::max(1, int(blockBytes / (std::max(nBins_, 1) * sizeof(int))));
+}
+
+// Return file offset of the specified row of the specified slice
+std::streamoff SpillStore::offset(int slice, int row) const
+{
+    return (std::streamoff(slice) * nRows_ + row) * nBins_ * sizeof(int);
+}
+
+// Return filename
+const std::string &SpillStore::filename() const { return filename_; }
+
+// Return whether counts are stored for the specified slice
+bool SpillStore::hasCounts(int slice) const { return stored_[slice]; }
+
+// Return total number of times slices have been spilled
+int SpillStore::nSpills() const { return nSpills_; }
+
+// Add the supplied counts to those stored for the specified slice
+void SpillStore::spill(int slice, const CountsMatrix &counts)
+{
+    if (counts.nRows() != nRows_ || counts.nBins() != nBins_)
+        throw(std::runtime_error("Can't spill counts of differing size.\n"));
+
+    Profiler::Scope profile(Profiler::Phase::Save, filename_);
+    auto &buffer = buffer_;
+    for (auto firstRow = 0; firstRow < nRows_; firstRow += blockRows())
+    {
+        auto nRows = std::min(blockRows(), nRows_ - firstRow);
+        buffer.assign(std::size_t(nRows) * nBins_, 0);
+        if (stored_[slice])
+        {
+            stream_.seekg(offset(slice, firstRow));
+            stream_.read(reinterpret_cast<char *>(buffer.data()), buffer.size() * sizeof(int));
+        }
+        counts.addRows(firstRow, nRows, buffer.data());
+        stream_.seekp(offset(slice, firstRow));
+        stream_.write(reinterpret_cast<const char *>(buffer.data()), buffer.size() * sizeof(int));
+        profile.add(Profiler::Counter::BytesWritten, buffer.size() * sizeof(int));
+    }
+    if (!stream_)
+        throw(std::runtime_error(fmt::format("Failed to spill counts to '{}'.\n", filename_)));
+
+    stored_[slice] = true;
+    ++nSpills_;
+}
+
+// Add counts stored for the specified slice into the supplied matrix, removing them from the store
+void SpillStore::restore(int slice, CountsMatrix &counts)
+{
+    if (!stored_[slice])
+        return;
+    if (counts.nRows() != nRows_ || counts.nBins() != nBins_)
+        throw(std::runtime_error("Can't restore counts of differing size.\n"));
+
+    Profiler::Scope profile(Profiler::Phase::Load, filename_);
+    auto *data = counts.data();
+    auto &buffer = buffer_;
+    for (auto firstRow = 0; firstRow < nRows_; firstRow += blockRows())
+    {
+        auto nRows = std::min(blockRows(), nRows_ - firstRow);
+        buffer.resize(std::size_t(nRows) * nBins_);
+        stream_.seekg(offset(slice, firstRow));
+        stream_.read(reinterpret_cast<char *>(buffer.data()), buffer.size() * sizeof(int));
+        auto *destination = data + std::size_t(firstRow) * nBins_;
+        for (std::size_t i = 0; i < buffer.size(); ++i)
+            destination[i] += buffer[i];
+        profile.add(Profiler::Counter::BytesRead, buffer.size() * sizeof(int));
+    }
+    if (!stream_)
+        throw(std::runtime_error(fmt::format("Failed to restore counts from '{}'.\n", filename_)));
+
+    stored_[slice] = false;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "countsMatrix.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Scratch file holding detector counts spilled from memory, as a raw array of int32 rows x bins for each slice in turn
+class SpillStore
+{
+    public:
+    SpillStore(std::string filename, int nSlices, int nRows, int nBins);
+    ~SpillStore();
+    SpillStore(const SpillStore &) = delete;
+    SpillStore &operator=(const SpillStore &) = delete;
+
+    private:
+    // Scratch filename and stream
+    std::string filename_;
+    std::fstream stream_;
+    // Number of rows and bins of each slice
+    int nRows_{0}, nBins_{0};
+    // Whether counts are stored for each slice
+    std::vector<bool> stored_;
+    // Total number of times slices have been spilled
+    int nSpills_{0};
+    // Transfer buffer, reused by every spill and restore
+    std::vector<int> buffer_;
+
+    private:
+    // Return number of rows to transfer at once
+    int blockRows() const;
+    // Return file offset of the specified row of the specified slice
+    std::streamoff offset(int slice, int row) const;
+
+    public:
+    // Return filename
+    const std::string &filename() const;
+    // Return whether counts are stored for the specified slice
+    bool hasCounts(int slice) const;
+    // Return total number of times slices have been spilled
+    int nSpills() const;
+    // Add the supplied counts to those stored for the specified slice
+    void spill(int slice, const CountsMatrix &counts);
+    // Add counts stored for the specified slice into the supplied matrix, removing them from the store
+    void restore(int slice, CountsMatrix &counts);
+};
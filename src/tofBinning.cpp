@@ -0,0 +1,148 @@
+#include "tofBinning.h"
+#include <algorithm>
+
+namespace
+{
+// Maximum deviation, as a fraction of the bin width, of a bin edge from its expected position within a segment
+constexpr auto segmentTolerance = 0.1;
+// Maximum number of segments to use before treating the bin edges as irregular
+constexpr auto maxSegments = 8;
+// Number of lookup table buckets per bin for irregular bin edges, and the maximum size of the table
+constexpr auto lookupBucketsPerBin = 4;
+constexpr auto maxLookupBuckets = 1 << 20;
+} // namespace
+
+TOFBinning::TOFBinning(std::vector<double> edges) : edges_(std::move(edges))
+{
+    // With fewer than two edges we have no bins - store an empty range so that all lookups fail
+    if (edges_.size() < 2)
+    {
+        edges_ = {0.0, 0.0};
+        nBins_ = 0;
+        return;
+    }
+
+    nBins_ = edges_.size() - 1;
+
+    if (detectSegments())
+    {
+        if (segments_.size() > 1)
+            type_ = BinningType::Piecewise;
+        else
+            type_ = segments_.front().logarithmic ? BinningType::Logarithmic : BinningType::Linear;
+    }
+    else
+    {
+        type_ = BinningType::Irregular;
+        segments_.clear();
+        createLookup();
+    }
+}
+
+// Return text name for the specified binning type
+std::string TOFBinning::binningType(BinningType type)
+{
+    switch (type)
+    {
+        case (BinningType::Linear):
+            return "linear";
+        case (BinningType::Logarithmic):
+            return "logarithmic";
+        case (BinningType::Piecewise):
+            return "piecewise linear/logarithmic";
+        default:
+            return "irregular";
+    }
+}
+
+// Return the number of bins, starting at the specified bin, which can be described by a single segment
+int TOFBinning::segmentLength(int firstBin, bool logarithmic) const
+{
+    if (logarithmic && edges_[firstBin] <= 0.0)
+        return 0;
+
+    auto x = [&](int edge) { return logarithmic ? std::log(edges_[edge]) : edges_[edge]; };
+
+    // Extend the segment while the next edge lies where the mean bin width so far predicts it should
+    const auto origin = x(firstBin);
+    auto n = 1;
+    while (firstBin + n < nBins_)
+    {
+        auto width = (x(firstBin + n) - origin) / n;
+        if (width <= 0.0)
+            break;
+        if (std::fabs(x(firstBin + n + 1) - (origin + (n + 1) * width)) > segmentTolerance * width)
+            break;
+        ++n;
+    }
+
+    return n;
+}
+
+// Detect segments describing the bin edges, returning false if they can't be described efficiently
+bool TOFBinning::detectSegments()
+{
+    segments_.clear();
+
+    auto bin = 0;
+    while (bin < nBins_)
+    {
+        if (segments_.size() == maxSegments)
+            return false;
+
+        // Take whichever of a linear or logarithmic segment covers more bins
+        auto nLinear = segmentLength(bin, false), nLogarithmic = segmentLength(bin, true);
+        auto &segment = segments_.emplace_back();
+        segment.logarithmic = nLogarithmic > nLinear;
+        segment.firstBin = bin;
+        segment.lastBin = bin + std::max(nLinear, nLogarithmic) - 1;
+
+        auto lower = segment.logarithmic ? std::log(edges_[segment.firstBin]) : edges_[segment.firstBin];
+        auto upper = segment.logarithmic ? std::log(edges_[segment.lastBin + 1]) : edges_[segment.lastBin + 1];
+        if (upper <= lower)
+            return false;
+        segment.origin = lower;
+        segment.inverseWidth = (segment.lastBin - segment.firstBin + 1) / (upper - lower);
+
+        bin = segment.lastBin + 1;
+    }
+
+    return true;
+}
+
+// Set up the coarse lookup table for irregular bin edges
+void TOFBinning::createLookup()
+{
+    const auto nBuckets = std::min(nBins_ * lookupBucketsPerBin, maxLookupBuckets);
+    lookupOrigin_ = edges_.front();
+    lookupInverseWidth_ = nBuckets / (edges_.back() - edges_.front());
+
+    // Store the bin containing the lower edge of each bucket - the final entry catches rounding at the upper limit
+    lookup_.resize(nBuckets + 1);
+    for (auto bucket = 0; bucket <= nBuckets; ++bucket)
+    {
+        auto tof = lookupOrigin_ + bucket / lookupInverseWidth_;
+        int bin = std::upper_bound(edges_.begin(), edges_.end(), tof) - edges_.begin() - 1;
+        lookup_[bucket] = std::clamp(bin, 0, nBins_ - 1);
+    }
+}
+
+// Return bin edges
+const std::vector<double> &TOFBinning::edges() const { return edges_; }
+
+// Return number of bins
+int TOFBinning::nBins() const { return nBins_; }
+
+// Return detected binning type
+TOFBinning::BinningType TOFBinning::type() const { return type_; }
+
+// Return number of segments in piecewise binning
+int TOFBinning::nSegments() const { return segments_.size(); }
+
+// Return segments comprising the binning (empty if irregular)
+const std::vector<TOFBinning::Segment> &TOFBinning::segments() const { return segments_; }
+
+// Return coarse lookup table for irregular binning, along with its origin and reciprocal bucket width
+const std::vector<int> &TOFBinning::lookup() const { return lookup_; }
+double TOFBinning::lookupOrigin() const { return lookupOrigin_; }
+double TOFBinning::lookupInverseWidth() const { return lookupInverseWidth_; }
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+// Constant-time lookup of TOF bin indices from a set of monotonically increasing bin edges
+class TOFBinning
+{
+    public:
+    TOFBinning(std::vector<double> edges = {});
+    ~TOFBinning() = default;
+
+    // Detected binning types
+    enum class BinningType
+    {
+        Linear,
+        Logarithmic,
+        Piecewise,
+        Irregular
+    };
+    // Return text name for the specified binning type
+    static std::string binningType(BinningType type);
+
+    public:
+    // Contiguous run of bins with either constant width or constant width in log(TOF)
+    struct Segment
+    {
+        // Index of the first and last bins in the segment
+        int firstBin{0}, lastBin{0};
+        // Whether the segment is logarithmic (constant width in log(TOF))
+        bool logarithmic{false};
+        // Origin of the segment in the space in which bins are evenly spaced
+        double origin{0.0};
+        // Reciprocal bin width in the space in which bins are evenly spaced
+        double inverseWidth{0.0};
+    };
+
+    private:
+    // Bin edges
+    std::vector<double> edges_;
+    // Number of bins
+    int nBins_{0};
+    // Detected binning type
+    BinningType type_{BinningType::Irregular};
+    // Segments comprising the binning (if not irregular)
+    std::vector<Segment> segments_;
+    // Coarse lookup table giving the first bin to search from for evenly spaced TOF buckets (if irregular)
+    std::vector<int> lookup_;
+    // Origin and reciprocal width of lookup table buckets
+    double lookupOrigin_{0.0}, lookupInverseWidth_{0.0};
+
+    private:
+    // Return the number of bins, starting at the specified bin, which can be described by a single segment
+    int segmentLength(int firstBin, bool logarithmic) const;
+    // Detect segments describing the bin edges, returning false if they can't be described efficiently
+    bool detectSegments();
+    // Set up the coarse lookup table for irregular bin edges
+    void createLookup();
+    // Refine estimated bin index so that the bin contains the supplied TOF
+    int refine(double tof, int bin) const
+    {
+        while (tof < edges_[bin])
+            --bin;
+        while (tof >= edges_[bin + 1])
+            ++bin;
+        return bin;
+    }
+    // Return estimated bin index for the supplied TOF within the specified segment
+    static int estimate(const Segment &segment, double tof)
+    {
+        auto x = segment.logarithmic ? std::log(tof) : tof;
+        auto bin = segment.firstBin + int((x - segment.origin) * segment.inverseWidth);
+        return bin < segment.firstBin ? segment.firstBin : (bin > segment.lastBin ? segment.lastBin : bin);
+    }
+
+    public:
+    // Return bin edges
+    [[nodiscard]] const std::vector<double> &edges() const;
+    // Return number of bins
+    [[nodiscard]] int nBins() const;
+    // Return detected binning type
+    [[nodiscard]] BinningType type() const;
+    // Return number of segments in piecewise binning
+    [[nodiscard]] int nSegments() const;
+    // Return segments comprising the binning (empty if irregular)
+    [[nodiscard]] const std::vector<Segment> &segments() const;
+    // Return coarse lookup table for irregular binning, along with its origin and reciprocal bucket width
+    [[nodiscard]] const std::vector<int> &lookup() const;
+    [[nodiscard]] double lookupOrigin() const;
+    [[nodiscard]] double lookupInverseWidth() const;
+    // Return index of the bin containing the supplied TOF (bins are [lower, upper)), or -1 if it is out of range
+    [[nodiscard]] int bin(double tof) const
+    {
+        // Negated test so that NaN is also rejected
+        if (!(tof >= edges_.front() && tof < edges_.back()))
+            return -1;
+
+        switch (type_)
+        {
+            case (BinningType::Linear):
+            case (BinningType::Logarithmic):
+                return refine(tof, estimate(segments_.front(), tof));
+            case (BinningType::Piecewise):
+            {
+                auto segment = segments_.begin();
+                while (tof >= edges_[segment->lastBin + 1])
+                    ++segment;
+                return refine(tof, estimate(*segment, tof));
+            }
+            default:
+                return refine(tof, lookup_[int((tof - lookupOrigin_) * lookupInverseWidth_)]);
+        }
+    }
+};
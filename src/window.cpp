@@ -1,6 +1,15 @@
 #include "window.h"
+#include <cmath>
 
-Window::Window(std::string_view id, double startTime, double duration) : id_(id), startTime_(startTime), duration_(duration) {}
+Window::Window(std::string_view id, double startTime, double duration)
+    : id_(id), startTime_(startTime), duration_(duration), endTime_(startTime + duration)
+{
+}
+
+Window::Window(std::string_view id, double startTime, double duration, double endTime)
+    : id_(id), startTime_(startTime), duration_(duration), endTime_(endTime)
+{
+}
 
 // String ID
 std::string_view Window::id() const { return id_; }
@@ -9,10 +18,34 @@ std::string_view Window::id() const { return id_; }
 double Window::startTime() const { return startTime_; }
 
 // Return end time (seconds since epoch) of the window
-double Window::endTime() const { return startTime_ + duration_; }
+double Window::endTime() const { return endTime_; }
 
 // Shift start time by specified delta
-void Window::shiftStartTime(double delta) { startTime_ += delta; }
+void Window::shiftStartTime(double delta)
+{
+    startTime_ += delta;
+    endTime_ += delta;
+}
+
+// Return the window shifted forwards by the specified number of deltas
+Window Window::occurrence(long nShifts, double delta) const { return {id_, startTime_ + nShifts * delta, duration_}; }
+
+// Return the number of shifts by the specified delta required for the window to end at or after the given time
+long Window::nShiftsToReach(double time, double delta) const
+{
+    if (delta <= 0.0 || endTime() >= time)
+        return 0;
+
+    // Estimate the number of shifts, then correct for any rounding in the estimate
+    auto nShifts = long(std::ceil((time - endTime()) / delta));
+    auto shiftedEndTime = [&](long n) { return occurrence(n, delta).endTime(); };
+    while (nShifts > 1 && shiftedEndTime(nShifts - 1) >= time)
+        --nShifts;
+    while (shiftedEndTime(nShifts) < time)
+        ++nShifts;
+
+    return nShifts;
+}
 
 // Return duration of the pulse
 double Window::duration() const { return duration_; }
@@ -6,6 +6,7 @@ class Window
 {
     public:
     Window(std::string_view id, double startTime, double duration);
+    Window(std::string_view id, double startTime, double duration, double endTime);
     ~Window() = default;
 
     private:
@@ -15,6 +16,8 @@ class Window
     double startTime_{0};
     // Duration of the pulse
     double duration_{0};
+    // End time (seconds since epoch) of the pulse, which may differ from the start time plus duration by rounding
+    double endTime_{0};
 
     public:
     // Return string ID
@@ -25,6 +28,10 @@ class Window
     [[nodiscard]] double endTime() const;
     // Shift start time by specified delta
     void shiftStartTime(double delta);
+    // Return the window shifted forwards by the specified number of deltas
+    [[nodiscard]] Window occurrence(long nShifts, double delta) const;
+    // Return the number of shifts by the specified delta required for the window to end at or after the given time
+    [[nodiscard]] long nShiftsToReach(double time, double delta) const;
     // Return duration of the window
     [[nodiscard]] double duration() const;
 };
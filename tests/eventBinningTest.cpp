@@ -0,0 +1,143 @@
+#include "countsMatrix.h"
+#include "eventBinning.h"
+#include "testing.h"
+#include "tofBinning.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+using EventBinning::InstructionSet;
+
+namespace
+{
+// Number of spectra (ids run from 1, with every fifth one unknown)
+constexpr auto nSpectra = 40;
+// Block sizes to bin, chosen to leave various numbers of events for the vector kernels' scalar tails
+constexpr int blockSizes[] = {0, 1, 3, 7, 8, 15, 16, 17, 33, 1000, 4099};
+
+// Return TOF bin edges of the specified type
+std::vector<double> binEdges(TOFBinning::BinningType type, std::mt19937 &generator)
+{
+    std::vector<double> edges;
+    switch (type)
+    {
+        case (TOFBinning::BinningType::Linear):
+            for (auto n = 0; n <= 50; ++n)
+                edges.push_back(1000.0 + n * 20.0);
+            break;
+        case (TOFBinning::BinningType::Logarithmic):
+            for (auto n = 0; n <= 50; ++n)
+                edges.push_back(std::exp(std::log(1000.0) + n * std::log(1.01)));
+            break;
+        case (TOFBinning::BinningType::Piecewise):
+            for (auto n = 0; n <= 20; ++n)
+                edges.push_back(1000.0 + n * 20.0);
+            for (auto n = 1; n <= 30; ++n)
+                edges.push_back(std::exp(std::log(1400.0) + n * std::log(1.01)));
+            break;
+        default:
+        {
+            std::uniform_real_distribution<double> width(1.0, 40.0);
+            edges.push_back(1000.0);
+            for (auto n = 0; n < 50; ++n)
+                edges.push_back(edges.back() + width(generator));
+        }
+    }
+    return edges;
+}
+
+// Return map of spectrum ids to counts matrix rows, with every fifth spectrum unknown
+std::vector<int> spectrumRows()
+{
+    std::vector<int> rows(nSpectra + 1, -1);
+    auto row = 0;
+    for (auto id = 1; id <= nSpectra; ++id)
+        if (id % 5 != 0)
+            rows[id] = row++;
+    return rows;
+}
+
+// Generate a block of random events, concentrated on a few spectra and bins so that indices collide within vector blocks, and
+// including invalid ids and times on, between and outside the bin edges
+template <class IdType, class TimeType>
+void generateEvents(int nEvents, const std::vector<double> &edges, std::mt19937 &generator, std::vector<IdType> &ids,
+                    std::vector<TimeType> &times)
+{
+    std::uniform_int_distribution<int> kind(0, 9), hotId(1, 3), anyId(-3, nSpectra + 3), edge(0, edges.size() - 1);
+    std::uniform_real_distribution<double> time(edges.front() - 50.0, edges.back() + 50.0), hotTime(edges[2], edges[3]);
+
+    ids.resize(nEvents);
+    times.resize(nEvents);
+    for (auto n = 0; n < nEvents; ++n)
+    {
+        auto k = kind(generator);
+        ids[n] = IdType(k < 5 ? hotId(generator) : anyId(generator));
+        if (k < 4)
+            times[n] = TimeType(hotTime(generator));
+        else if (k < 6)
+            times[n] = TimeType(edges[edge(generator)]);
+        else if (k == 6)
+            times[n] = std::numeric_limits<TimeType>::quiet_NaN();
+        else
+            times[n] = TimeType(time(generator));
+    }
+}
+
+// Check each supported instruction set against the scalar kernel for the supplied id and time types
+template <class IdType, class TimeType> void checkKernels(const std::string &typeNames, std::mt19937 &generator)
+{
+    const auto rows = spectrumRows();
+    const auto nRows = *std::max_element(rows.begin(), rows.end()) + 1;
+
+    for (auto binningType : {TOFBinning::BinningType::Linear, TOFBinning::BinningType::Logarithmic,
+                             TOFBinning::BinningType::Piecewise, TOFBinning::BinningType::Irregular})
+    {
+        auto edges = binEdges(binningType, generator);
+        TOFBinning binning(edges);
+        if (!Testing::check(binning.type() == binningType, "Test bin edges detected as the wrong binning type."))
+            continue;
+
+        for (auto nEvents : blockSizes)
+        {
+            std::vector<IdType> ids;
+            std::vector<TimeType> times;
+            generateEvents(nEvents, edges, generator, ids, times);
+
+            CountsMatrix expected(nRows, binning.nBins());
+            EventBinning::binEvents(InstructionSet::Scalar, ids.data(), times.data(), nEvents, rows, binning, expected);
+            if (nEvents >= 1000)
+                Testing::check(expected.sum() > 0, "No test events were binned.");
+
+            for (auto set : {InstructionSet::AVX2, InstructionSet::AVX512})
+            {
+                if (!EventBinning::isSupported(set))
+                    continue;
+
+                CountsMatrix counts(nRows, binning.nBins());
+                EventBinning::binEvents(set, ids.data(), times.data(), nEvents, rows, binning, counts);
+                Testing::check(std::equal(counts.data(), counts.data() + counts.size(), expected.data()),
+                               fmt::format("{} kernel differs from scalar for {} events ({}, {} binning).",
+                                           EventBinning::instructionSet(set), nEvents, typeNames,
+                                           TOFBinning::binningType(binningType)));
+            }
+        }
+    }
+}
+} // namespace
+
+int main()
+{
+    std::mt19937 generator(4096);
+
+    for (auto set : {InstructionSet::AVX2, InstructionSet::AVX512})
+        fmt::print("Instruction set {} is {}supported.\n", EventBinning::instructionSet(set),
+                   EventBinning::isSupported(set) ? "" : "not ");
+
+    checkKernels<int, double>("int ids, double times", generator);
+    checkKernels<int, float>("int ids, float times", generator);
+    checkKernels<unsigned int, double>("unsigned ids, double times", generator);
+    checkKernels<unsigned int, float>("unsigned ids, float times", generator);
+
+    return Testing::result("eventBinningTest");
+}
@@ -0,0 +1,104 @@
+#include "nexusFile.h"
+#include "processors.h"
+#include "syntheticNeXuS.h"
+#include "testing.h"
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+
+/*
+ * Event files written by event processing should sum back to exactly the totals of summing the original runs. The check is
+ * made in a time zone observing DST at the time of the run, since the start times of event files must be read back by
+ * loadTimes() as the same instant they were written for.
+ */
+
+namespace
+{
+// Local time zone in which to run the test (Australia/Sydney), which observes DST over the new year
+constexpr auto timeZone = "AEST-10AEDT,M10.1.0,M4.1.0/3";
+// Number of slices to divide the window into
+constexpr auto nSlices = 2;
+
+// Detector counts and frame count read from an output file
+struct SliceTotals
+{
+    std::vector<int> counts;
+    int goodFrames{0};
+};
+
+// Read detector counts and good frames from the specified output file
+SliceTotals readTotals(const std::string &filename)
+{
+    std::lock_guard<std::recursive_mutex> lock(NeXuSFile::hdf5Mutex());
+    H5::H5File file(filename, H5F_ACC_RDONLY);
+    SliceTotals totals;
+    auto counts = file.openDataSet("raw_data_1/detector_1/counts");
+    totals.counts.resize(counts.getSpace().getSimpleExtentNpoints());
+    counts.read(totals.counts.data(), H5::PredType::NATIVE_INT);
+    file.openDataSet("raw_data_1/good_frames").read(&totals.goodFrames, H5::PredType::NATIVE_INT);
+    return totals;
+}
+} // namespace
+
+int main()
+{
+    setenv("TZ", timeZone, 1);
+    tzset();
+
+    // Check that times survive formatting and parsing, both in and out of DST
+    for (std::time_t time : {1704067203, 1719792000, 1712415600, 1728143999})
+        Testing::check(NeXuSFile::parseTime(NeXuSFile::formatTime(time)) == time,
+                       fmt::format("Time {} formatted as '{}' did not read back correctly.", time,
+                                   NeXuSFile::formatTime(time)));
+
+    auto directory = std::filesystem::temp_directory_path() / "np_eventFileTest";
+    std::filesystem::remove_all(directory);
+    for (auto subdirectory : {"summed", "events", "resummed"})
+        std::filesystem::create_directories(directory / subdirectory);
+    auto path = [&](const std::string &subdirectory) { return (directory / subdirectory).string() + "/"; };
+
+    // Write a run starting in DST
+    SyntheticRun run;
+    run.nSpectra = 50;
+    run.nBins = 100;
+    run.nFrames = 600;
+    run.eventsPerFrame = 50;
+    run.startTime = "2024-01-01T00:00:00";
+    auto runFilename = (directory / "run.nxs").string();
+    writeSyntheticNeXuS(runFilename, run);
+
+    NeXuSFile runFile(runFilename);
+    runFile.loadTimes();
+    std::time_t runStart = runFile.startSinceEpoch();
+    Testing::check(std::localtime(&runStart)->tm_isdst > 0, "Test run does not start during DST.");
+
+    // Sum the run directly, and via event files for each slice - the window delta doesn't divide an hour, so that frames
+    // misplaced by a DST offset can't land in the same slices of another occurrence
+    Window window("dst", runFile.startSinceEpoch() + 3.3, 12.0);
+    const auto windowDelta = 21.7;
+    Processors::processSummed({runFilename}, path("summed"), window, nSlices, windowDelta);
+    Processors::processEvents({runFilename}, path("events"), window, nSlices, windowDelta);
+    std::vector<std::string> eventFilenames;
+    for (const auto &entry : std::filesystem::directory_iterator(directory / "events"))
+        eventFilenames.push_back(entry.path().string());
+    std::sort(eventFilenames.begin(), eventFilenames.end());
+    Testing::check(eventFilenames.size() > nSlices, "Too few event files were written.");
+    Processors::processSummed(eventFilenames, path("resummed"), window, nSlices, windowDelta);
+
+    for (auto slice = 0; slice < nSlices; ++slice)
+    {
+        auto direct = readTotals(Processors::sliceFilename(window, nSlices, slice, path("summed")));
+        auto resummed = readTotals(Processors::sliceFilename(window, nSlices, slice, path("resummed")));
+        Testing::check(direct.goodFrames > 0, fmt::format("Slice {} has no frames.", slice + 1));
+        Testing::check(resummed.goodFrames == direct.goodFrames,
+                       fmt::format("Slice {} summed from event files has {} frames (expected {}).", slice + 1,
+                                   resummed.goodFrames, direct.goodFrames));
+        Testing::check(resummed.counts == direct.counts,
+                       fmt::format("Slice {} summed from event files has different detector counts.", slice + 1));
+    }
+
+    std::filesystem::remove_all(directory);
+
+    return Testing::result("eventFileTest");
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <fmt/core.h>
+#include <string_view>
+
+// Minimal checking support for the unit tests, each of which is a standalone executable returning non-zero on failure
+namespace Testing
+{
+// Return number of failed checks
+inline int &nFailures()
+{
+    static int nFailures = 0;
+    return nFailures;
+}
+
+// Check the supplied condition, reporting the description if it is false (and returning the condition)
+inline bool check(bool condition, std::string_view description)
+{
+    if (!condition)
+    {
+        fmt::print("FAILED: {}\n", description);
+        ++nFailures();
+    }
+    return condition;
+}
+
+// Report the overall result, returning the exit code for the test
+inline int result(std::string_view testName)
+{
+    if (nFailures() == 0)
+        fmt::print("{}: all checks passed.\n", testName);
+    else
+        fmt::print("{}: {} check(s) failed.\n", testName, nFailures());
+    return nFailures() == 0 ? 0 : 1;
+}
+}; // namespace Testing
@@ -0,0 +1,113 @@
+#include "testing.h"
+#include "tofBinning.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+namespace
+{
+// Return reference bin index for the supplied TOF, or -1 if it is out of range
+int referenceBin(const std::vector<double> &edges, double tof)
+{
+    if (!(tof >= edges.front() && tof < edges.back()))
+        return -1;
+    return std::upper_bound(edges.begin(), edges.end(), tof) - edges.begin() - 1;
+}
+
+// Return linear bin edges
+std::vector<double> linearEdges(double first, double width, int nBins)
+{
+    std::vector<double> edges(nBins + 1);
+    for (auto n = 0; n <= nBins; ++n)
+        edges[n] = first + n * width;
+    return edges;
+}
+
+// Return logarithmic bin edges, each bin being wider than the last by the specified factor
+std::vector<double> logarithmicEdges(double first, double factor, int nBins)
+{
+    std::vector<double> edges(nBins + 1);
+    for (auto n = 0; n <= nBins; ++n)
+        edges[n] = std::exp(std::log(first) + n * std::log(factor));
+    return edges;
+}
+
+// Append bin edges to another set, skipping the first which must coincide with the last of the existing edges
+void appendEdges(std::vector<double> &edges, const std::vector<double> &extra)
+{
+    edges.insert(edges.end(), extra.begin() + 1, extra.end());
+}
+
+// Return bin edges of random width
+std::vector<double> irregularEdges(double first, int nBins, std::mt19937 &generator)
+{
+    std::uniform_real_distribution<double> width(0.5, 50.0);
+    std::vector<double> edges{first};
+    for (auto n = 0; n < nBins; ++n)
+        edges.push_back(edges.back() + width(generator));
+    return edges;
+}
+
+// Check bin lookups against the reference for edges, values either side of them, bin centres, random and out-of-range values
+void checkBinning(const std::string &name, const std::vector<double> &edges, TOFBinning::BinningType expectedType,
+                  std::mt19937 &generator)
+{
+    TOFBinning binning(edges);
+    Testing::check(binning.type() == expectedType,
+                   fmt::format("{} edges detected as {} binning.", name, TOFBinning::binningType(binning.type())));
+    Testing::check(binning.nBins() == int(edges.size()) - 1, fmt::format("{} binning has the wrong number of bins.", name));
+
+    std::vector<double> values;
+    for (auto n = 0; n < edges.size(); ++n)
+    {
+        values.push_back(edges[n]);
+        values.push_back(std::nextafter(edges[n], -std::numeric_limits<double>::infinity()));
+        values.push_back(std::nextafter(edges[n], std::numeric_limits<double>::infinity()));
+        if (n + 1 < edges.size())
+            values.push_back(0.5 * (edges[n] + edges[n + 1]));
+    }
+    auto range = edges.back() - edges.front();
+    std::uniform_real_distribution<double> random(edges.front() - 0.1 * range, edges.back() + 0.1 * range);
+    for (auto n = 0; n < 100000; ++n)
+        values.push_back(random(generator));
+    for (auto value : {-std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(),
+                       std::numeric_limits<double>::quiet_NaN(), -1.0e300, 1.0e300, 0.0, -0.0})
+        values.push_back(value);
+
+    for (auto tof : values)
+    {
+        auto expected = referenceBin(edges, tof);
+        auto bin = binning.bin(tof);
+        if (!Testing::check(bin == expected,
+                            fmt::format("{} binning gave bin {} for TOF {:.17g} (expected {}).", name, bin, tof, expected)))
+            return;
+    }
+}
+} // namespace
+
+int main()
+{
+    std::mt19937 generator(2024);
+
+    checkBinning("Linear", linearEdges(0.0, 10.0, 2000), TOFBinning::BinningType::Linear, generator);
+    checkBinning("Non-integral linear", linearEdges(1000.1, 0.3, 5000), TOFBinning::BinningType::Linear, generator);
+    checkBinning("Logarithmic", logarithmicEdges(1000.0, 1.001, 3000), TOFBinning::BinningType::Logarithmic, generator);
+
+    auto piecewise = linearEdges(500.0, 5.0, 100);
+    appendEdges(piecewise, logarithmicEdges(piecewise.back(), 1.002, 1000));
+    appendEdges(piecewise, linearEdges(piecewise.back(), 20.0, 200));
+    checkBinning("Piecewise", piecewise, TOFBinning::BinningType::Piecewise, generator);
+
+    checkBinning("Irregular", irregularEdges(100.0, 1500, generator), TOFBinning::BinningType::Irregular, generator);
+
+    // Binnings without any bins reject everything
+    for (auto &&edges : {std::vector<double>{}, std::vector<double>{10.0}})
+    {
+        TOFBinning empty(edges);
+        Testing::check(empty.nBins() == 0 && empty.bin(10.0) == -1 && empty.bin(0.0) == -1,
+                       "Binning without bins returned a bin.");
+    }
+
+    return Testing::result("tofBinningTest");
+}